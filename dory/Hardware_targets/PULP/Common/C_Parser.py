@@ -25,7 +25,9 @@ import shutil
 from dory.Parsers.Parser_HW_to_C import Parser_HW_to_C
 import dory.Utils.Templates_writer.Layer2D_template_writer as Layer2D_writer
 import dory.Utils.Templates_writer.Makefile_template_writer as Makefile_writer
+import dory.Parsers.Network_planner as Network_planner
 from dory.Utils.Templates_writer.TemplateWriter import TemplateWriter
+from dory.Hardware_targets.PULP.Common.Tiler import layer_double_buffering
 import dory.Hardware_targets.PULP.Backend_Kernels.BackendKernelsAdapter as BackendKernelsAdapter
 
 
@@ -81,7 +83,16 @@ class C_Parser_PULP(Parser_HW_to_C):
             shutil.copy(file, self.inc_dir)
 
     def l2_template_keywords(self, node, backend_library):
-        return Layer2D_writer.print_template_layer(node, backend_library, double_buffering=self.double_buffering)
+        if "DepthwisePointwise" in node.name:
+            tk = Layer2D_writer.print_template_layer_dw_pw(node, backend_library, double_buffering=self.double_buffering)
+        elif "FusedGroup" in node.name:
+            tk = Layer2D_writer.print_template_layer_fused_group(node, backend_library, double_buffering=self.double_buffering)
+        else:
+            tk = Layer2D_writer.print_template_layer(node, backend_library,
+                                                     double_buffering=layer_double_buffering(self.HW_description, node.name, self.double_buffering))
+        # the first layer waits for the rows of its input, see network_args_t.input_stream
+        tk['stream_input'] = node is self.HWgraph[0] and Network_planner.input_streaming(self.HWgraph)
+        return tk
 
     def mapping_layers_to_C_files(self):
         print("\nMapping the layers files to their templates and copying the kernels associated.")
@@ -120,6 +131,10 @@ class C_Parser_PULP(Parser_HW_to_C):
                     tk = self.l2_template_keywords(node, backend_library)
                     TemplateWriter.write(tk, self.l2_template_mapping(node, backend_library))
                     node.name = node.name[:-7]
+            elif node.fused_layers() > 1:
+                # the L1 output tile is already the one of the geometry of the fused layers
+                tk = self.l2_template_keywords(node, backend_library)
+                TemplateWriter.write(tk, self.l2_template_mapping(node, backend_library))
             else:
                 if node.tiling_dimensions["L2"]["input_dimensions"][2] == node.tiling_dimensions["L1"]["input_dimensions"][2]:
                     node.tiling_dimensions["L1"]["output_dimensions"][2] = int((node.tiling_dimensions["L1"]["input_dimensions"][2] + (node.pads[1] + node.pads[3]) - node.kernel_shape[1] + node.strides[1]) / node.strides[1])
@@ -27,6 +27,7 @@ import os
 from dory.Parsers import HW_node, Layer_node
 from dory.Parsers.Parser_DORY_to_HW import Parser_DORY_to_HW
 from functools import partial
+from .Tiler.tiler_dw_pw import fused_node_fits_L2
 
 
 
@@ -37,6 +38,7 @@ class onnx_manager_PULP(Parser_DORY_to_HW):
         layers_supported_by_HW_Backend_IR = ["Convolution", "Pooling", "FullyConnected", "Addition", "QAddition"]
         layers_supported_by_HW_Backend_IR+= ["ReluConvolution", "ReluPooling", "ReluFullyConnected", "ReluAddition", "ReluQAddition"]
         layers_supported_by_HW_Backend_IR+= ["BNReluConvolution", "RequantPooling", "BNReluFullyConnected", "BNReluAddition", "BNReluQAddition"]
+        layers_supported_by_HW_Backend_IR+= ["DepthwisePointwiseBNReluConvolution", "FusedGroupBNReluConvolution"]
         file_path = self.get_file_path()
         pattern_rewriter = self.get_pattern_rewriter()
         with open(os.path.join(file_path, "pattern_rules.json")) as f:
@@ -53,6 +55,9 @@ class onnx_manager_PULP(Parser_DORY_to_HW):
             db = 2
 
         self.double_buffering = db
+
+        pattern_rewriter.L1_memory = HW_description["memory"]["L1"]["dimension"] - HW_description["HW specific parameters"]["accelerator core0 stack"] - 7 * HW_description["HW specific parameters"]["accelerator core1-7 stack"]
+        pattern_rewriter.L2_memory = HW_description["memory"]["L2"]["dimension"] - config_file["code reserved space"]
         
             
         tiler = self.get_tiler()
@@ -103,18 +108,58 @@ class onnx_manager_PULP(Parser_DORY_to_HW):
                     weights["value"] = weights["value"][:,:,None,:]
                 weights["value"] = np.transpose(weights["value"], (0,2,3,1))
                 weights["layout"] = "CoutKCin"
+            if "DepthwisePointwise" in node.name and node.dw_weights["layout"] == "CoutCinK":
+                node.dw_weights["value"] = np.transpose(node.dw_weights["value"], (0,2,3,1))
+                node.dw_weights["layout"] = "CoutKCin"
+            if "FusedGroup" in node.name:
+                for layer in node.fused_chain[:-1]:
+                    if layer["op"] == "conv" and layer["weights"]["layout"] == "CoutCinK":
+                        layer["weights"]["value"] = np.transpose(layer["weights"]["value"], (0,2,3,1))
+                        layer["weights"]["layout"] = "CoutKCin"
 
     def adjust_data_layout(self):
         print("\nPULP Backend: Adjusting Data Layout to HWC and CoutKCin.")
         for i, node in enumerate(self.DORY_Graph):
              self.adjust_node_data_layout(node, i)
 
+    def tiling(self):
+        # Fused nodes keep all their layers in L2. The pattern rewriter can't know whether the
+        # previous layer leaves its output in L3: in that case, or if the fused node does not fit L2,
+        # it is replaced by its original layers, which are tiled as any other node.
+        print("\nInsert tiling parameters per layer inside graph nodes")
+        prev = None
+        i = 0
+        while i < len(self.DORY_Graph):
+            node = self.DORY_Graph[i]
+            if node.fused_layers() > 1 and not fused_node_fits_L2(node, prev if prev else node, self.config_file["code reserved space"]):
+                print("  {}: input in L3 or not fitting L2, its {} layers are tiled separately.".format(node.name, node.fused_layers()))
+                self.DORY_Graph[i:i + 1] = self.unfuse_node(node, i)
+                continue
+            node.create_tiling_dimensions(prev if prev else node, self.config_file)
+            prev = node
+            i += 1
+
+    def unfuse_node(self, node, node_id):
+        # The layers of a fused node, stored by the pattern rewriter before any backend pass,
+        # go through the same passes as the rest of the graph.
+        layers = node.unfused_nodes
+        for k, layer in enumerate(layers):
+            self.adjust_node_data_layout(layer, node_id + k)
+            layer.add_memory_and_MACs()
+            # only the first layer reads the inputs of the fused node, and only the last one writes its output
+            layer.add_existing_parameter("branch_in", node.branch_in if k == 0 else 0)
+            for key in ["branch_out", "branch_change", "branch_last"]:
+                layer.add_existing_parameter(key, getattr(node, key) if k == len(layers) - 1 else 0)
+        return [HW_node.HW_node(layer, self.HW_description) for layer in layers]
+
     def check_parameters(self):
         WARNINGS =0
         for node in self.DORY_Graph:
             for key, value in node.__dict__.items():
                 if key not in HW_node.HW_node(Layer_node.Layer_node(), self.HW_description).__dict__.keys() and key not in Layer_node.Layer_node().__dict__.keys():
-                    if key not in node.constant_names:
+                    # dw_* attributes hold the depthwise half of a fused DepthwisePointwise node,
+                    # fused_chain the layers of a FusedGroup node, unfused_nodes the original layers of both
+                    if key not in node.constant_names and not key.startswith("dw_") and key not in ["fused_chain", "unfused_nodes"]:
                         print("WARNING: DORY Backend. Attribute {} of Node {} is not inside the predefined parameters for DORY nodes.".format(key, node.name))
                         WARNINGS +=1
                 if isinstance(value,list):
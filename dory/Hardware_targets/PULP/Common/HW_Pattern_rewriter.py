@@ -16,7 +16,18 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import copy
+import numpy as np
+
+from .Tiler.tiler_dw_pw import dw_pw_l1_memory, dw_pw_weights_memory
+from .Tiler.tiler_fused_group import fused_layer_params, fused_group_band, fused_group_recompute, fused_group_weights_memory, MAX_RECOMPUTE
+
+
 class Pattern_rewriter_PULP:
+    # Memory budgets used to decide whether two layers can be fused, set by onnx_manager_PULP
+    L1_memory = None
+    L2_memory = None
+
     def __init__(self, graph):
         self.graph = graph
 
@@ -27,6 +38,12 @@ class Pattern_rewriter_PULP:
             self.NodeRequant_pattern_rewriter(i)
         if rule in ["ConvolutionRelu", "FullyConnectedRelu", "AdditionRelu", "QAdditionRelu", "PoolingRelu"]:
             self.NodeRelu_pattern_rewriter(i)
+        if rule in ["DepthwisePointwise"]:
+            # a pair of convolutions that is not a depthwise + pointwise can still be a fused group
+            if not self.DepthwisePointwise_pattern_rewriter(i):
+                self.FusedGroup_pattern_rewriter(i)
+        if rule in ["FusedGroupPooling", "FusedGroupAppend", "FusedGroupAppendPooling"]:
+            self.FusedGroup_pattern_rewriter(i)
         return self.graph
 
     def NodeBNRelu_pattern_rewriter(self, i):
@@ -86,3 +103,140 @@ class Pattern_rewriter_PULP:
             del self.graph[ele]
         self.graph.insert(i[0], DORY_Relu_node)
 
+    def DepthwisePointwise_fusable(self, dw, pw):
+        # 8-bit BNRelu depthwise followed by a 1x1 BNRelu convolution that is the only consumer
+        # of its output, without biases, and small enough to keep both weights in L1 and the
+        # whole layer in L2.
+        if self.L1_memory is None or self.L2_memory is None:
+            return False
+        # a grouped convolution with more than one channel per group is not a depthwise
+        if not (dw.group == dw.input_channels == dw.output_channels > 1 and pw.group == 1):
+            return False
+        if list(pw.kernel_shape) != [1, 1] or list(pw.strides) != [1, 1] or any(pw.pads):
+            return False
+        if any(d != 1 for d in dw.dilations):
+            return False
+        for node in [dw, pw]:
+            if any("bias" in name for name in node.constant_names):
+                return False
+            if not (node.input_activation_bits == node.output_activation_bits == node.weight_bits == 8):
+                return False
+        if dw.constant_bits != pw.constant_bits:
+            return False
+        for node in self.graph:
+            if node is not pw and dw.output_index in node.input_indexes:
+                return False
+        if len(dw.input_dimensions) == 0 or len(pw.output_dimensions) == 0:
+            return False
+        channels = dw.input_channels
+        l1 = dw_pw_l1_memory(channels, pw.output_channels, dw.input_dimensions[1], pw.output_dimensions[1],
+                             dw.kernel_shape[0], 1, dw.kernel_shape, dw.pads, pw.constant_bits, 2)
+        l2 = channels * np.prod(dw.input_dimensions) + pw.output_channels * np.prod(pw.output_dimensions) + \
+            dw_pw_weights_memory(channels, pw.output_channels, dw.kernel_shape, pw.constant_bits)
+        return l1 <= self.L1_memory and l2 <= self.L2_memory
+
+    def DepthwisePointwise_pattern_rewriter(self, i):
+        DORY_DW_node = self.graph[i[0]]
+        DORY_PW_node = self.graph[i[1]]
+        if not self.DepthwisePointwise_fusable(DORY_DW_node, DORY_PW_node):
+            return False
+        # The fused node is the pointwise one, taking the input of the depthwise;
+        # the depthwise geometry and constants are kept in the dw_* attributes.
+        # The original layers are kept in unfused_nodes, see onnx_manager_PULP.tiling.
+        unfused_nodes = [copy.deepcopy(DORY_DW_node), copy.deepcopy(DORY_PW_node)]
+        DORY_DWPW_node = DORY_PW_node
+        DORY_DWPW_node.name = "DepthwisePointwise"+DORY_PW_node.name
+        DORY_DWPW_node.op_type = "DepthwisePointwise"+DORY_PW_node.op_type
+        DORY_DWPW_node.input_indexes = DORY_DW_node.input_indexes
+        DORY_DWPW_node.input_channels = DORY_DW_node.input_channels
+        DORY_DWPW_node.input_dimensions = DORY_DW_node.input_dimensions
+        DORY_DWPW_node.input_activation_bits = DORY_DW_node.input_activation_bits
+        DORY_DWPW_node.input_activation_type = DORY_DW_node.input_activation_type
+        DORY_DWPW_node.dw_kernel_shape = DORY_DW_node.kernel_shape
+        DORY_DWPW_node.dw_strides = DORY_DW_node.strides
+        DORY_DWPW_node.dw_pads = DORY_DW_node.pads
+        for name in DORY_DW_node.constant_names:
+            if name not in ["l","k","outshift","outmul"]:
+                DORY_DWPW_node.dw_weights = DORY_DW_node.__dict__[name]
+        DORY_DWPW_node.dw_k = DORY_DW_node.k
+        DORY_DWPW_node.dw_l = DORY_DW_node.l
+        DORY_DWPW_node.dw_outshift = DORY_DW_node.outshift
+        DORY_DWPW_node.unfused_nodes = unfused_nodes
+        for ele in sorted(i, reverse = True):
+            del self.graph[ele]
+        self.graph.insert(i[0], DORY_DWPW_node)
+        return True
+
+    # Longest chain of layers computed in a single fused group
+    MAX_FUSED_LAYERS = 4
+
+    def FusedGroup_chain(self, nodes):
+        # Layers of the group obtained by fusing nodes, or None if they cannot be fused:
+        # 8-bit BNRelu convolutions without biases, with optional max poolings between them,
+        # each layer being the only consumer of the output of the previous one.
+        if self.L1_memory is None or self.L2_memory is None:
+            return None
+        if any(len(node.input_dimensions) == 0 or len(node.output_dimensions) == 0 for node in nodes):
+            return None
+        chain = []
+        for node in nodes:
+            if "FusedGroup" in node.name:
+                constants = fused_layer_params(node, "conv")
+                last = dict(node.fused_chain[-1])
+                last.update({key: constants[key] for key in ["weights", "k", "l", "outshift"]})
+                chain += node.fused_chain[:-1] + [last]
+            elif node.name == "BNReluConvolution":
+                if node.group != 1 or any(d != 1 for d in node.dilations):
+                    return None
+                if any("bias" in name for name in node.constant_names) or node.weight_bits != 8:
+                    return None
+                chain.append(fused_layer_params(node, "conv", constants=node is not nodes[-1]))
+            elif node.name == "Pooling" and "Max" in node.op_type and "Global" not in node.op_type:
+                chain.append(fused_layer_params(node, "maxpool"))
+            else:
+                return None
+            if not (node.input_activation_bits == node.output_activation_bits == 8):
+                return None
+        if len(chain) > self.MAX_FUSED_LAYERS or chain[-1]["op"] != "conv":
+            return None
+        if any(node.constant_bits != nodes[-1].constant_bits for node in nodes if "Pooling" not in node.name):
+            return None
+        for node, next_node in zip(nodes[:-1], nodes[1:]):
+            for other in self.graph:
+                if other is not next_node and node.output_index in other.input_indexes:
+                    return None
+        # the group is never tiled from L3, and its halos must not cost more than the saved L2 traffic
+        l2 = nodes[0].input_channels * np.prod(nodes[0].input_dimensions) + nodes[-1].output_channels * np.prod(nodes[-1].output_dimensions) + \
+            fused_group_weights_memory(chain, nodes[-1].constant_bits)
+        if l2 > self.L2_memory:
+            return None
+        band_h = fused_group_band(chain, self.L1_memory, nodes[-1].constant_bits, 2)
+        if band_h == 0 or fused_group_recompute(chain, band_h) > MAX_RECOMPUTE:
+            return None
+        return chain
+
+    def FusedGroup_pattern_rewriter(self, i):
+        nodes = [self.graph[j] for j in i]
+        chain = self.FusedGroup_chain(nodes)
+        if chain is None:
+            return False
+        # The fused node is the last convolution, taking the input of the first layer;
+        # the geometry of every layer, and the constants of all but the last one, are in fused_chain.
+        # The original layers are kept in unfused_nodes, see onnx_manager_PULP.tiling.
+        unfused_nodes = []
+        for node in nodes:
+            unfused_nodes += node.unfused_nodes if "FusedGroup" in node.name else [copy.deepcopy(node)]
+        DORY_Fused_node = nodes[-1]
+        DORY_Fused_node.name = "FusedGroup"+nodes[-1].name
+        DORY_Fused_node.op_type = "FusedGroup"+nodes[-1].op_type
+        DORY_Fused_node.input_indexes = nodes[0].input_indexes
+        DORY_Fused_node.input_channels = nodes[0].input_channels
+        DORY_Fused_node.input_dimensions = nodes[0].input_dimensions
+        DORY_Fused_node.input_activation_bits = nodes[0].input_activation_bits
+        DORY_Fused_node.input_activation_type = nodes[0].input_activation_type
+        DORY_Fused_node.fused_chain = chain
+        DORY_Fused_node.unfused_nodes = unfused_nodes
+        for ele in sorted(i, reverse = True):
+            del self.graph[ele]
+        self.graph.insert(min(i), DORY_Fused_node)
+        return True
@@ -56,9 +56,15 @@ APP_CFLAGS += -DFLASH_TYPE=$(FLASH_TYPE) -DUSE_$(FLASH_TYPE) -DUSE_$(RAM_TYPE)
 % if blocking_dma:
 APP_CFLAGS += -DALWAYS_BLOCK_DMA_TRANSFERS
 % endif
+% if dma_queue_depth:
+APP_CFLAGS += -DDORY_DMA_QUEUE_DEPTH=${dma_queue_depth}
+% endif
 % if single_core_dma:
 APP_CFLAGS += -DSINGLE_CORE_DMA
 % endif
+% if resident_cluster:
+APP_CFLAGS += -DRESIDENT_CLUSTER
+% endif
 % if mchan_check_end_policy:
 APP_CFLAGS += -DMCHAN_${mchan_check_end_policy.upper()}
 % endif
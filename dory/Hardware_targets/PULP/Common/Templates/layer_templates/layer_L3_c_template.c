@@ -31,9 +31,82 @@
 #include "bsp/flash/hyperflash.h"
 #include "bsp/ram/hyperram.h"
 #include "net_utils.h"
+#include "dory_trace.h"
+% if compressed_weights:
+#include "dory_weights_decoder.h"
+% endif
+% if compressed_input or compressed_output:
+#include "dory_activations_codec.h"
+% endif
+<%
+  # offset in the input of the first band after the one at the top, and between two bands
+  x_first_offset = dim_in - int(conv_overlap1*n_in*w_in*BitIn/8) - int(padding*n_in*w_in*BitIn/8)
+  x_band_step = dim_in - int(conv_overlap1*n_in*w_in*BitIn/8)
+%>
+
+% if n_tile_W > 1:
+% if compressed_weights:
+// Offset in L3 of each compressed weights tile, and of their end
+static const unsigned int ${func_name_L3}_w_offset[${n_tile_W + 1}] = {${", ".join(str(offset) for offset in w_tile_offset)}};
+
+// Reads from L3 a compressed output channels tile of weights, bias, k and lambda
+static void ${func_name_L3}_read_weights(const pi_device_t *ram, unsigned int l3_W, int tile, void *w, pi_cl_ram_req_t *req)
+{
+  int size = ${func_name_L3}_w_offset[tile + 1] - ${func_name_L3}_w_offset[tile];
+  DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(size));
+  pi_cl_ram_read(ram, l3_W + ${func_name_L3}_w_offset[tile], w, size, req);
+}
+% else:
+// Reads from L3 an output channels tile of weights, bias, k and lambda, contiguous in L3 and in L2
+static void ${func_name_L3}_read_weights(const pi_device_t *ram, unsigned int l3_W, int tile, void *w, pi_cl_ram_req_t *req)
+{
+  DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${l3_tile_dim}));
+  pi_cl_ram_read(ram, l3_W + tile * ${l3_tile_dim}, w, ${l3_tile_dim}, req);
+}
+% endif
 
+% endif
+% if compressed_input:
+// The input is compressed in L3 (see dory_activations_codec.h). A band, given by its offset in the
+// uncompressed input, is read in a staging buffer that follows the table of the rows in L2, then
+// expanded in the double buffer by all the cores.
+static void ${func_name_L3}_read_input(const pi_device_t *ram, unsigned int l3_x, int offset, void *staging, pi_cl_ram_req_t *req)
+{
+  const uint32_t *row_offset = (const uint32_t *) staging - ${x_rows + 1};
+  int row = offset / ${x_row_size};
+  int rows = ${x_rows} - row < ${h_in} ? ${x_rows} - row : ${h_in};
+  int size = row_offset[row + rows] - row_offset[row];
+  DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(size));
+  pi_cl_ram_read(ram, l3_x + ${4 * (x_rows + 1)} + row_offset[row], staging, size, req);
+}
 
+static void ${func_name_L3}_decode_input(int offset, void *staging, void *x)
+{
+  const uint32_t *row_offset = (const uint32_t *) staging - ${x_rows + 1};
+  int row = offset / ${x_row_size};
+  int rows = ${x_rows} - row < ${h_in} ? ${x_rows} - row : ${h_in};
+  dory_activations_decode(staging, x, row_offset + row, rows, ${x_row_size});
+}
+
+% endif
+% if compressed_output:
+// The output is compressed in L3 (see dory_activations_codec.h). All the cores compress a band in a
+// staging buffer that follows the table of the rows in L2, then core 0 writes it after the bands
+// before; the table is written once all the bands are.
+static void ${func_name_L3}_write_output(const pi_device_t *ram, unsigned int l3_y, int band, void *y, void *staging, pi_cl_ram_req_t *req)
+{
+  uint32_t *row_offset = (uint32_t *) staging - ${y_rows + 1};
+  int row = band * ${h_out};
+  int rows = ${y_rows} - row < ${h_out} ? ${y_rows} - row : ${h_out};
+  dory_activations_encode(y, staging, row_offset + row, rows, ${y_row_size});
+  if(pi_core_id()==0) {
+    int size = row_offset[row + rows] - row_offset[row];
+    DORY_TRACE(DORY_TRACE_L3_WRITE_START, DORY_TRACE_SIZE(size));
+    pi_cl_ram_write(ram, l3_y + ${4 * (y_rows + 1)} + row_offset[row], staging, size, req);
+  }
+}
 
+% endif
 void __attribute__ ((noinline)) ${func_name_L3}(void *args)
 {
   layer_args_t *layer_args = (layer_args_t *)args;
@@ -81,35 +154,244 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
       % endif
       .x = l2_x + ${dim_in},
       .w = l2_W + ${weight_dim + bias_dim + k_dim + lambda_dim},
-      .y = l2_y + ${dim_out}
+      .y = l2_y + ${dim_out_band}
     }
   };
 
   int i_db_x = 0, i_db_w = 0, i_db_y = 0;
+  % if compressed_weights:
+  // the weights tiles are compressed in L3 (see dory_weights_decoder.h): each one is read
+  // in a staging buffer after the double buffer, then expanded in it by all the cores
+  void *w_staging = (void *) (l2_W + ${w_staging_offset});
+  % endif
+  % if compressed_input:
+  uint32_t *x_offset = (uint32_t *) (l2_x + ${x_staging_offset});
+  void *x_staging = x_offset + ${x_rows + 1};
+  % endif
+  % if compressed_output:
+  uint32_t *y_offset = (uint32_t *) (l2_y + ${y_staging_offset});
+  void *y_staging = y_offset + ${y_rows + 1};
+  if(pi_core_id()==0)
+    y_offset[0] = 0;
+  % endif
+
+  % if n_tile_W > 1 and (n_tile_x > 1 or n_tile_y > 1):
+  // weights and activations tiled from L3: ${n_tile_W} output channels tiles x ${n_tile_h} bands of rows,
+  % if l3_loop_order == 'bands':
+  // all the weights tiles are read again for every band (the order with the least L3 traffic).
+  % else:
+  // every weights tile is read once and goes through all the bands (the order with the least L3 traffic).
+  % endif
+  // While a tile is executed, the next weights${', input' if n_tile_x > 1 else ''} and the previous output are transferred.
+  pi_cl_ram_req_t req_w;
+  % if input_L3 == 1:
+  pi_cl_ram_req_t req_x;
+  % endif
+  % if n_tile_y > 1:
+  pi_cl_ram_req_t req_y;
+  % endif
+
+  // first tile transfer. Weights, k, lambda and input activations
+  if(pi_core_id()==0) {
+    ${func_name_L3}_read_weights(ram, l3_W, 0, ${'w_staging' if compressed_weights else 'db[0].w'}, &req_w);
+    pi_cl_ram_read_wait(&req_w);
+    DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    % if compressed_input:
+    // table of the rows of the input
+    DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${4 * (x_rows + 1)}));
+    pi_cl_ram_read(ram, l3_x, x_offset, ${4 * (x_rows + 1)}, &req_x);
+    pi_cl_ram_read_wait(&req_x);
+    DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    ${func_name_L3}_read_input(ram, l3_x, 0, x_staging, &req_x);
+    pi_cl_ram_read_wait(&req_x);
+    DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    % elif input_L3 == 1:
+    DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${dim_in}));
+    pi_cl_ram_read(ram, l3_x, db[0].x, ${dim_in}, &req_x);
+    pi_cl_ram_read_wait(&req_x);
+    DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    % endif
+  }
+  % if compressed_weights:
+  dory_weights_decode(w_staging, db[0].w, ${n_out}, ${w_channel_size}, ${w_tail_dim});
+  % endif
+  % if compressed_input:
+  ${func_name_L3}_decode_input(0, x_staging, db[0].x);
+  % endif
+
+  % if l3_loop_order == 'bands':
+  // loop over bands of rows
+  for(int j = 0; j < ${n_tile_h}; j++) {
+    % if n_tile_x > 1:
+    // Fetching next input band: the offset is computed based on the overlap
+    % if compressed_input:
+    if(pi_core_id()==0 && j < ${n_tile_h - 1})
+      ${func_name_L3}_read_input(ram, l3_x, ${x_first_offset} + j * ${x_band_step}, x_staging, &req_x);
+    % else:
+    if(pi_core_id()==0 && j < ${n_tile_h - 1}) {
+      DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${dim_in}));
+      pi_cl_ram_read(ram, l3_x + ${dim_in - int(conv_overlap1*n_in*w_in*BitIn/8) - int(padding*n_in*w_in*BitIn/8)} + j * ${dim_in - int(conv_overlap1*n_in*w_in*BitIn/8)}, db[!i_db_x].x, ${dim_in}, &req_x);
+    }
+    % endif
+    % endif
+    // loop over weight tiles
+    for(int k = 0; k < ${n_tile_W}; k++) {
+      // Fetch next weights: after the last tile, the first one of the next band
+      if(pi_core_id()==0 && (j < ${n_tile_h - 1} || k < ${n_tile_W - 1}))
+        ${func_name_L3}_read_weights(ram, l3_W, (k + 1) % ${n_tile_W}, ${'w_staging' if compressed_weights else 'db[!i_db_w].w'}, &req_w);
+  % else:
+  // loop over weight tiles
+  for(int k = 0; k < ${n_tile_W}; k++) {
+    // Fetch next weights
+    if(pi_core_id()==0 && k < ${n_tile_W - 1})
+      ${func_name_L3}_read_weights(ram, l3_W, k + 1, ${'w_staging' if compressed_weights else 'db[!i_db_w].w'}, &req_w);
+    // loop over bands of rows
+    for(int j = 0; j < ${n_tile_h}; j++) {
+    % if n_tile_x > 1:
+      // Fetching next input band: after the last band, the first one for the next weights
+      % if compressed_input:
+      if(pi_core_id()==0 && (j < ${n_tile_h - 1} || k < ${n_tile_W - 1}))
+        ${func_name_L3}_read_input(ram, l3_x, j < ${n_tile_h - 1} ? ${x_first_offset} + j * ${x_band_step} : 0, x_staging, &req_x);
+      % else:
+      if(pi_core_id()==0 && (j < ${n_tile_h - 1} || k < ${n_tile_W - 1})) {
+        DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${dim_in}));
+        pi_cl_ram_read(ram, l3_x + (j < ${n_tile_h - 1} ? ${dim_in - int(conv_overlap1*n_in*w_in*BitIn/8) - int(padding*n_in*w_in*BitIn/8)} + j * ${dim_in - int(conv_overlap1*n_in*w_in*BitIn/8)} : 0), db[!i_db_x].x, ${dim_in}, &req_x);
+      }
+      % endif
+    % endif
+  % endif
+
+    % if n_tile_x > 1:
+      tile_args.L2_input = db[i_db_x].x;
+    % else:
+      tile_args.L2_input = j == 0 ? db[i_db_x].x :
+        dory_get_tile_3d(db[i_db_x].x, j, 0, 0, ${h_in}, ${w_in}, ${n_in}, ${w_in}, ${n_in}, ${conv_overlap1}, ${conv_overlap2},0, ${padding}, 0, 0, ${x_data_size_byte});
+    % endif
+    % if n_tile_y > 1 and l3_loop_order == 'weights':
+      tile_args.L2_output = db[i_db_y].y;
+    % else:
+      tile_args.L2_output = dory_get_tile_3d(db[i_db_y].y, ${0 if n_tile_y > 1 else 'j'}, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte});
+    % endif
+      tile_args.L2_weights = db[i_db_w].w;
+
+      // execution of L2-L1 layer. Either top, middle or bottom layer.
+      pi_cl_team_barrier(0);
+      if (j == 0)
+        ${func_name[1] if padding > 0 else func_name[0]}((void*)&tile_args);
+      else if (j == ${n_tile_h - 1})
+        ${func_name[2] if padding > 0 else func_name[0]}((void*)&tile_args);
+      else
+        ${func_name[0]}((void*)&tile_args);
+      pi_cl_team_barrier(0);
 
+  % if l3_loop_order == 'bands':
+      if(pi_core_id()==0 && (j < ${n_tile_h - 1} || k < ${n_tile_W - 1})) {
+        pi_cl_ram_read_wait(&req_w);
+        DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+      }
+      % if compressed_weights:
+      if (j < ${n_tile_h - 1} || k < ${n_tile_W - 1})
+        dory_weights_decode(w_staging, db[!i_db_w].w, ${n_out}, ${w_channel_size}, ${w_tail_dim});
+      % endif
+      i_db_w = !i_db_w;
+    }
+    % if n_tile_x > 1:
+    if(pi_core_id()==0 && j < ${n_tile_h - 1}) {
+      pi_cl_ram_read_wait(&req_x);
+      DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    }
+    % if compressed_input:
+    if (j < ${n_tile_h - 1})
+      ${func_name_L3}_decode_input(${x_first_offset} + j * ${x_band_step}, x_staging, db[!i_db_x].x);
+    % endif
+    i_db_x = !i_db_x;
+    % endif
+    % if n_tile_y > 1 and compressed_output:
+    // waits for output transfer to be ended, then compresses the band and writes it
+    if(pi_core_id()==0 && j > 0) {
+      pi_cl_ram_write_wait(&req_y);
+      DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+    }
+    ${func_name_L3}_write_output(ram, l3_y, j, db[i_db_y].y, y_staging, &req_y);
+    i_db_y = !i_db_y;
+    % elif n_tile_y > 1:
+    if(pi_core_id()==0) {
+      // waits for output transfer to be ended
+      if (j > 0) {
+        pi_cl_ram_write_wait(&req_y);
+        DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+      }
+      DORY_TRACE(DORY_TRACE_L3_WRITE_START, DORY_TRACE_SIZE(${dim_out_band}));
+      pi_cl_ram_write(ram, l3_y + j * ${dim_out_band}, db[i_db_y].y, ${dim_out_band}, &req_y);
+    }
+    i_db_y = !i_db_y;
+    % endif
+  }
+  % else:
+    % if n_tile_x > 1:
+      if(pi_core_id()==0 && (j < ${n_tile_h - 1} || k < ${n_tile_W - 1})) {
+        pi_cl_ram_read_wait(&req_x);
+        DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+      }
+      % if compressed_input:
+      if (j < ${n_tile_h - 1} || k < ${n_tile_W - 1})
+        ${func_name_L3}_decode_input(j < ${n_tile_h - 1} ? ${x_first_offset} + j * ${x_band_step} : 0, x_staging, db[!i_db_x].x);
+      % endif
+      i_db_x = !i_db_x;
+    % endif
+    % if n_tile_y > 1:
+      if(pi_core_id()==0) {
+        // waits for output transfer to be ended
+        if (j > 0 || k > 0) {
+          pi_cl_ram_write_wait(&req_y);
+          DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+        }
+        // the output channels of the tile are strided in the L3 output band
+        DORY_TRACE(DORY_TRACE_L3_WRITE_START, DORY_TRACE_SIZE(${dim_out}));
+        pi_cl_ram_write_2d(ram, l3_y + j * ${dim_out * n_tile_W} + k * ${y_ch_tile_byte}, db[i_db_y].y, ${dim_out}, ${y_ch_byte}, ${y_ch_tile_byte}, &req_y);
+      }
+      i_db_y = !i_db_y;
+    % endif
+    }
+    if(pi_core_id()==0 && k < ${n_tile_W - 1}) {
+      pi_cl_ram_read_wait(&req_w);
+      DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    }
+    % if compressed_weights:
+    if (k < ${n_tile_W - 1})
+      dory_weights_decode(w_staging, db[!i_db_w].w, ${n_out}, ${w_channel_size}, ${w_tail_dim});
+    % endif
+    i_db_w = !i_db_w;
+  }
+  % endif
+  % if n_tile_y > 1:
+  // last wait
+  if(pi_core_id()==0) {
+    pi_cl_ram_write_wait(&req_y);
+    DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+    % if compressed_output:
+    // table of the rows of the output
+    DORY_TRACE(DORY_TRACE_L3_WRITE_START, DORY_TRACE_SIZE(${4 * (y_rows + 1)}));
+    pi_cl_ram_write(ram, l3_y, y_offset, ${4 * (y_rows + 1)}, &req_y);
+    pi_cl_ram_write_wait(&req_y);
+    DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+    % endif
+  }
+  % endif
+  % else:
   % if n_tile_W > 1:
   // weight L3 tiling. Parameters
-  pi_cl_ram_req_t req_w, req_k, req_l, req_bias;
-  // first tile transfer. Weights, k, lambda
+  pi_cl_ram_req_t req_w;
+  // first tile transfer. Weights, bias, k, lambda of a tile are contiguous in L3 and in L2
   if(pi_core_id()==0)
   {
-    pi_cl_ram_read(ram, l3_W, db[i_db_w].w, ${weight_dim}, &req_w);
-    % if k_dim != 0:
-    pi_cl_ram_read(ram, l3_W+${(weight_dim+bias_dim)*n_tile_W}, db[i_db_w].k, ${k_dim}, &req_k);
-    pi_cl_ram_read(ram, l3_W+${(weight_dim+bias_dim+k_dim)*n_tile_W}, db[i_db_w].l, ${lambda_dim}, &req_l);
-    % endif 
-    % if bias_dim != 0:
-    pi_cl_ram_read(ram, l3_W+${weight_dim*n_tile_W}, db[i_db_w].bias, ${bias_dim}, &req_bias);
-    % endif 
+    ${func_name_L3}_read_weights(ram, l3_W, 0, ${'w_staging' if compressed_weights else 'db[i_db_w].w'}, &req_w);
     pi_cl_ram_read_wait(&req_w);
-    % if k_dim != 0:
-    pi_cl_ram_read_wait(&req_k);
-    pi_cl_ram_read_wait(&req_l);
-    % endif
-    % if bias_dim != 0:
-    pi_cl_ram_read_wait(&req_bias);
-    % endif 
+    DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
   }
+  % if compressed_weights:
+  dory_weights_decode(w_staging, db[i_db_w].w, ${n_out}, ${w_channel_size}, ${w_tail_dim});
+  % endif
   // switching buffers
   % endif
 
@@ -118,9 +400,23 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
   pi_cl_ram_req_t req_x;
   // first tile transfer. Input activations
   if(pi_core_id()==0) {
+    % if compressed_input:
+    // table of the rows of the input
+    DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${4 * (x_rows + 1)}));
+    pi_cl_ram_read(ram, l3_x, x_offset, ${4 * (x_rows + 1)}, &req_x);
+    pi_cl_ram_read_wait(&req_x);
+    DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    ${func_name_L3}_read_input(ram, l3_x, 0, x_staging, &req_x);
+    % else:
+    DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${dim_in}));
     pi_cl_ram_read(ram, l3_x, db[i_db_x].x, ${dim_in}, &req_x);
+    % endif
     pi_cl_ram_read_wait(&req_x);
+    DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
   }
+  % if compressed_input:
+  ${func_name_L3}_decode_input(0, x_staging, db[i_db_x].x);
+  % endif
   % endif
 
   % if n_tile_y > 1:
@@ -138,14 +434,30 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
   % if n_tile_x > 1:
   // loop over input/output tiles
   for(int j = 0; j < ${n_tile_x}; j++) {
+    % if compressed_input:
+    // band j is expanded from the staging buffer before the next one is read in it
+    if(pi_core_id()==0 && j > 0) {
+      pi_cl_ram_read_wait(&req_x);
+      DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+    }
+    if (j > 0)
+      ${func_name_L3}_decode_input(${x_first_offset} + (j - 1) * ${x_band_step}, x_staging, db[i_db_x].x);
+    if(pi_core_id()==0 && j + 1 < ${n_tile_x})
+      ${func_name_L3}_read_input(ram, l3_x, ${x_first_offset} + j * ${x_band_step}, x_staging, &req_x);
+    % else:
     if(pi_core_id()==0) {
       // Fetching next input tile
-      if (j > 0) pi_cl_ram_read_wait(&req_x);
+      if (j > 0) {
+        pi_cl_ram_read_wait(&req_x);
+        DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+      }
       if (j + 1 < ${n_tile_x}) {
+        DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(${dim_in}));
         pi_cl_ram_read(ram, l3_x + offset_x, db[!i_db_x].x, ${dim_in}, &req_x);
         offset_x += ${dim_in-int(conv_overlap1*n_in*w_in*BitIn/8)};
       }
     }
+    % endif
   % elif n_tile_y > 1:
   // loop over output tiles
   for(int j = 0; j < ${n_tile_y}; j++) {
@@ -155,33 +467,11 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
 
   % if n_tile_W > 1:
   // loop over weight tiles
-
-  int offset_w = ${l3_offset_w + weight_dim};
-  % if k_dim != 0:
-  int offset_k = ${l3_offset_k + k_dim};
-  int offset_l = ${l3_offset_l + lambda_dim};
-  % endif
-  % if bias_dim != 0:
-  int offset_b = ${l3_offset_b + bias_dim};
-  % endif
-
   for(int k = 0; k < ${n_tile_W}; k++) {
     if (k < ${n_tile_W-1}) {
       // Fetch next weights
-      if(pi_core_id()==0) {
-        pi_cl_ram_read(ram, l3_W + offset_w, db[!i_db_w].w, ${weight_dim}, &req_w);
-        offset_w += ${weight_dim};
-        % if k_dim != 0:
-        pi_cl_ram_read(ram, l3_W + offset_k, db[!i_db_w].k, ${k_dim}, &req_k);
-        offset_k += ${k_dim};
-        pi_cl_ram_read(ram, l3_W + offset_l, db[!i_db_w].l, ${lambda_dim}, &req_l);
-        offset_l += ${lambda_dim};
-        % endif
-        % if bias_dim != 0:
-        pi_cl_ram_read(ram, l3_W + offset_b, db[!i_db_w].bias, ${bias_dim}, &req_bias);
-        offset_b += ${bias_dim};
-        % endif 
-      }
+      if(pi_core_id()==0)
+        ${func_name_L3}_read_weights(ram, l3_W, k + 1, ${'w_staging' if compressed_weights else 'db[!i_db_w].w'}, &req_w);
     }  
   % else:
     int k = 0;
@@ -218,21 +508,35 @@ else if (j == (${n_tile_y-1})) {
         {
           // waiting for weights, lambda, and k
           pi_cl_ram_read_wait(&req_w);
-          % if k_dim != 0:
-          pi_cl_ram_read_wait(&req_k);
-          pi_cl_ram_read_wait(&req_l);
-          % endif
-          % if bias_dim != 0:
-          pi_cl_ram_read_wait(&req_bias);
-          % endif
+          if (k < ${n_tile_W-1})
+            DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
         }
+        % if compressed_weights:
+        if (k < ${n_tile_W-1})
+          dory_weights_decode(w_staging, db[!i_db_w].w, ${n_out}, ${w_channel_size}, ${w_tail_dim});
+        % endif
         i_db_w = !i_db_w;
       }   
       % endif 
   % if n_tile_x > 1:
     i_db_x = !i_db_x;
   % endif
-  % if n_tile_y > 1:
+  % if n_tile_y > 1 and compressed_output:
+    if(pi_core_id()==0) {
+      % if n_tile_x > 1:
+      // waits for input transfer to be ended
+      pi_cl_ram_read_wait(&req_x);
+      % endif
+      // waits for output transfer to be ended
+      if (j > 0) {
+        pi_cl_ram_write_wait(&req_y);
+        DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+      }
+    }
+    // compresses the band and writes it
+    ${func_name_L3}_write_output(ram, l3_y, j, db[i_db_y].y, y_staging, &req_y);
+    i_db_y = !i_db_y;
+  % elif n_tile_y > 1:
     if(pi_core_id()==0) 
     {
       % if n_tile_x > 1:
@@ -240,8 +544,11 @@ else if (j == (${n_tile_y-1})) {
       pi_cl_ram_read_wait(&req_x);
       % endif
       // waits for output transfer to be ended
-      if (j > 0)
+      if (j > 0) {
         pi_cl_ram_write_wait(&req_y);
+        DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+      }
+      DORY_TRACE(DORY_TRACE_L3_WRITE_START, DORY_TRACE_SIZE(${dim_out}));
       pi_cl_ram_write(ram, l3_y + offset_y, db[i_db_y].y, ${dim_out}, &req_y);
       offset_y += ${dim_out};
     % if verbose == 1:
@@ -260,7 +567,16 @@ else if (j == (${n_tile_y-1})) {
   // last wait
   if(pi_core_id()==0) {
     pi_cl_ram_write_wait(&req_y);
+    DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+    % if compressed_output:
+    // table of the rows of the output
+    DORY_TRACE(DORY_TRACE_L3_WRITE_START, DORY_TRACE_SIZE(${4 * (y_rows + 1)}));
+    pi_cl_ram_write(ram, l3_y, y_offset, ${4 * (y_rows + 1)}, &req_y);
+    pi_cl_ram_write_wait(&req_y);
+    DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
+    % endif
   }
   % endif
+  % endif
   pi_cl_team_barrier(0);
 }
@@ -18,6 +18,7 @@
  */
 <%
 l3_supported = DORY_HW_graph[0].HW_description['memory']['levels'] > 2
+output_l3 = l3_supported and DORY_HW_graph[-1].tiling_dimensions["L3"]["output_dimensions"] != DORY_HW_graph[-1].tiling_dimensions["L2"]["output_dimensions"]
 n_inputs = DORY_HW_graph[0].n_test_inputs
 single_input = n_inputs==1
 %>\
@@ -27,6 +28,7 @@ single_input = n_inputs==1
 #include "mem.h"
 % endif
 #include "${prefix}network.h"
+#include "dory_trace.h"
 
 #include "pmsis.h"
 
@@ -58,6 +60,17 @@ void application(void * arg) {
 #ifdef VERBOSE
   printf("\nL2 Buffer alloc initial\t@ 0x%08x:\tOk\n", (unsigned int)l2_buffer);
 #endif
+  % if not output_l3:
+  // Written in place by the last layer
+  size_t l2_output_size = ${int(DORY_HW_graph[-1].tiling_dimensions["L2"]["output_activation_memory"])};
+  void *l2_output = pi_l2_malloc(l2_output_size);
+  if (NULL == l2_output) {
+#ifdef VERBOSE
+    printf("ERROR: L2 output allocation failed.");
+#endif
+    pmsis_exit(-1);
+  }
+  % endif
   size_t l2_input_size = ${int(DORY_HW_graph[0].tiling_dimensions["L2"]["input_activation_memory"])};
   size_t input_size = 1000000;
   % if l3_supported:
@@ -72,13 +85,19 @@ void application(void * arg) {
 % elif l3_supported:
       load_file_to_ram(ram_input, "${prefix}inputs.hex");
 % endif
+#ifdef PERF_LAYER_EXTENDED
+    // One run for every counted event, on the same input
+    for (int run = 0; run < PERF_EXTENDED_EVENTS; run++) {
+#endif
   % if l3_supported:
       ram_read(l2_buffer, ram_input, l2_input_size);
   % endif
       ${prefix}network_args_t args = {
         .l2_buffer = l2_buffer,
         .l2_buffer_size = ${l2_buffer_size},
-        .l2_final_output = l2_buffer,
+        % if not output_l3:
+        .l2_final_output = l2_output,
+        % endif
         .exec = ${"0" if single_input else "exec"},
         .initial_allocator_dir = 1,
         % if not l3_supported:
@@ -86,14 +105,23 @@ void application(void * arg) {
         % endif
       };
       ${prefix}network_run(&network, &args);
+#ifdef PERF_LAYER_EXTENDED
+    }
+#endif
 
   % if not single_input:
   }
   % endif
+#ifdef TRACE
+  dory_trace_dump();
+#endif
   % if l3_supported:
   ram_free(ram_input, input_size);
   % endif
   ${prefix}network_terminate(&network);
+  % if not output_l3:
+  pi_l2_free(l2_output, l2_output_size);
+  % endif
   pi_l2_free(l2_buffer, ${l2_buffer_size});
 }
 
@@ -19,12 +19,15 @@
  */
 <%
 l3_supported = DORY_HW_graph[0].HW_description['memory']['levels'] > 2
+last = len(DORY_HW_graph) - 1
+output_l3 = l3_supported and DORY_HW_graph[-1].tiling_dimensions["L3"]["output_dimensions"] != DORY_HW_graph[-1].tiling_dimensions["L2"]["output_dimensions"]
 %>\
 #define DEFINE_CONSTANTS
 %if not l3_supported:
 #include "${prefix}weights.h"
 %endif
 #include "net_utils.h"
+#include "dory_trace.h"
 #include "pmsis.h"
 #include "${prefix}network.h"
 #include "directional_allocator.h"
@@ -36,12 +39,22 @@ l3_supported = DORY_HW_graph[0].HW_description['memory']['levels'] > 2
 
 % if l3_supported:
 #define L3_WEIGHTS_SIZE 4000000
-#define L3_INPUT_SIZE 1500000
-#define L3_OUTPUT_SIZE 1500000
+#define L3_INPUT_SIZE ${l3_activations_size}
+#define L3_OUTPUT_SIZE ${l3_activations_size}
 % endif
+#if defined PERF_LAYER_EXTENDED && (defined PERF_LAYER || defined PERF_FINAL || defined TRACE)
+#error "PERF_LAYER_EXTENDED reprograms the counters used by PERF_LAYER, PERF_FINAL and TRACE"
+#endif
 static void *L3_weights = NULL;
 static void *L3_input = NULL;
 static void *L3_output = NULL;
+% if resident_weights:
+static void *L2_weights_resident = NULL;
+% endif
+#ifdef RESIDENT_CLUSTER
+// L1 buffer allocated once in network_initialize and reused by every inference
+static void *L1_buffer_resident = NULL;
+#endif
 
 /* Moves the weights and the biases from hyperflash to hyperram */
 void ${prefix}network_initialize(${prefix}network_t * network) {
@@ -56,13 +69,43 @@ void ${prefix}network_initialize(${prefix}network_t * network) {
   printf("\nL3 Buffer alloc initial\t@ %d:\t%s\n", (unsigned int)L3_output, L3_output?"Ok":"Failed");
 #endif // VERBOSE
 
+  % if packed_weights:
+  // All the layers are packed in a single file, laid out as in L3_weights_size
+  size_t size = load_file_to_ram(L3_weights, L3_weights_files[0]);
+  size_t expected_size = 0;
+  for (int i = 0; i < ${weights_number}; i++)
+    expected_size += L3_weights_size[i];
+  if (size != expected_size) {
+    // the layers would read their weights at the wrong offsets
+    printf("\nERROR: Weights file size %d, expected %d\n", size, expected_size);
+    pmsis_exit(-7);
+  }
+  % else:
   void *w_ptr = L3_weights;
   for (int i = 0; i < ${weights_number}; i++) {
     size_t size = load_file_to_ram(w_ptr, L3_weights_files[i]);
     L3_weights_size[i] = size;
     w_ptr += size;
   }
+  % endif
+
+  % if resident_weights:
+  // The weights of the layers planned as resident are read once and stay in L2
+  L2_weights_resident = pi_l2_malloc(RESIDENT_WEIGHTS_SIZE);
+  if (NULL == L2_weights_resident) {
+    printf("ERROR: Failed to allocate the resident weights.\n");
+    pmsis_exit(-6);
+  }
+  void *L3_weights_layer = L3_weights;
+  for (int i = 0, w = 0; i < ${len(DORY_HW_graph)}; i++) {
+    if (layer_with_weights[i] == 0)
+      continue;
+    if (resident_weights_offset[i] >= 0)
+      ram_read(L2_weights_resident + resident_weights_offset[i], L3_weights_layer, weights_size[i]);
+    L3_weights_layer += L3_weights_size[w++];
+  }
 
+  % endif
   % endif
   network->cluster_dev = (struct pi_device){0};
   struct pi_cluster_conf conf;
@@ -73,6 +116,16 @@ void ${prefix}network_initialize(${prefix}network_t * network) {
     return;
 
   network->cluster_task = (struct pi_cluster_task){0};
+#ifdef RESIDENT_CLUSTER
+  // The task is set up once, every run only updates its arguments
+  pi_cluster_task(&network->cluster_task, ${prefix}network_run_cluster, NULL);
+
+  L1_buffer_resident = pi_l1_malloc(&network->cluster_dev, ${l1_buffer});
+  if (NULL == L1_buffer_resident) {
+    printf("ERROR: Failed to allocate the L1 buffer.\n");
+    pmsis_exit(-5);
+  }
+#endif
 #ifndef TARGET_CHIP_FAMILY_GAP9
   network->cluster_task.stack_size = ${master_stack};
 #endif
@@ -86,9 +139,51 @@ void ${prefix}network_terminate(${prefix}network_t * network) {
   ram_free(L3_input, L3_INPUT_SIZE);
   ram_free(L3_output, L3_OUTPUT_SIZE);
   % endif
+  % if resident_weights:
+  pi_l2_free(L2_weights_resident, RESIDENT_WEIGHTS_SIZE);
+  L2_weights_resident = NULL;
+  % endif
+#ifdef RESIDENT_CLUSTER
+  pi_l1_free(&network->cluster_dev, L1_buffer_resident, ${l1_buffer});
+  L1_buffer_resident = NULL;
+#endif
   pi_cluster_close(&network->cluster_dev);
 }
 
+% if dvfs_plan:
+#ifndef DORY_FREQUENCY_EVENT
+// software event of the cluster event unit raised by the FC once the frequency is set
+#define DORY_FREQUENCY_EVENT 7
+#endif
+
+static pi_task_t cluster_frequency_task;
+static volatile int cluster_frequency_done;
+// frequency of the cluster when the network is launched, restored at its end
+static int cluster_frequency_start;
+
+static void ${prefix}cluster_frequency_fc(void *frequency) {
+  pi_freq_set(PI_FREQ_DOMAIN_CL, (int) frequency);
+  cluster_frequency_done = 1;
+  eu_evt_trig(eu_evt_trig_cluster_addr(0, DORY_FREQUENCY_EVENT), 1 << 0);
+}
+
+/* Changes the cluster frequency between two layers: the FLL is reprogrammed by the
+   fabric controller, while core 0 sleeps until the FC raises DORY_FREQUENCY_EVENT
+   once pi_freq_set has returned, i.e. the FLL is locked.
+   - it is only called by core 0 between two pi_cl_team_fork, while the other
+     cores sleep in the dispatch loop, and with one request in flight at most;
+   - the FC runs the callback from its event loop, which it enters while it waits
+     for the cluster task, so the callback doesn't depend on the cluster;
+   - an event raised before core 0 waits is kept by the event unit, and the flag
+     filters out the wake-ups of other events. */
+static void ${prefix}cluster_frequency_set(int frequency) {
+  cluster_frequency_done = 0;
+  pi_cl_send_task_to_fc(pi_task_callback(&cluster_frequency_task, ${prefix}cluster_frequency_fc, (void *) frequency));
+  while (cluster_frequency_done == 0)
+    eu_evt_maskWaitAndClr(1 << DORY_FREQUENCY_EVENT);
+}
+
+% endif
 static inline void ${prefix}execute_layer_fork(layer_args_t *args, int layer_id) {
   switch (layer_id)
   {
@@ -100,10 +195,83 @@ static inline void ${prefix}execute_layer_fork(layer_args_t *args, int layer_id)
   }
 }
 
+#ifdef PERF_LAYER_EXTENDED
+static void (*const layer_functions[${len(DORY_HW_graph)}])(void *) = {${', '.join(func_name[i] for i in range(len(DORY_HW_graph)))}};
+// Event counted at network run r: perf_extended_events[r % PERF_EXTENDED_EVENTS]
+static const int perf_extended_events[PERF_EXTENDED_EVENTS] = {
+  PI_PERF_CYCLES, PI_PERF_ACTIVE_CYCLES, PI_PERF_INSTR, PI_PERF_LD_STALL,
+  PI_PERF_JR_STALL, PI_PERF_IMISS, PI_PERF_TCDM_CONT
+};
+static const char *perf_extended_names[PERF_EXTENDED_EVENTS] = {
+  "cycles", "active cycles", "instructions", "load stalls",
+  "jump stalls", "icache misses", "tcdm contention"
+};
+// Sum and maximum over the cores of every event, for every layer
+static uint32_t perf_extended[${len(DORY_HW_graph)}][PERF_EXTENDED_EVENTS][2];
+static uint32_t perf_extended_core[NUM_CORES];
+static int perf_extended_run = 0;
+
+typedef struct {
+  void (*layer)(void *);
+  layer_args_t *args;
+  int event;
+} perf_extended_args_t;
+
+/* Forked in place of the layer: every core counts the same event while running it */
+static void ${prefix}perf_extended_fork(void *args) {
+  perf_extended_args_t *perf_args = (perf_extended_args_t *) args;
+  pi_perf_conf(1 << perf_args->event);
+  pi_perf_reset();
+  pi_perf_start();
+  perf_args->layer(perf_args->args);
+  pi_perf_stop();
+  perf_extended_core[pi_core_id()] = pi_perf_read(perf_args->event);
+}
+
+static void ${prefix}execute_layer_perf_extended(layer_args_t *args, int layer_id, int event) {
+  perf_extended_args_t perf_args = {layer_functions[layer_id], args, perf_extended_events[event]};
+  pi_cl_team_fork(NUM_CORES, ${prefix}perf_extended_fork, &perf_args);
+
+  uint32_t sum = 0, max = 0;
+  for (int core = 0; core < NUM_CORES; core++) {
+    sum += perf_extended_core[core];
+    if (perf_extended_core[core] > max)
+      max = perf_extended_core[core];
+  }
+  perf_extended[layer_id][event][0] = sum;
+  perf_extended[layer_id][event][1] = max;
+}
+
+/* One line per layer with the sum and the maximum over the cores of every event, read by scripts/perf2csv.py */
+static void ${prefix}print_perf_extended() {
+  printf("\nPERF_EXTENDED Layer,MACs,Cores");
+  for (int e = 0; e < PERF_EXTENDED_EVENTS; e++)
+    printf(",%s,%s max", perf_extended_names[e], perf_extended_names[e]);
+  printf("\n");
+  for (int i = 0; i < ${len(DORY_HW_graph)}; i++) {
+    printf("PERF_EXTENDED %s,%d,%d", Layers_name[i], NODEs_MACS[i], NUM_CORES);
+    for (int e = 0; e < PERF_EXTENDED_EVENTS; e++)
+      printf(",%u,%u", perf_extended[i][e][0], perf_extended[i][e][1]);
+    printf("\n");
+  }
+}
+#endif
+
+void ${prefix}network_run_task_async(${prefix}network_t * network, ${prefix}network_args_t * args, pi_task_t * task) {
+  % if dvfs_plan:
+  cluster_frequency_start = pi_freq_get(PI_FREQ_DOMAIN_CL);
+  % endif
+#ifdef RESIDENT_CLUSTER
+  network->cluster_task.arg = args;
+#else
+  pi_cluster_task(&network->cluster_task, ${prefix}network_run_cluster, args);
+#endif
+  pi_cluster_send_task_to_cl_async(&network->cluster_dev, &network->cluster_task, task);
+}
+
 void ${prefix}network_run_async(${prefix}network_t * network, ${prefix}network_args_t * args) {
   pi_task_block(&network->task);
-  pi_cluster_task(&network->cluster_task, ${prefix}network_run_cluster, args);
-  pi_cluster_send_task_to_cl_async(&network->cluster_dev, &network->cluster_task, &network->task);
+  ${prefix}network_run_task_async(network, args, &network->task);
 }
 
 void ${prefix}network_run_wait(${prefix}network_t * network) {
@@ -122,8 +290,17 @@ void ${prefix}network_run_cluster(void * args) {
   void * l2_final_output = network_args->l2_final_output;
   int exec = network_args->exec;
   int dir = network_args->initial_allocator_dir;
+  // The input and the output are read and written in place by the first and the last layer
   % if not l3_supported:
-  void * L2_input_h = network_args->l2_input_h;
+  void * network_input = network_args->l2_input != NULL ? network_args->l2_input : network_args->l2_input_h;
+  % elif l2_plan and l2_plan["input_in_buffer"]:
+  void * network_input = network_args->l2_input != NULL ? network_args->l2_input : l2_buffer;
+  % else:
+  void * network_input = network_args->l2_input;
+  % endif
+  % if not output_l3:
+  // unless the output overlaps the buffer of the network: then it is copied at the end
+  int output_in_place = l2_final_output + activations_out_size[${last}] <= l2_buffer || l2_final_output >= l2_buffer + l2_buffer_size;
   % endif
 /*
   - initial buffer allocation L2 and L1
@@ -136,6 +313,10 @@ void ${prefix}network_run_cluster(void * args) {
   void *L2_input = NULL;
   void *L2_weights = NULL;
   void *L3_weights_curr = L3_weights;
+  % if l3_supported:
+  void *L2_weights_prefetched = NULL;
+  pi_cl_ram_req_t weights_prefetch_req;
+  % endif
   void *bypass_activations = NULL;
 
   int residual_number = 0;
@@ -150,6 +331,18 @@ void ${prefix}network_run_cluster(void * args) {
 /* --------- SECTION 0 END ---------- */
 /* ---------------------------------- */
 
+#if defined PERF_LAYER || defined PERF_FINAL
+  pi_perf_conf(1<<PI_PERF_CYCLES);
+  int perf_cyc = 0;
+  int io_cyc = 0;
+  int setup_cyc = 0;
+  int bookkeeping_cyc = 0;
+  int cycle_network_execution = 0;
+  // Setup cycle measurement start
+  pi_perf_reset();
+  pi_perf_start();
+#endif
+
 /*
   - initial copies from L3 of input
   - copies of weights of first 2 layers
@@ -158,11 +351,22 @@ void ${prefix}network_run_cluster(void * args) {
 /* -------- SECTION 1 BEGIN --------- */
 /* ---------------------------------- */
   % if not l3_supported:
-  L2_input = L2_input_h;
+  L2_input = network_input;
   % endif
+  % if l2_plan:
+  if (l2_buffer_size < L2_PLAN_SIZE) {
+#ifdef VERBOSE
+    printf("ERROR: The L2 buffer is smaller than the static L2 plan (%d < %d).\n", l2_buffer_size, L2_PLAN_SIZE);
+#endif // VERBOSE
+    return;
+  }
+  % else:
   directional_allocator_init(l2_buffer, l2_buffer_size);
+  % endif
 
-#ifdef TARGET_CHIP_FAMILY_GAP9
+#ifdef RESIDENT_CLUSTER
+  void * L1_buffer = L1_buffer_resident;
+#elif defined TARGET_CHIP_FAMILY_GAP9
   void * L1_buffer = pi_cl_l1_malloc(NULL, ${l1_buffer});
 #else
   void * L1_buffer = pmsis_l1_malloc(${l1_buffer});
@@ -180,11 +384,8 @@ void ${prefix}network_run_cluster(void * args) {
 /* ---------------------------------- */
 
 #if defined PERF_LAYER || defined PERF_FINAL
-  pi_perf_conf(1<<PI_PERF_CYCLES);
-  int perf_cyc = 0;
-  int io_cyc = 0;
-  int bookkeeping_cyc = 0;
-  int cycle_network_execution = 0;
+  pi_perf_stop();
+  setup_cyc += pi_perf_read(PI_PERF_CYCLES);
 #endif
 
 /* MAIN SECTION
@@ -204,20 +405,81 @@ void ${prefix}network_run_cluster(void * args) {
   pi_perf_start();
 #endif
 
+#ifdef TRACE
+  pi_cl_team_fork(NUM_CORES, dory_trace_start, NULL);
+#endif
+
   int weight_l_cnt = 0; // count how many layers with weights we have processed to increment the weights_L3 pointer
+  % if dvfs_plan:
+  int frequency = cluster_frequency_start;
+  % endif
   for (int i = 0; i < ${len(DORY_HW_graph)}; i++) {
+    % if dvfs_plan:
+    if (cluster_frequency[i] != frequency) {
+      frequency = cluster_frequency[i];
+      ${prefix}cluster_frequency_set(frequency);
+    }
+    % endif
 /* MEMORY ALLOCATION
   - allocate memory if layer is executed from L3;
   - allocate weights
   - read weights
 */
+    % if l2_plan:
+    // Buffers at the offsets fixed by the static L2 plan
+    % if output_l3:
+    L2_output = l2_buffer + l2_output_offset[i];
+    % else:
+    if (i == ${last} && output_in_place)
+      L2_output = l2_final_output;
+    else
+      L2_output = l2_buffer + l2_output_offset[i];
+    % endif
+    if (l2_input_offset[i] == -2)
+      L2_input = network_input;
+    else if (l2_input_offset[i] >= 0)
+      L2_input = l2_buffer + l2_input_offset[i];
+    if (l2_bypass_offset[i] == -2)
+      bypass_activations = network_input;
+    else if (l2_bypass_offset[i] >= 0)
+      bypass_activations = l2_buffer + l2_bypass_offset[i];
+    % else:
+    % if output_l3:
     L2_output = dmalloc(activations_out_size[i], !dir);
+    % else:
+    if (i == ${last} && output_in_place)
+      L2_output = l2_final_output;
+    else
+      L2_output = dmalloc(activations_out_size[i], !dir);
+    % endif
+    % endif
     % if l3_supported:
-    if (L3_input_layers[i] == 1)
+    % if l2_plan:
+    % if resident_weights:
+    if (resident_weights_offset[i] >= 0)
+      L2_weights = L2_weights_resident + resident_weights_offset[i];
+    else if (layer_with_weights[i] == 1)
+    % else:
+    if (layer_with_weights[i] == 1)
+    % endif
+      L2_weights = l2_buffer + l2_weights_offset[i];
+    % else:
+    if (i == 0 && network_input != NULL)
+      L2_input = network_input;
+    else if (L3_input_layers[i] == 1)
       L2_input = dmalloc(activations_size[i], dir);
 
-    if (layer_with_weights[i] == 1)
+    % if resident_weights:
+    if (resident_weights_offset[i] >= 0)
+      L2_weights = L2_weights_resident + resident_weights_offset[i];
+    else if (L2_weights_prefetched != NULL)
+    % else:
+    if (L2_weights_prefetched != NULL)
+    % endif
+      L2_weights = L2_weights_prefetched;
+    else if (layer_with_weights[i] == 1)
       L2_weights = dmalloc(weights_size[i], dir);
+    % endif
 
 
 #if defined PERF_LAYER || defined PERF_FINAL
@@ -229,7 +491,18 @@ void ${prefix}network_run_cluster(void * args) {
     pi_perf_start();
 #endif
 
-    if (allocate_layer[i] == 1)
+    % if l2_plan:
+    if (l2_reload_input[i] >= 0)
+      cl_ram_read(L2_input, (void *) layers_pointers[l2_reload_input[i]], activations_out_size[l2_reload_input[i]]);
+    if (l2_reload_bypass[i] >= 0)
+      cl_ram_read(bypass_activations, (void *) layers_pointers[l2_reload_bypass[i]], activations_out_size[l2_reload_bypass[i]]);
+
+    % endif
+    if (L2_weights_prefetched != NULL) {
+      // Weights were read while the previous layer was running
+      cl_ram_read_wait(&weights_prefetch_req);
+      L2_weights_prefetched = NULL;
+    } else if (allocate_layer[i] == 1${" && resident_weights_offset[i] < 0" if resident_weights else ""})
       cl_ram_read(L2_weights, L3_weights_curr, weights_size[i]);
 
 #if defined PERF_LAYER || defined PERF_FINAL
@@ -283,7 +556,11 @@ void ${prefix}network_run_cluster(void * args) {
 
     layer_args_t largs = {
       .L3_input = (unsigned int) L3_input,
+      % if output_l3:
+      .L3_output = (unsigned int) (i == ${last} && network_args->l3_final_output != NULL ? network_args->l3_final_output : L3_output),
+      % else:
       .L3_output = (unsigned int) L3_output,
+      % endif
       .L3_after_weights = (unsigned int) L3_weights_curr,
       .L2_input = (unsigned int) L2_input,
       .bypass = (unsigned int) bypass_activations,
@@ -292,9 +569,28 @@ void ${prefix}network_run_cluster(void * args) {
       .L1_buffer = (unsigned int) L1_buffer,
       .ram = (unsigned int) get_ram_ptr(),
       .out_mult = (unsigned int) out_mult_vector[i],
-      .out_shift = (unsigned int) out_shift_vector[i]
+      .out_shift = (unsigned int) out_shift_vector[i],
+      .input_stream = (unsigned int) (i == 0 ? network_args->input_stream : NULL)
     };
 
+    % if l3_supported:
+    % if l2_plan:
+    // Prefetch the weights of the next layer, the static L2 plan keeps their buffer free during this layer.
+    if (i + 1 < ${len(DORY_HW_graph)} && prefetch_weights[i + 1] == 1) {
+      L2_weights_prefetched = l2_buffer + l2_weights_offset[i + 1];
+    % else:
+    // Prefetch the weights of the next layer in the slot following this layer's output,
+    // where the next layer would allocate them. Falls back to a blocking read if it doesn't fit.
+    if (i + 1 < ${len(DORY_HW_graph)} && prefetch_weights[i + 1] == 1) {
+      L2_weights_prefetched = dmalloc(weights_size[i + 1], !dir);
+    % endif
+      if (L2_weights_prefetched != NULL)
+        cl_ram_read_async(L2_weights_prefetched,
+                          L3_weights_curr + (layer_with_weights[i] ? L3_weights_size[weight_l_cnt] : 0),
+                          weights_size[i + 1], &weights_prefetch_req);
+    }
+
+    % endif
 /*
 - Execution of the layers_pointers
 */
@@ -308,7 +604,13 @@ void ${prefix}network_run_cluster(void * args) {
     pi_perf_start();
 #endif
 
+    DORY_TRACE(DORY_TRACE_LAYER_START, i);
+#ifdef PERF_LAYER_EXTENDED
+    ${prefix}execute_layer_perf_extended(&largs, i, perf_extended_run % PERF_EXTENDED_EVENTS);
+#else
     ${prefix}execute_layer_fork(&largs, i);
+#endif
+    DORY_TRACE(DORY_TRACE_LAYER_END, i);
 
 #if defined PERF_LAYER || defined PERF_FINAL
     pi_perf_stop();
@@ -364,11 +666,20 @@ void ${prefix}network_run_cluster(void * args) {
 #endif
 #endif // CHECKSUM
 
+    % if l2_plan and l3_supported:
+    // Residual not kept in L2 by the static plan: stored in L3 until its consumers
+    if (l2_spill_output[i] == 1) {
+      layers_pointers[i] = (int) cl_ram_malloc(activations_out_size[i]);
+      cl_ram_write((void *) layers_pointers[i], L2_output, activations_out_size[i]);
+    }
+    % endif
+    % if not l2_plan:
     // Free memory
     % if l3_supported:
-    if (layer_with_weights[i] == 1)
+    if (layer_with_weights[i] == 1${" && resident_weights_offset[i] < 0" if resident_weights else ""})
       dfree(weights_size[i], dir);
-    dfree(activations_size[i], dir);
+    if (i > 0 || network_input == NULL)
+      dfree(activations_size[i], dir);
     % endif
     if (branch_input[i] == 1)
       dfree(bypass_dimension, dir);
@@ -449,14 +760,27 @@ void ${prefix}network_run_cluster(void * args) {
       }
       % endif
     }
+    % endif
     % if l3_supported:
     if (layer_with_weights[i])
        L3_weights_curr += L3_weights_size[weight_l_cnt++];
     % endif
     dir = !dir;
   }
+  % if dvfs_plan:
+  if (frequency != cluster_frequency_start)
+    ${prefix}cluster_frequency_set(cluster_frequency_start);
+  % endif
+  % if l2_plan and l3_supported:
+
+  for (int i = 0; i < ${len(DORY_HW_graph)}; i++)
+    if (l2_spill_output[i] == 1)
+      cl_ram_free((void *) layers_pointers[i], activations_out_size[i]);
+  % endif
 
-#ifdef TARGET_CHIP_FAMILY_GAP9
+#ifdef RESIDENT_CLUSTER
+  // L1 buffer is kept for the next inference
+#elif defined TARGET_CHIP_FAMILY_GAP9
   pi_cl_l1_free(NULL, L1_buffer, ${l1_buffer});
 #else
   pmsis_l1_malloc_free(L1_buffer, ${l1_buffer});
@@ -471,9 +795,10 @@ void ${prefix}network_run_cluster(void * args) {
   pi_perf_start();
 #endif
 
-  //memcpy(L2_output, l2_final_output, activations_out_size[${len(DORY_HW_graph)-1}]); // BUGGY!
-  for (int i=0; i<activations_out_size[${len(DORY_HW_graph)-1}]; i++)
-    *((uint8_t*)(l2_final_output+i)) = *((uint8_t*)(L2_output+i));
+  % if not output_l3:
+  if (!output_in_place)
+    memmove(l2_final_output, L2_output, activations_out_size[${last}]);
+  % endif
 
 #if defined PERF_LAYER || defined PERF_FINAL
   pi_perf_stop();
@@ -481,17 +806,24 @@ void ${prefix}network_run_cluster(void * args) {
 #endif
 
 #ifdef PERF_LAYER
+  print_perf("Setup", setup_cyc, 0 /*ops*/);
   print_perf("IO wait", io_cyc, 0 /*ops*/);
   print_perf("Bookkeeping", bookkeeping_cyc, 0 /*ops*/);
 #endif
 
 #ifdef CHECKSUM
-  checksum("final layer", L2_output, activations_out_size[${len(DORY_HW_graph)-1}], activations_out_checksum[${len(DORY_HW_graph)-1}][exec]);
+  checksum("final layer", ${"L2_output" if output_l3 else "l2_final_output"}, activations_out_size[${len(DORY_HW_graph)-1}], activations_out_checksum[${len(DORY_HW_graph)-1}][exec]);
 #endif
 
 #if defined PERF_LAYER || defined PERF_FINAL
   print_perf("Only network execution", cycle_network_execution, ${MACs});
-  print_perf("Total", cycle_network_execution + io_cyc + bookkeeping_cyc, ${MACs});
+  print_perf("Total", cycle_network_execution + io_cyc + setup_cyc + bookkeeping_cyc, ${MACs});
+#endif
+
+#ifdef PERF_LAYER_EXTENDED
+  // Every event has been counted once for each layer
+  if (++perf_extended_run % PERF_EXTENDED_EVENTS == 0)
+    ${prefix}print_perf_extended();
 #endif
 
 /* ---------------------------------- */
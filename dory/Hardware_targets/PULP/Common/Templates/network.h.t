@@ -41,9 +41,18 @@ typedef struct ${prefix}network_t {
 typedef struct ${prefix}network_args_t {
   void * l2_buffer;
   size_t l2_buffer_size;
+  // Input read in place by the first layer, NULL if it is at the beginning of l2_buffer
+  // (never with "bound_l2_input": the L2 plan leaves no room for it there)
+  void * l2_input;
+  // Output written in place by the last layer, copied only if it overlaps l2_buffer
   void * l2_final_output;
+% if l3_supported:
+  // RAM buffer written in place by the last layer when its output is tiled in L3, NULL to keep it in the network L3 buffer
+  void * l3_final_output;
+% endif
   int32_t exec;
   int32_t initial_allocator_dir;
+  void * input_stream;
 % if not l3_supported:
   void * l2_input_h;
 % endif
@@ -53,10 +62,16 @@ typedef struct ${prefix}network_args_t {
 void ${prefix}network_initialize(${prefix}network_t * network);
 void ${prefix}network_terminate(${prefix}network_t * network);
 void ${prefix}network_run_cluster(void * args);
+void ${prefix}network_run_task_async(${prefix}network_t * network, ${prefix}network_args_t * args, pi_task_t * task);
 void ${prefix}network_run_async(${prefix}network_t * network, ${prefix}network_args_t * args);
 void ${prefix}network_run_wait(${prefix}network_t * network);
 void ${prefix}network_run(${prefix}network_t * network, ${prefix}network_args_t * args);
 
+#ifdef PERF_LAYER_EXTENDED
+// The cores count one event at a time: network runs needed to count all of them
+#define PERF_EXTENDED_EVENTS 7
+#endif
+
 % if l3_supported and not single_input:
 static char * ${prefix}Input_names[${n_inputs}] = { \
   % for n in range(n_inputs-1):
@@ -72,7 +87,11 @@ static char * ${prefix}Input_names[${n_inputs}] = { \
 static const char * L3_weights_files[] = {
   ${files_list}
 };
+% if packed_weights:
+static int L3_weights_size[${weights_number}] = {${', '.join(str(w) for w in weights_blob_sizes)}};
+% else:
 static int L3_weights_size[${weights_number}];
+% endif
 static int layers_pointers[${len(DORY_HW_graph)}];
 % endif
 static char * Layers_name[${len(DORY_HW_graph)}] = {\
@@ -100,6 +119,12 @@ static int L3_output_layers[${len(DORY_HW_graph)}] = {\
 % endif
 % endfor
 };
+static int prefetch_weights[${len(DORY_HW_graph)}] = {${', '.join(str(p) for p in prefetch_weights)}};
+% if resident_weights:
+// Offsets of the weights kept in L2 from network_initialize to network_terminate, -1 if read from L3 at every run
+#define RESIDENT_WEIGHTS_SIZE ${resident_weights['size']}
+static int resident_weights_offset[${len(DORY_HW_graph)}] = {${', '.join(str(o) for o in resident_weights['offset'])}};
+% endif
 static int allocate_layer[${len(DORY_HW_graph)}] = {\
 % for node in DORY_HW_graph:
 % if node.tiling_dimensions["L3"]["weights_dimensions"] == node.tiling_dimensions["L2"]["weights_dimensions"] and ('FullyConnected' in node.name or 'Conv' in node.name):
@@ -155,7 +180,7 @@ ${node.check_sum_w}${'' if loop.last else ', '}\
 static int weights_size[${len(DORY_HW_graph)}] = {\
 % for node in DORY_HW_graph:
 % if l3_supported:
-${int((node.tiling_dimensions["L2"]["weight_memory"] + node.tiling_dimensions["L2"]["constants_memory"] + node.tiling_dimensions["L2"]["bias_memory"]) * (1 + int(node.tiling_dimensions["L3"]["weights_dimensions"] != node.tiling_dimensions["L2"]["weights_dimensions"])))}${'' if loop.last else ', '}\
+${int((node.tiling_dimensions["L2"]["weight_memory"] + node.tiling_dimensions["L2"]["constants_memory"] + node.tiling_dimensions["L2"]["bias_memory"]) * (1 + int(node.tiling_dimensions["L3"]["weights_dimensions"] != node.tiling_dimensions["L2"]["weights_dimensions"])) + (node.compressed_weights["staging_size"] if node.compressed_weights is not None else 0))}${'' if loop.last else ', '}\
 % else:
 ${int(node.tiling_dimensions["L2"]["weight_memory"] + node.tiling_dimensions["L2"]["constants_memory"] + node.tiling_dimensions["L2"]["bias_memory"])}${'' if loop.last else ', '}\
 % endif
@@ -173,7 +198,7 @@ static int activations_checksum[${len(DORY_HW_graph)}][${DORY_HW_graph[0].n_test
 static int activations_size[${len(DORY_HW_graph)}] = {\
 % for node in DORY_HW_graph:
 % if l3_supported:
-${int(node.tiling_dimensions["L2"]["input_activation_memory"] * (1 + int(node.tiling_dimensions["L3"]["input_dimensions"] != node.tiling_dimensions["L2"]["input_dimensions"])))}${'' if loop.last else ', '}\
+${int(node.tiling_dimensions["L2"]["input_activation_memory"] * (1 + int(node.tiling_dimensions["L3"]["input_dimensions"] != node.tiling_dimensions["L2"]["input_dimensions"])) + (node.compressed_input["staging_size"] if node.compressed_input is not None else 0))}${'' if loop.last else ', '}\
 % else:
 ${int(node.tiling_dimensions["L2"]["input_activation_memory"])}${'' if loop.last else ', '}\
 % endif
@@ -209,22 +234,39 @@ static int activations_out_checksum[${len(DORY_HW_graph)}][${DORY_HW_graph[0].n_
 static int activations_out_size[${len(DORY_HW_graph)}] = {\
 % for node in DORY_HW_graph:
 % if l3_supported:
-${int(node.tiling_dimensions["L2"]["output_activation_memory"] * (1 + int(node.tiling_dimensions["L3"]["output_dimensions"] != node.tiling_dimensions["L2"]["output_dimensions"])))}${'' if loop.last else ', '}\
+${int(node.tiling_dimensions["L2"]["output_activation_memory"] * (1 + int(node.tiling_dimensions["L3"]["output_dimensions"] != node.tiling_dimensions["L2"]["output_dimensions"])) + (node.compressed_output["staging_size"] if node.compressed_output is not None else 0))}${'' if loop.last else ', '}\
 % else:
 ${int(node.tiling_dimensions["L2"]["output_activation_memory"])}${'' if loop.last else ', '}\
 % endif
 % endfor
 };
+% if l2_plan:
+// Static L2 plan: offsets of the layer buffers in the network L2 buffer, -1 if unused, -2 for the network input
+#define L2_PLAN_SIZE ${l2_plan['size']}
+% for buffer in ['input', 'output', 'weights', 'bypass']:
+static int l2_${buffer}_offset[${len(DORY_HW_graph)}] = {${', '.join(str(o) for o in l2_plan[buffer])}};
+% endfor
+% if l3_supported:
+// Residuals not kept in L2: outputs written to L3, and producer of the input/bypass to read back (-1 if none)
+static int l2_spill_output[${len(DORY_HW_graph)}] = {${', '.join(str(o) for o in l2_plan['spill'])}};
+static int l2_reload_input[${len(DORY_HW_graph)}] = {${', '.join(str(o) for o in l2_plan['reload_input'])}};
+static int l2_reload_bypass[${len(DORY_HW_graph)}] = {${', '.join(str(o) for o in l2_plan['reload_bypass'])}};
+% endif
+% endif
+% if dvfs_plan:
+// Cluster frequency of every layer, see dvfs_plan.csv for the predicted latency and energy
+static int cluster_frequency[${len(DORY_HW_graph)}] = {${', '.join(str(f) for f in dvfs_plan['frequency'])}};
+% endif
 static int layer_with_weights[${len(DORY_HW_graph)}] = {\
 % for node in DORY_HW_graph:
-% if 'Conv' in node.name or 'FullyConnected' in node.name:
+% if node.has_weights():
 1${'' if loop.last else ', '}\
 % else:
 0${'' if loop.last else ', '}\
 % endif
 % endfor
 };
-#ifdef PERF_LAYER
+#if defined PERF_LAYER || defined PERF_LAYER_EXTENDED
 static int NODEs_MACS[${len(DORY_HW_graph)}] = {\
 % for node in DORY_HW_graph:
 ${node.MACs}${'' if loop.last else ', '}\
@@ -0,0 +1,233 @@
+#
+# PulpNNPerfModel.py
+#
+# Copyright (C) 2018-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from numpy import prod
+
+
+def div_and_ceil(a, b):
+    return ((a - 1) // b) + 1
+
+
+class PulpNNPerfModel:
+    # Analytical cycle model of the 8-bit pulp-nn kernels called by the L2
+    # layer template, plus the mchan transfers of the L2-L1 tiling loop.
+    # Constants are cluster cycles and were fitted on GAP8 PERF_LAYER runs;
+    # use scripts/perf_model_check.py to re-check them on a new target.
+    CORES = 8
+    # 4x2 matmul: 4 output channels x 2 pixels, 8 sdotp + 6 loads per 4 input bytes
+    MATMUL_4x2_CYCLES = 14
+    # leftover output channels (k_out % 4) fall back to a 1x2 matmul
+    MATMUL_1x2_CYCLES = 5
+    # per output pixel: normalization, quantization and store
+    QNT_CYCLES = 6
+    # im2col copies word by word, with a fixed cost per buffer
+    IM2COL_CYCLES_PER_BYTE = 0.35
+    IM2COL_OVERHEAD = 12
+    # depthwise works on one channel at a time with no SIMD reuse
+    DW_CYCLES_PER_MAC = 1.25
+    DW_IM2COL_CYCLES_PER_BYTE = 0.6
+    LINEAR_CYCLES_PER_4_MACS = 2.5
+    # fork, barrier and argument unpacking of a single kernel call
+    KERNEL_OVERHEAD = 250
+    # index bookkeeping and DMA programming of one tile on core 0
+    TILE_OVERHEAD = 350
+    DMA_SETUP = 30
+    DMA_ROW_CYCLES = 2
+    # HWC to CHW transposition of a depthwise input tile on the cluster
+    # (dory_hwc_to_chw): 4x4 bytes blocks shuffled in registers, plus barriers
+    TRANSPOSE_CYCLES_PER_BYTE = 1.25
+    TRANSPOSE_OVERHEAD = 60
+
+    def __init__(self, operation, kernel_shape, stride=(1, 1), bandwidth=8, double_buffering=2):
+        # operation is one of 'conv', 'pointwise', 'depthwise', 'linear'
+        self.operation = operation
+        self.kernel_shape = kernel_shape
+        self.stride = stride
+        self.bandwidth = bandwidth
+        self.double_buffering = double_buffering
+        # depthwise input tiles are transposed to CHW by the DMA ('dma') or by the cluster ('cluster')
+        self.dw_input = 'dma'
+        self.layer = (1, 1, 1, 1)
+
+    @classmethod
+    def from_node(cls, HW_node, double_buffering=2):
+        # Same kernel selection as layer_L2_c_conv_template.c
+        ks = tuple(HW_node.kernel_shape)
+        s = tuple(HW_node.strides)
+        if HW_node.group > 1:
+            operation = 'depthwise'
+        elif 'FullyConnected' in HW_node.name:
+            operation = 'linear'
+        elif prod(ks) > 1 or s[0] > 1:
+            operation = 'conv'
+        else:
+            operation = 'pointwise'
+        bandwidth = HW_node.HW_description["memory"]["L2"]["bandwidth"] or 8
+        model = cls(operation, ks, s, bandwidth, double_buffering)
+        model.dw_input = HW_node.dw_input_transpose
+        return model
+
+    def set_layer(self, layer):
+        # layer = (h_out, w_out, k_out, k_in)
+        self.layer = layer
+        return self
+
+    @property
+    def layer_shape_in(self):
+        h_out, w_out, _, k_in = self.layer
+        return ((h_out - 1) * self.stride[0] + self.kernel_shape[0],
+                (w_out - 1) * self.stride[1] + self.kernel_shape[1],
+                k_in)
+
+    def matmul_latency(self, k_out, reduction):
+        steps = div_and_ceil(reduction, 4)
+        return (k_out // 4) * steps * self.MATMUL_4x2_CYCLES + (k_out % 4) * steps * self.MATMUL_1x2_CYCLES + \
+               2 * k_out * self.QNT_CYCLES
+
+    @property
+    def conv_latency(self):
+        h_out, w_out, k_out, k_in = self.layer
+        reduction = self.kernel_shape[0] * self.kernel_shape[1] * k_in
+        im2col = self.IM2COL_OVERHEAD + 2 * reduction * self.IM2COL_CYCLES_PER_BYTE
+        rows_per_core = div_and_ceil(h_out, self.CORES)
+        return rows_per_core * div_and_ceil(w_out, 2) * (im2col + self.matmul_latency(k_out, reduction))
+
+    @property
+    def pointwise_latency(self):
+        h_out, w_out, k_out, k_in = self.layer
+        pixels_per_core = div_and_ceil(h_out * w_out, self.CORES)
+        return div_and_ceil(pixels_per_core, 2) * self.matmul_latency(k_out, k_in)
+
+    @property
+    def depthwise_latency(self):
+        h_out, w_out, k_out, _ = self.layer
+        h_in, _, _ = self.layer_shape_in
+        channels_per_core = div_and_ceil(k_out, self.CORES)
+        im2col = self.IM2COL_OVERHEAD + h_in * self.kernel_shape[1] * self.DW_IM2COL_CYCLES_PER_BYTE
+        per_column = im2col + h_out * (prod(self.kernel_shape) * self.DW_CYCLES_PER_MAC + self.QNT_CYCLES)
+        return channels_per_core * w_out * per_column
+
+    @property
+    def linear_latency(self):
+        _, _, k_out, k_in = self.layer
+        outputs_per_core = div_and_ceil(k_out, self.CORES)
+        return outputs_per_core * (div_and_ceil(k_in, 4) * self.LINEAR_CYCLES_PER_4_MACS + self.QNT_CYCLES)
+
+    @property
+    def latency(self):
+        compute = {
+            'conv': lambda: self.conv_latency,
+            'pointwise': lambda: self.pointwise_latency,
+            'depthwise': lambda: self.depthwise_latency,
+            'linear': lambda: self.linear_latency,
+        }[self.operation]()
+        return int(self.KERNEL_OVERHEAD + compute)
+
+    @property
+    def ops(self):
+        h_out, w_out, k_out, k_in = self.layer
+        if self.operation == 'depthwise':
+            return prod(self.kernel_shape) * h_out * w_out * k_out
+        return prod(self.kernel_shape) * h_out * w_out * k_out * k_in
+
+    def dma_latency(self, size, rows=1):
+        # One mchan command moving size bytes split in rows 1D bursts
+        if size == 0:
+            return 0
+        return int(self.DMA_SETUP + rows * self.DMA_ROW_CYCLES + size / self.bandwidth)
+
+    def tile_dma_latency(self, layer_shape_in, layer_shape_out, load_weights, bits=(8, 8, 8)):
+        # Transfers of the current tile: (input [+ weights], output)
+        h_out, w_out, k_out, k_in = self.layer
+        h_in, w_in, _ = self.layer_shape_in
+        h_in, w_in = min(h_in, layer_shape_in[0]), min(w_in, layer_shape_in[1])
+        in_bits, out_bits, w_bits = bits
+        # HWC tiles are contiguous only when they span whole rows and channels
+        in_rows = 1 if k_in == layer_shape_in[2] and w_in == layer_shape_in[1] else h_in * (1 if k_in == layer_shape_in[2] else w_in)
+        out_rows = 1 if k_out == layer_shape_out[2] and w_out == layer_shape_out[1] else h_out * (1 if k_out == layer_shape_out[2] else w_out)
+        if self.operation == 'depthwise' and self.dw_input == 'dma':
+            # one command per channel, moving a byte per burst (dory_dma_memcpy_hwc_to_chw)
+            dma_in = k_in * self.dma_latency(h_in * w_in * in_bits // 8, h_in * w_in)
+        else:
+            dma_in = self.dma_latency(h_in * w_in * k_in * in_bits // 8, in_rows)
+        if load_weights:
+            weights = k_out * prod(self.kernel_shape) * (1 if self.operation == 'depthwise' else k_in) * w_bits // 8
+            # weights, then k and lambda
+            dma_in += self.dma_latency(weights) + 2 * self.dma_latency(k_out * 4)
+        dma_out = self.dma_latency(h_out * w_out * k_out * out_bits // 8, out_rows)
+        return dma_in, dma_out
+
+    def transpose_latency(self, layer_shape_in):
+        # HWC to CHW transposition of the current input tile by all the cores
+        if self.operation != 'depthwise' or self.dw_input != 'cluster':
+            return 0
+        h_in, w_in, k_in = self.layer_shape_in
+        size = min(h_in, layer_shape_in[0]) * min(w_in, layer_shape_in[1]) * k_in
+        return int(self.TRANSPOSE_OVERHEAD + size * self.TRANSPOSE_CYCLES_PER_BYTE / self.CORES)
+
+    def tiled_layer_latency(self, layer_shape_in, layer_shape_out, tile_shape_out, bits=(8, 8, 8)):
+        # Latency of the whole L2-L1 tiling loop. Tiles are visited with the
+        # output channels outermost, so weights are reloaded only when the
+        # channel tile changes. With double buffering the transfers of the
+        # next tile run under the kernel of the current one.
+        k_in_full = layer_shape_in[2]
+        counts, remainders = [], []
+        for dim in range(3):
+            counts.append(layer_shape_out[dim] // tile_shape_out[dim])
+            remainders.append(layer_shape_out[dim] % tile_shape_out[dim])
+        h_choices = [(tile_shape_out[0], counts[0])] + ([(remainders[0], 1)] if remainders[0] else [])
+        w_choices = [(tile_shape_out[1], counts[1])] + ([(remainders[1], 1)] if remainders[1] else [])
+        k_choices = [(tile_shape_out[2], counts[2])] + ([(remainders[2], 1)] if remainders[2] else [])
+        n_spatial = sum(n for _, n in h_choices) * sum(n for _, n in w_choices)
+
+        latency = 0
+        first_in = 0
+        last_out = 0
+        for k, n_k in k_choices:
+            k_in = k if self.operation == 'depthwise' else k_in_full
+            for h, n_h in h_choices:
+                for w, n_w in w_choices:
+                    n = n_k * n_h * n_w
+                    self.set_layer((h, w, k, k_in))
+                    compute = self.latency + self.TILE_OVERHEAD + self.transpose_latency(layer_shape_in)
+                    # the first spatial tile of every channel tile also moves the weights
+                    dma_in, dma_out = self.tile_dma_latency(layer_shape_in, layer_shape_out, False, bits)
+                    dma_in_w, _ = self.tile_dma_latency(layer_shape_in, layer_shape_out, True, bits)
+                    n_weights = n_k if (h, w) == (h_choices[0][0], w_choices[0][0]) else 0
+                    if self.double_buffering > 1:
+                        step = max(compute, dma_in + dma_out)
+                        step_w = max(compute, dma_in_w + dma_out)
+                    else:
+                        step = compute + dma_in + dma_out
+                        step_w = compute + dma_in_w + dma_out
+                    latency += n_weights * step_w + (n - n_weights) * step
+                    if not first_in:
+                        first_in = dma_in_w
+                    last_out = dma_out
+        if self.double_buffering > 1:
+            # the pipeline is not overlapped on the first load and last store
+            latency += first_in + last_out
+        return int(latency)
+
+
+if __name__ == "__main__":
+    # layer = (Ho, Wo, Ko, Ki)
+    layer = (24, 40, 32, 32)
+    model = PulpNNPerfModel('conv', (3, 3))
+    model.set_layer(layer)
+    print(f'Latency:{model.latency} cycles, ops:{model.ops} MACs, Perf:{model.ops / model.latency:.2f} MAC/cycle')
+    print(f'Tiled (12, 40, 16): {model.tiled_layer_latency((26, 42, 32), (24, 40, 32), (12, 40, 16))} cycles')
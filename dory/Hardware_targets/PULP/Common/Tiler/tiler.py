@@ -21,6 +21,16 @@
 from .tiler_conv2d import Tiler_Conv2D_PULP as Tiler_Conv2D
 from .tiler_pool2d import Tiler_Pool2D_PULP as Tiler_Pool2D
 from .tiler_add import Tiler_Add_PULP as Tiler_Add
+from .tiler_dw_pw import Tiler_DW_PW_PULP as Tiler_DW_PW
+from .tiler_fused_group import Tiler_Fused_Group_PULP as Tiler_Fused_Group
+
+
+def layer_double_buffering(HW_description, name, double_buffering):
+    # The L2 templates of the layers in "single_buffered_layers" keep a single L1 buffer per tensor,
+    # so they are tiled and laid out in L1 without the double buffering of the other layers.
+    if any(layer in name for layer in HW_description.get("single_buffered_layers", [])):
+        return 1
+    return double_buffering
 
 
 class Tiler_PULP:
@@ -29,13 +39,17 @@ class Tiler_PULP:
         self.HW_node = HW_node
         self.previous_HW_node = previous_HW_node
         self.code_reserved_space = code_reserved_space
-        self.double_buffering = double_buffering
+        self.double_buffering = layer_double_buffering(HW_node.HW_description, HW_node.name, double_buffering)
         self.n_memory_levels = HW_node.HW_description['memory']['levels']
 
     def get_tiling(self, level):
         # This function is used to create the tiling of either a convolutional layer or
         # a fully connected or a pooling layer. The relu is included automatically in conv/FC.
-        if 'Conv' in self.HW_node.name or  'FullyConnected' in self.HW_node.name:
+        if 'DepthwisePointwise' in self.HW_node.name:
+            return Tiler_DW_PW(self).get_tiling(level)
+        elif 'FusedGroup' in self.HW_node.name:
+            return Tiler_Fused_Group(self).get_tiling(level)
+        elif 'Conv' in self.HW_node.name or  'FullyConnected' in self.HW_node.name:
             return Tiler_Conv2D(self).get_tiling(level)
         elif 'Pool' in self.HW_node.name:
             return Tiler_Pool2D(self).get_tiling(level)
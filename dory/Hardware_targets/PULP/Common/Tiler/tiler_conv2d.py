@@ -27,6 +27,7 @@ import os
 import sys
 from ortools.constraint_solver import pywrapcp
 from ortools.constraint_solver import solver_parameters_pb2
+from .PulpNNPerfModel import PulpNNPerfModel, div_and_ceil
 CORES = 8
 
 
@@ -41,10 +42,12 @@ class Tiler_Conv2D_PULP():
             # L3 tiling
             tiling = self.get_tiling_conv2d_L3()
             if (self.HW_node.output_channels > tiling[0][0]) and ((self.HW_node.input_dimensions[0] > tiling[1][1]) or (self.HW_node.output_dimensions[0] > tiling[2][1])):
-                print("Convolution: Tiling of weights and Input/output activation from L3 not yet working. Exiting...")
-                os._exit(0)
-            else:
-                return tiling
+                # the GAP9 L3 template only tiles either the weights or the activations
+                if self.HW_node.HW_description["name"].startswith("PULP/GAP9"):
+                    print("Convolution: Tiling of weights and Input/output activation from L3 not yet working. Exiting...")
+                    os._exit(0)
+                self.HW_node.L3_loop_order = self.loop_order_conv2d_L3(tiling)
+            return tiling
         if level == 2:
             # L3 tiling
             tiling = self.get_tiling_conv2d_L2()
@@ -146,6 +149,10 @@ class Tiler_Conv2D_PULP():
                 solver.Add(tile_h_out * s[0] == (tile_h_in - (ks[0] - 1) + (s[0] - 1)))
             if db_x == 2:
                 solver.Add(0  == (out_dim[0] - zero_variable) % ((tile_h_in - ks[0] + s[0]) // s[0]))
+            if db_W == 2:
+                # weights tiles, also nested with bands of rows: both have to split the layer evenly
+                solver.Add(0 == (out_ch - zero_variable) % tile_n_out)
+                solver.Add(0 == (out_dim[0] - zero_variable) % tile_h_out)
 
 
             # objective              
@@ -214,6 +221,34 @@ class Tiler_Conv2D_PULP():
         os._exit(0)
         return None
 
+    def loop_order_conv2d_L3(self, tiling):
+        '''
+        Loop order of a layer tiled from L3 both in output channels and in bands of rows:
+        "bands" reads all the weights tiles for every band, "weights" reads every weights tile
+        once and the input bands for every weights tile. The one moving less bytes is chosen.
+        '''
+        ks = self.HW_node.kernel_shape
+        s = self.HW_node.strides
+        out_dim = self.HW_node.output_dimensions
+        (tile_n_out, _), (in_ch, tile_h_in, w_in), (_, tile_h_out, _) = tiling
+        n_tile_W = self.HW_node.output_channels // tile_n_out
+        input_tiled = self.HW_node.L3_input and self.HW_node.input_dimensions[0] > tile_h_in
+        if input_tiled:
+            n_bands = out_dim[0] // ((tile_h_in - ks[0] + s[0]) // s[0])
+            input_traffic = n_bands * in_ch * tile_h_in * w_in * self.HW_node.input_activation_bits // 8
+        else:
+            n_bands = out_dim[0] // tile_h_out
+            input_traffic = self.HW_node.input_activation_memory if self.HW_node.L3_input else 0
+        weights_traffic = self.HW_node.weight_memory + self.HW_node.bias_memory + self.HW_node.constants_memory
+        # the output is written once in both orders
+        traffic = {"bands": weights_traffic * n_bands + input_traffic,
+                   "weights": weights_traffic + input_traffic * (n_tile_W if input_tiled else 1)}
+        order = "weights" if traffic["weights"] < traffic["bands"] else "bands"
+        print("  {}: {} weights tiles x {} bands, {} loop outer: {} bytes read from L3 ({} with the other order)".format(
+            self.HW_node.name, n_tile_W, n_bands, order, int(traffic[order]),
+            int(traffic["bands" if order == "weights" else "weights"])))
+        return order
+
 
 
 
@@ -268,9 +303,16 @@ class Tiler_Conv2D_PULP():
         buffer_total = self.HW_node.tiling_dimensions["L2"]["weight_memory"] + self.HW_node.tiling_dimensions["L2"]["constants_memory"] + self.HW_node.tiling_dimensions["L2"]["bias_memory"] + in_mem + out_mem + im2col_dim + weight_full_prec_dim
         # return immediatly if the memory fits the L1  
         if buffer_total <= L1_memory:
-            return (self.HW_node.tiling_dimensions["L2"]["weights_dimensions"] , [self.HW_node.tiling_dimensions["L2"]["input_dimensions"][0], h_in, self.HW_node.tiling_dimensions["L2"]["input_dimensions"][2]] , [self.HW_node.tiling_dimensions["L2"]["weights_dimensions"][0], h_out, self.HW_node.tiling_dimensions["L2"]["output_dimensions"][2]] )
+            if self.HW_node.HW_description.get("tiler_cost_model", "heuristic") == "latency":
+                model = PulpNNPerfModel.from_node(self.HW_node, 1)
+                self.HW_node.predicted_latency = self.tiled_latency_conv2d_L2(model, inp_dim, out_dim, in_ch, out_ch, (out_dim[0], out_dim[1], out_ch))
+            tiling = (self.HW_node.tiling_dimensions["L2"]["weights_dimensions"] , [self.HW_node.tiling_dimensions["L2"]["input_dimensions"][0], h_in, self.HW_node.tiling_dimensions["L2"]["input_dimensions"][2]] , [self.HW_node.tiling_dimensions["L2"]["weights_dimensions"][0], h_out, self.HW_node.tiling_dimensions["L2"]["output_dimensions"][2]] )
+            self.dw_input_transpose_conv2d_L2(tiling, L1_memory, inp_dim, out_dim, in_ch, out_ch, 1)
+            return tiling
         else:
             db = self.double_buffering
+        if self.HW_node.HW_description.get("tiler_cost_model", "heuristic") == "latency":
+            return self.get_tiling_conv2d_L2_latency(L1_memory, inp_dim, out_dim, in_ch, out_ch, db)
 
         ###############################################
         ##### TILING OF LAYER USING ORTOOLS ###########
@@ -325,31 +367,7 @@ class Tiler_Conv2D_PULP():
         ##### CONSTRAINTS FOR DIMENSION ###############
         ###############################################
 
-        input_tile_dimension  = db * (tile_n_in * tile_h_in * tile_w_in * self.HW_node.input_activation_bits) // 8
-        output_tile_dimension = db * (tile_n_out * tile_h_out * tile_w_out * self.HW_node.output_activation_bits) // 8
-        if g == 1:
-            weight_tile_dimension = db * tile_n_in * tile_n_out * np.prod(ks) * self.HW_node.weight_bits // 8
-            im2col_dimension = 2 * CORES * np.prod(ks) * tile_n_in
-            weight_full_prec_dimension = 0
-        else:
-            weight_tile_dimension = (db * tile_n_in * np.prod(ks) * self.HW_node.weight_bits) // 8
-            im2col_dimension = CORES * (ks[0] * (tile_n_in + p[0] + p[2]) + ks[0]) * int( 8 / min(self.HW_node.input_activation_bits, self.HW_node.output_activation_bits, self.HW_node.weight_bits))
-            weight_full_prec_dimension = 0
-            if self.HW_node.weight_bits != 8:
-                weight_full_prec_dimension = db * 8 * 8 * np.prod(ks) * int( 8 / min(self.HW_node.input_activation_bits, self.HW_node.output_activation_bits, self.HW_node.weight_bits))
-        if "FullyConnected" in self.HW_node.name:
-            im2col_dimension = 0
-
-        constants = 0
-        for name in self.HW_node.constant_names:
-            if name in ["l","k"]:
-                constants+=1
-        if constants > 0:
-            constants_tile_dimension = db * tile_n_out * constants  * self.HW_node.constant_bits // 8
-        else:
-            constants_tile_dimension = 0
-
-        constraint_all = self.HW_node.tiling_dimensions["L2"]["bias_memory"] + input_tile_dimension + output_tile_dimension + weight_tile_dimension + constants_tile_dimension + im2col_dimension + weight_full_prec_dimension + 40 
+        constraint_all = self.l1_tile_dimension_conv2d_L2(tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out, db)
 
         solver.Add(constraint_all <= L1_memory)
 
@@ -426,8 +444,140 @@ class Tiler_Conv2D_PULP():
                 tile_w_in = inp_dim[1]
                 tile_w_out = int((tile_w_in -(ks[1] - 1) + (p[1] + p[3]) + (s[0] - 1))/s[0])
 
-            return ([tile_n_out, tile_n_in], [tile_n_in, tile_h_in, tile_w_in], [tile_n_out, tile_h_out, tile_w_out])
+            tiling = ([tile_n_out, tile_n_in], [tile_n_in, tile_h_in, tile_w_in], [tile_n_out, tile_h_out, tile_w_out])
+            self.dw_input_transpose_conv2d_L2(tiling, L1_memory, inp_dim, out_dim, in_ch, out_ch, db)
+            return tiling
         print("  Conv2d ERROR: no L2-L1 tiling found of layer {} with dimensions {} / {}, input / output channels {} / {}. Exiting...".format(self.HW_node.__dict__["name"], self.HW_node.__dict__["input_dimensions"], self.HW_node.__dict__["output_dimensions"], self.HW_node.__dict__["input_channels"], self.HW_node.__dict__["output_channels"] ))
         os._exit(0)
         return None
 
+
+    def l1_tile_dimension_conv2d_L2(self, tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out, db):
+        '''
+        L1 footprint of an L2-L1 tile: input, output, weights and constants buffers, each db times,
+        plus the im2col and weights buffers of the kernels. Works on integers as well as on the
+        ortools variables of get_tiling_conv2d_L2.
+        '''
+        ks = self.HW_node.kernel_shape
+        p = self.HW_node.pads
+        granularity = int(8 / min(self.HW_node.input_activation_bits, self.HW_node.output_activation_bits, self.HW_node.weight_bits))
+        input_tile_dimension  = db * (tile_n_in * tile_h_in * tile_w_in * self.HW_node.input_activation_bits) // 8
+        output_tile_dimension = db * (tile_n_out * tile_h_out * tile_w_out * self.HW_node.output_activation_bits) // 8
+        if self.HW_node.group == 1:
+            weight_tile_dimension = db * tile_n_in * tile_n_out * np.prod(ks) * self.HW_node.weight_bits // 8
+            im2col_dimension = 2 * CORES * np.prod(ks) * tile_n_in
+            weight_full_prec_dimension = 0
+        else:
+            weight_tile_dimension = (db * tile_n_in * np.prod(ks) * self.HW_node.weight_bits) // 8
+            im2col_dimension = CORES * (ks[0] * (tile_n_in + p[0] + p[2]) + ks[0]) * granularity
+            weight_full_prec_dimension = 0
+            if self.HW_node.weight_bits != 8:
+                weight_full_prec_dimension = db * 8 * 8 * np.prod(ks) * granularity
+        if "FullyConnected" in self.HW_node.name:
+            im2col_dimension = 0
+
+        constants = len([name for name in self.HW_node.constant_names if name in ["l", "k"]])
+        constants_tile_dimension = db * tile_n_out * constants * self.HW_node.constant_bits // 8
+
+        return self.HW_node.tiling_dimensions["L2"]["bias_memory"] + input_tile_dimension + output_tile_dimension + weight_tile_dimension + constants_tile_dimension + im2col_dimension + weight_full_prec_dimension + 40
+
+    def dw_input_transpose_conv2d_L2(self, tiling, L1_memory, inp_dim, out_dim, in_ch, out_ch, db):
+        '''
+        Depthwise kernels read their input tiles in CHW, while they are HWC in L2. They are either
+        transposed by the DMA, moving a byte per burst, or transferred as they are into an L1 staging
+        buffer and transposed by the cluster (dory_hwc_to_chw). With "dw_cluster_transpose" in the HW
+        description, sets node.dw_input_transpose to the one with the lowest latency predicted by
+        PulpNNPerfModel, "cluster" only if the staging buffer also fits in L1.
+        '''
+        if self.HW_node.group == 1 or not self.HW_node.HW_description.get("dw_cluster_transpose", False):
+            return
+        if self.HW_node.input_activation_bits != 8:
+            return
+        ks = self.HW_node.kernel_shape
+        tile_n_out = tiling[0][0]
+        tile_n_in, tile_h_in, tile_w_in = tiling[1]
+        tile_h_out, tile_w_out = tiling[2][1:]
+        granularity = int(8 / min(self.HW_node.input_activation_bits, self.HW_node.output_activation_bits, self.HW_node.weight_bits))
+
+        constraint_all = self.l1_tile_dimension_conv2d_L2(tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out, db)
+        # the im2col buffer of print_template_layer spans the rows of the tile, that of the tiler its channels
+        constraint_all += CORES * ks[0] * max(tile_h_in - tile_n_in, 0) * granularity
+        # the staging buffer follows the weights transposition buffer of the kernel, see print_template_layer
+        staging_dimension = 8 * np.prod(ks) * granularity + tile_n_in * tile_h_in * tile_w_in + 8
+        if constraint_all + staging_dimension > L1_memory:
+            return
+
+        model = PulpNNPerfModel.from_node(self.HW_node, db)
+        latency = {}
+        for dw_input in ["dma", "cluster"]:
+            model.dw_input = dw_input
+            latency[dw_input] = self.tiled_latency_conv2d_L2(model, inp_dim, out_dim, in_ch, out_ch, (tile_h_out, tile_w_out, tile_n_out))
+        if latency["cluster"] < latency["dma"]:
+            self.HW_node.dw_input_transpose = "cluster"
+            if getattr(self.HW_node, "predicted_latency", None) is not None:
+                self.HW_node.predicted_latency = latency["cluster"]
+
+    def tiled_latency_conv2d_L2(self, model, inp_dim, out_dim, in_ch, out_ch, tile_shape_out):
+        bits = (self.HW_node.input_activation_bits, self.HW_node.output_activation_bits, self.HW_node.weight_bits)
+        return model.tiled_layer_latency((inp_dim[0], inp_dim[1], in_ch), (out_dim[0], out_dim[1], out_ch), tile_shape_out, bits)
+
+    def get_tiling_conv2d_L2_latency(self, L1_memory, inp_dim, out_dim, in_ch, out_ch, db):
+        '''
+        Function To make the tile from L2 to L1 minimizing the latency predicted by PulpNNPerfModel.
+        Candidates satisfy the same geometrical, backend and L1 constraints as the ortools search.
+        '''
+        ks = self.HW_node.kernel_shape
+        s = self.HW_node.strides
+        g = self.HW_node.group
+        p = self.HW_node.pads
+        model = PulpNNPerfModel.from_node(self.HW_node, db)
+        granularity = int(8 / min(self.HW_node.input_activation_bits, self.HW_node.output_activation_bits, self.HW_node.weight_bits))
+
+        def splits(dim, multiple=1):
+            # smallest tile for each number of tiles along a dimension
+            sizes = set()
+            for n_tiles in range(1, dim + 1):
+                size = div_and_ceil(div_and_ceil(dim, n_tiles), multiple) * multiple
+                if size <= dim:
+                    sizes.add(size)
+            return sorted(sizes)
+
+        def spatial(axis, tiled):
+            full_in = inp_dim[axis]
+            full_out = int((full_in - (ks[axis] - 1) + (p[axis] + p[axis + 2]) + (s[axis] - 1)) / s[axis])
+            candidates = [(full_in, full_out)]
+            if tiled:
+                for tile_out in splits(out_dim[axis]):
+                    tile_in = (tile_out - 1) * s[axis] + ks[axis]
+                    if tile_in < full_in:
+                        candidates.append((tile_in, tile_out))
+            return candidates
+
+        if g > 1 and inp_dim[0] <= 32 and inp_dim[1] <= 32:
+            h_candidates, w_candidates = spatial(0, False), spatial(1, False)
+        elif g > 1:
+            h_candidates, w_candidates = spatial(0, True), spatial(1, False)
+        else:
+            h_candidates, w_candidates = spatial(0, True), spatial(1, True)
+
+        best = None
+        for tile_n_out in splits(out_ch, granularity):
+            tile_n_in = in_ch if g == 1 else tile_n_out
+            for tile_h_in, tile_h_out in h_candidates:
+                for tile_w_in, tile_w_out in w_candidates:
+                    constraint_all = self.l1_tile_dimension_conv2d_L2(tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out, db)
+                    if constraint_all > L1_memory:
+                        continue
+                    latency = self.tiled_latency_conv2d_L2(model, inp_dim, out_dim, in_ch, out_ch, (tile_h_out, tile_w_out, tile_n_out))
+                    if best is None or (latency, constraint_all) < best[0]:
+                        best = ((latency, constraint_all), (tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out))
+
+        if best is not None:
+            tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out = best[1]
+            self.HW_node.predicted_latency = best[0][0]
+            tiling = ([tile_n_out, tile_n_in], [tile_n_in, tile_h_in, tile_w_in], [tile_n_out, tile_h_out, tile_w_out])
+            self.dw_input_transpose_conv2d_L2(tiling, L1_memory, inp_dim, out_dim, in_ch, out_ch, db)
+            return tiling
+        print("  Conv2d ERROR: no L2-L1 tiling found of layer {} with dimensions {} / {}, input / output channels {} / {}. Exiting...".format(self.HW_node.__dict__["name"], self.HW_node.__dict__["input_dimensions"], self.HW_node.__dict__["output_dimensions"], self.HW_node.__dict__["input_channels"], self.HW_node.__dict__["output_channels"] ))
+        os._exit(0)
+        return None
@@ -0,0 +1,106 @@
+#
+# tiler_dw_pw.py
+#
+# Copyright (C) 2018-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Libraries
+import numpy as np
+import os
+CORES = 8
+
+
+def pad_to_word(size):
+    return int(size + (-size) % 4)
+
+
+def dw_pw_weights_memory(channels, out_channels, ks, constant_bits):
+    # Depthwise weights, k, lambda, then pointwise weights, k, lambda, as laid out by
+    # HW_node.weights_blob: each weight tensor is padded to a word to keep k and lambda aligned.
+    constants = 2 * constant_bits // 8
+    return pad_to_word(channels * ks[0] * ks[1]) + channels * constants + pad_to_word(channels * out_channels) + out_channels * constants
+
+
+def dw_pw_l1_memory(channels, out_channels, w_in, w_out, tile_h_in, tile_h_out, ks, p, constant_bits, db):
+    # Joint L1 footprint of a fused depthwise + pointwise tile: the input and output tiles are
+    # double buffered, the depthwise output is a single buffer consumed in place by the pointwise,
+    # and the weights of both layers stay in L1 for the whole layer. The depthwise im2col and
+    # transposition buffers are reused as pointwise im2col.
+    input_tile_dimension = db * channels * tile_h_in * w_in
+    intermediate_tile_dimension = channels * tile_h_out * w_out
+    output_tile_dimension = db * out_channels * tile_h_out * w_out
+    im2col_dimension = max(CORES * (ks[0] * (tile_h_in + p[0] + p[2]) + ks[0]) + CORES * tile_h_out, 2 * CORES * channels)
+    weights_dimension = dw_pw_weights_memory(channels, out_channels, ks, constant_bits)
+    return input_tile_dimension + intermediate_tile_dimension + output_tile_dimension + im2col_dimension + weights_dimension + 48
+
+
+def fused_node_fits_L2(HW_node, previous_HW_node, code_reserved_space):
+    # Fused nodes are never tiled from L3: their input, output and weights must all fit L2,
+    # and the previous layer must leave its output there.
+    L2_memory = HW_node.HW_description["memory"]["L2"]["dimension"] - code_reserved_space
+    input_L3 = not isinstance(previous_HW_node.tiling_dimensions["L2"]["output_dimensions"], type(None)) and \
+        previous_HW_node.tiling_dimensions["L3"]["output_dimensions"] != previous_HW_node.tiling_dimensions["L2"]["output_dimensions"]
+    buffer_total = HW_node.input_activation_memory + HW_node.output_activation_memory + HW_node.weight_memory + HW_node.bias_memory + HW_node.constants_memory
+    return buffer_total <= L2_memory and not input_L3
+
+
+class Tiler_DW_PW_PULP():
+    # Class to generate the Tiling of a fused depthwise + pointwise layer.
+    # The depthwise geometry is stored in the dw_* attributes of the node,
+    # see Pattern_rewriter_PULP.DepthwisePointwise_pattern_rewriter.
+    def __init__(self,tiler):
+        self.__dict__ = tiler.__dict__
+
+    def get_tiling(self, level):
+        if level == 3:
+            return self.get_tiling_dw_pw_L3()
+        if level == 2:
+            return self.get_tiling_dw_pw_L2()
+        print("Error: Either you should be in L3-L2 tiling or L2-L1 tiling")
+        os._exit(0)
+
+    def get_tiling_dw_pw_L3(self):
+        # The fused layer is never tiled from L3: when it does not fit L2, or its input is
+        # in L3, onnx_manager_PULP.tiling splits it back in its two layers before tiling.
+        if fused_node_fits_L2(self.HW_node, self.previous_HW_node, self.code_reserved_space):
+            return ([self.HW_node.output_channels, self.HW_node.input_channels], [self.HW_node.input_channels, self.HW_node.input_dimensions[0], self.HW_node.input_dimensions[1]], [self.HW_node.output_channels, self.HW_node.output_dimensions[0], self.HW_node.output_dimensions[1]])
+        print("  DepthwisePointwise ERROR: layer {} must be tiled from L3 and should have been split. Exiting...".format(self.HW_node.name))
+        os._exit(0)
+
+    def get_tiling_dw_pw_L2(self):
+        '''
+        Function To make the tile from L2 to L1: only output rows are tiled, both layers
+        always work on the whole width and on all the channels.
+        '''
+        L1_memory = self.HW_node.HW_description["memory"]["L1"]["dimension"] - self.HW_node.HW_description["HW specific parameters"]["accelerator core0 stack"] - 7 * self.HW_node.HW_description["HW specific parameters"]["accelerator core1-7 stack"]
+        ks = self.HW_node.dw_kernel_shape
+        s = self.HW_node.dw_strides
+        p = self.HW_node.dw_pads
+        channels = self.HW_node.input_channels
+        out_channels = self.HW_node.output_channels
+        h_in, w_in = self.HW_node.input_dimensions
+        h_out, w_out = self.HW_node.output_dimensions
+        db = self.double_buffering
+
+        def memory(tile_h_in, tile_h_out, db):
+            return dw_pw_l1_memory(channels, out_channels, w_in, w_out, tile_h_in, tile_h_out, ks, p, self.HW_node.constant_bits, db)
+
+        if memory(h_in, h_out, 1) <= L1_memory:
+            return ([out_channels, channels], [channels, h_in, w_in], [out_channels, h_out, w_out])
+        for tile_h_out in range(h_out - 1, 0, -1):
+            tile_h_in = min((tile_h_out - 1) * s[0] + ks[0], h_in)
+            if memory(tile_h_in, tile_h_out, db) <= L1_memory:
+                return ([out_channels, channels], [channels, tile_h_in, w_in], [out_channels, tile_h_out, w_out])
+        print("  DepthwisePointwise ERROR: no L2-L1 tiling found of layer {} with dimensions {} / {}, input / output channels {} / {}. Exiting...".format(self.HW_node.name, self.HW_node.input_dimensions, self.HW_node.output_dimensions, channels, out_channels))
+        os._exit(0)
@@ -0,0 +1,156 @@
+#
+# tiler_fused_group.py
+#
+# Copyright (C) 2018-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Libraries
+import numpy as np
+import os
+from .tiler_dw_pw import pad_to_word, fused_node_fits_L2
+CORES = 8
+# Maximum ratio between the MACs executed by the fused group, halo rows
+# included, and the MACs of the layers executed one by one.
+MAX_RECOMPUTE = 1.25
+
+
+def fused_layer_params(node, op, constants=True):
+    # Geometry and constants of one layer of a fused group. op is 'conv' or 'maxpool'.
+    # The constants of the last layer are the ones of the FusedGroup node itself.
+    layer = {
+        "op": op,
+        "kernel_shape": list(node.kernel_shape),
+        "strides": list(node.strides),
+        "pads": list(node.pads),
+        "input_channels": node.input_channels,
+        "output_channels": node.output_channels,
+        "input_dimensions": list(node.input_dimensions),
+        "output_dimensions": list(node.output_dimensions),
+    }
+    if op == "conv" and constants:
+        for name in node.constant_names:
+            if name not in ["l","k","outshift","outmul","outadd"] and "bias" not in name:
+                layer["weights"] = node.__dict__[name]
+        layer["k"] = node.k
+        layer["l"] = node.l
+        layer["outshift"] = node.outshift
+    return layer
+
+
+def fused_group_bands(layers, band_h):
+    '''
+    Rows computed by every layer for each band of band_h output rows of the last layer.
+    Going backwards from the last layer, each layer produces exactly the rows, halo
+    included, that the next one needs. Each entry is a list with one
+    (input_start, input_rows, p_t, p_b, output_rows) tuple per layer.
+    '''
+    h_out = layers[-1]["output_dimensions"][0]
+    bands = []
+    for start in range(0, h_out, band_h):
+        rows = (start, min(start + band_h, h_out))
+        band = []
+        for layer in reversed(layers):
+            ks, s, p = layer["kernel_shape"], layer["strides"], layer["pads"]
+            h_in = layer["input_dimensions"][0]
+            first = rows[0] * s[0] - p[0]
+            last = (rows[1] - 1) * s[0] - p[0] + ks[0]
+            in_rows = (max(first, 0), min(last, h_in))
+            band.insert(0, (in_rows[0], in_rows[1] - in_rows[0], max(-first, 0), max(last - h_in, 0), rows[1] - rows[0]))
+            rows = in_rows
+        bands.append(band)
+    return bands
+
+
+def fused_group_weights_memory(layers, constant_bits):
+    # Weights, k and lambda of every convolution, each tensor padded to a word as in HW_node.weights_blob
+    memory = 0
+    for layer in layers:
+        if layer["op"] == "conv":
+            memory += pad_to_word(layer["output_channels"] * layer["input_channels"] * np.prod(layer["kernel_shape"]))
+            memory += 2 * layer["output_channels"] * constant_bits // 8
+    return int(memory)
+
+
+def fused_group_l1_memory(layers, band_h, constant_bits, db):
+    # Input and output bands are double buffered, every intermediate band has a
+    # single buffer, all the weights stay in L1 and im2col is shared by the layers.
+    bands = fused_group_bands(layers, band_h)
+    input_band = max(band[0][1] for band in bands) * layers[0]["input_dimensions"][1] * layers[0]["input_channels"]
+    output_band = band_h * layers[-1]["output_dimensions"][1] * layers[-1]["output_channels"]
+    intermediate = 0
+    for i, layer in enumerate(layers[:-1]):
+        intermediate += pad_to_word(max(band[i][4] for band in bands) * layer["output_dimensions"][1] * layer["output_channels"]) + 8
+    im2col = max([2 * CORES * np.prod(layer["kernel_shape"]) * layer["input_channels"] for layer in layers if layer["op"] == "conv"] + [0])
+    return int(db * input_band + intermediate + db * output_band + fused_group_weights_memory(layers, constant_bits) + im2col + 40)
+
+
+def fused_group_recompute(layers, band_h):
+    # Ratio between the output rows computed with halos and the rows of the layers executed one by one
+    bands = fused_group_bands(layers, band_h)
+    computed, needed = 0, 0
+    for i, layer in enumerate(layers):
+        macs_per_row = layer["output_dimensions"][1] * layer["output_channels"] * np.prod(layer["kernel_shape"]) * (layer["input_channels"] if layer["op"] == "conv" else 1)
+        computed += sum(band[i][4] for band in bands) * macs_per_row
+        needed += layer["output_dimensions"][0] * macs_per_row
+    return computed / needed
+
+
+def fused_group_band(layers, L1_memory, constant_bits, db):
+    # Tallest band of output rows of the last layer fitting L1; the whole layer is tried first in single buffering
+    h_out = layers[-1]["output_dimensions"][0]
+    if fused_group_l1_memory(layers, h_out, constant_bits, 1) <= L1_memory:
+        return h_out
+    for band_h in range(h_out - 1, 0, -1):
+        if fused_group_l1_memory(layers, band_h, constant_bits, db) <= L1_memory:
+            return band_h
+    return 0
+
+
+class Tiler_Fused_Group_PULP():
+    # Class to generate the Tiling of a group of fused layers.
+    # The geometry of all the layers is stored in the fused_chain attribute of the node,
+    # see Pattern_rewriter_PULP.FusedGroup_pattern_rewriter.
+    def __init__(self,tiler):
+        self.__dict__ = tiler.__dict__
+
+    def get_tiling(self, level):
+        if level == 3:
+            return self.get_tiling_fused_group_L3()
+        if level == 2:
+            return self.get_tiling_fused_group_L2()
+        print("Error: Either you should be in L3-L2 tiling or L2-L1 tiling")
+        os._exit(0)
+
+    def get_tiling_fused_group_L3(self):
+        # As for the fused depthwise + pointwise layer, the group is split back in its layers
+        # by onnx_manager_PULP.tiling when it can't be kept in L2.
+        if fused_node_fits_L2(self.HW_node, self.previous_HW_node, self.code_reserved_space):
+            return ([self.HW_node.output_channels, self.HW_node.input_channels], [self.HW_node.input_channels, self.HW_node.input_dimensions[0], self.HW_node.input_dimensions[1]], [self.HW_node.output_channels, self.HW_node.output_dimensions[0], self.HW_node.output_dimensions[1]])
+        print("  FusedGroup ERROR: layer {} must be tiled from L3 and should have been split. Exiting...".format(self.HW_node.name))
+        os._exit(0)
+
+    def get_tiling_fused_group_L2(self):
+        '''
+        Function To make the tile from L2 to L1: the tile is a band of output rows of the
+        last layer, the input tile is the tallest input band needed by the first layer.
+        '''
+        L1_memory = self.HW_node.HW_description["memory"]["L1"]["dimension"] - self.HW_node.HW_description["HW specific parameters"]["accelerator core0 stack"] - 7 * self.HW_node.HW_description["HW specific parameters"]["accelerator core1-7 stack"]
+        layers = self.HW_node.fused_chain
+        band_h = fused_group_band(layers, L1_memory, self.HW_node.constant_bits, self.double_buffering)
+        if band_h == 0:
+            print("  FusedGroup ERROR: no L2-L1 tiling found of layer {} with {} fused layers. Exiting...".format(self.HW_node.name, len(layers)))
+            os._exit(0)
+        bands = fused_group_bands(layers, band_h)
+        tile_h_in = max(band[0][1] for band in bands)
+        return ([self.HW_node.output_channels, self.HW_node.input_channels], [self.HW_node.input_channels, tile_h_in, self.HW_node.input_dimensions[1]], [self.HW_node.output_channels, band_h, self.HW_node.output_dimensions[1]])
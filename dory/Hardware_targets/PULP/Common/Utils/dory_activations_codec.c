@@ -0,0 +1,101 @@
+/*
+ * dory_activations_codec.c
+ *
+ * Copyright (C) 2019-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dory_activations_codec.h"
+#include "pmsis.h"
+
+#define MIN(a,b) ((a)<(b)?(a):(b))
+
+void dory_activations_encode(const void *src, void *dst, uint32_t *offset, int rows, int row_size) {
+  int core_id = pi_core_id();
+  int chunk = (rows + NUM_CORES - 1) / NUM_CORES;
+  int start = MIN(chunk * core_id, rows);
+  int stop = MIN(start + chunk, rows);
+  int bitmap_size = (row_size + 7) / 8;
+
+  // dst may still be being written to L3
+  pi_cl_team_barrier(0);
+
+  // size of every row, in the offset of the next one
+  for (int r = start; r < stop; r++) {
+    const uint8_t *in = (const uint8_t *) src + r * row_size;
+    int size = bitmap_size;
+    for (int i = 0; i < row_size; i++)
+      size += in[i] != 0;
+    offset[r + 1] = MIN(size, row_size);
+  }
+  pi_cl_team_barrier(0);
+  if (core_id == 0)
+    for (int r = 0; r < rows; r++)
+      offset[r + 1] += offset[r];
+  pi_cl_team_barrier(0);
+
+  for (int r = start; r < stop; r++) {
+    const uint8_t *in = (const uint8_t *) src + r * row_size;
+    uint8_t *out = (uint8_t *) dst + offset[r] - offset[0];
+    if (offset[r + 1] - offset[r] == row_size) {
+      for (int i = 0; i < row_size; i++)
+        out[i] = in[i];
+      continue;
+    }
+    uint8_t *values = out + bitmap_size;
+    for (int i = 0; i < row_size; i += 8) {
+      uint8_t bitmap = 0;
+      for (int k = 0; k < 8 && i + k < row_size; k++) {
+        if (in[i + k] != 0) {
+          bitmap |= 1 << k;
+          *values++ = in[i + k];
+        }
+      }
+      out[i / 8] = bitmap;
+    }
+  }
+
+  // the rows can be written to L3
+  pi_cl_team_barrier(0);
+}
+
+void dory_activations_decode(const void *src, void *dst, const uint32_t *offset, int rows, int row_size) {
+  int core_id = pi_core_id();
+  int chunk = (rows + NUM_CORES - 1) / NUM_CORES;
+  int start = MIN(chunk * core_id, rows);
+  int stop = MIN(start + chunk, rows);
+  int bitmap_size = (row_size + 7) / 8;
+
+  // core 0 may still be waiting for the rows
+  pi_cl_team_barrier(0);
+
+  for (int r = start; r < stop; r++) {
+    const uint8_t *in = (const uint8_t *) src + offset[r] - offset[0];
+    uint8_t *out = (uint8_t *) dst + r * row_size;
+    if (offset[r + 1] - offset[r] == row_size) {
+      for (int i = 0; i < row_size; i++)
+        out[i] = in[i];
+      continue;
+    }
+    const uint8_t *values = in + bitmap_size;
+    for (int i = 0; i < row_size; i += 8) {
+      uint8_t bitmap = in[i / 8];
+      for (int k = 0; k < 8 && i + k < row_size; k++)
+        out[i + k] = (bitmap >> k) & 1 ? *values++ : 0;
+    }
+  }
+
+  // the rows are expanded and src can be overwritten
+  pi_cl_team_barrier(0);
+}
@@ -0,0 +1,49 @@
+/*
+ * dory_activations_codec.h
+ *
+ * Copyright (C) 2019-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Compressed activations
+ *
+ *  The outputs selected by activations_compression_plan are stored in L3 as
+ *  a table of rows + 1 offsets, then the rows one after the other. A row is a
+ *  bitmap of its non-zero bytes, least significant bit first, followed by
+ *  those bytes, or the row as it is when the bitmap would not be shorter: a
+ *  row is stored as it is if and only if its size is row_size. Offsets are
+ *  in bytes from the end of the table, so that any band of rows is read with
+ *  a single transfer.
+ */
+
+#ifndef _DORY_ACTIVATIONS_CODEC_H
+#define _DORY_ACTIVATIONS_CODEC_H
+#include <stdint.h>
+
+/*
+ * Compresses rows of row_size bytes from src to dst, where row i is stored at
+ * offset[i] - offset[0], and sets offset[1], ..., offset[rows]. Called by all
+ * the cores, each compressing a share of the rows, once dst can be
+ * overwritten.
+ */
+void dory_activations_encode(const void *src, void *dst, uint32_t *offset, int rows, int row_size);
+
+/*
+ * Expands the rows read from offset[0] in src to rows of row_size bytes in
+ * dst. Called by all the cores, each expanding a share of the rows, once
+ * core 0 waited for src to be read.
+ */
+void dory_activations_decode(const void *src, void *dst, const uint32_t *offset, int rows, int row_size);
+
+#endif
@@ -1,4 +1,5 @@
 #include "dory_dma.h"
+#include "dory_trace.h"
 
 #include "pmsis.h"
 
@@ -27,6 +28,60 @@
 
 #define MIN(a,b) ((a)<(b)?(a):(b))
 
+#ifdef DORY_DMA_QUEUE_DEPTH
+#ifdef SINGLE_CORE_DMA
+#define DORY_DMA_CORE_QUEUE_DEPTH (DORY_DMA_QUEUE_DEPTH)
+#else
+// the copies split between the cores give each one a share of the queue
+#define DORY_DMA_CORE_QUEUE_DEPTH (DORY_DMA_QUEUE_DEPTH / NUM_CORES > 0 ? DORY_DMA_QUEUE_DEPTH / NUM_CORES : 1)
+#endif
+
+// commands pushed by each core since it last waited for its transfers,
+// and the transfer ids they belong to
+static int dory_dma_in_flight[NUM_CORES];
+static unsigned int dory_dma_pending_tids[NUM_CORES];
+
+// The commands in flight can belong to other transfers than the one being pushed
+// (e.g. the output of the previous tile), so all of them are waited for.
+static void dory_dma_wait_pending(int core_id) {
+  DORY_TRACE(DORY_TRACE_DMA_WAIT_START, 0);
+  for (int tid = 0; dory_dma_pending_tids[core_id] >> tid; tid++)
+    if (dory_dma_pending_tids[core_id] & (1 << tid))
+      mchan_transfer_wait(tid);
+  DORY_TRACE(DORY_TRACE_DMA_WAIT_END, 0);
+  dory_dma_in_flight[core_id] = 0;
+  dory_dma_pending_tids[core_id] = 0;
+}
+
+// Called before every command: blocks only when the part of the queue the core can use is full.
+static void dory_dma_reserve(DMA_copy *copy, int depth) {
+  int core_id = pi_core_id();
+  if (dory_dma_in_flight[core_id] >= depth)
+    dory_dma_wait_pending(core_id);
+  dory_dma_in_flight[core_id]++;
+  dory_dma_pending_tids[core_id] |= 1 << copy->tid;
+}
+
+#ifndef SINGLE_CORE_DMA
+// Core 0 pushes the 1D and 2D copies alone, with the whole queue: before all the cores
+// push their share of a copy, it leaves at most its own share in flight.
+static void dory_dma_share_queue() {
+  if (pi_core_id() == 0 && dory_dma_in_flight[0] > DORY_DMA_CORE_QUEUE_DEPTH)
+    dory_dma_wait_pending(0);
+  pi_cl_team_barrier(0);
+}
+
+// Core 0 then counts the shares of the other cores as its own: the transfer ids are
+// common to all the cores, so its waits also retire their commands.
+static void dory_dma_unshare_queue(DMA_copy *copy) {
+  if (pi_core_id() == 0) {
+    dory_dma_in_flight[0] += (NUM_CORES - 1) * DORY_DMA_CORE_QUEUE_DEPTH;
+    dory_dma_pending_tids[0] |= 1 << copy->tid;
+  }
+}
+#endif
+#endif
+
 void dory_dma_memcpy_hwc_to_chw(DMA_copy *copy){
 #ifdef SINGLE_CORE_DMA
   if (pi_core_id() == 0) {
@@ -47,6 +102,12 @@ void dory_dma_memcpy_hwc_to_chw(DMA_copy *copy){
   void * loc = copy->loc + copy->number_of_1d_copies*copy->number_of_2d_copies*start_pixel;
   void * ext = copy->ext + start_pixel;
   const int size_2d = copy->number_of_1d_copies * copy->number_of_2d_copies;
+#if defined(DORY_DMA_QUEUE_DEPTH) && !defined(SINGLE_CORE_DMA)
+  dory_dma_share_queue();
+#endif
+  // only the cores with a share of the channels issue commands
+  if (start_pixel < stop_pixel)
+    DORY_TRACE(DORY_TRACE_DMA_ISSUE, copy->dir);
 
   for (int i=start_pixel; i<stop_pixel; i++) {
     mchan_transfer_t trans = {
@@ -57,32 +118,82 @@ void dory_dma_memcpy_hwc_to_chw(DMA_copy *copy){
       .ext_size_1d = 1, // one byte at a time...
       .ext_stride_1d = copy->stride_1d
     };
+#ifdef DORY_DMA_QUEUE_DEPTH
+    dory_dma_reserve(copy, DORY_DMA_CORE_QUEUE_DEPTH);
+#endif
     mchan_transfer_push_2d(trans);
-#ifdef ALWAYS_BLOCK_DMA_TRANSFERS // needed on GAP8 board
+#if defined(ALWAYS_BLOCK_DMA_TRANSFERS) && !defined(DORY_DMA_QUEUE_DEPTH) // needed on GAP8 board
     dory_dma_barrier(copy);
 #endif
     ext += 1; // next channel
     loc += copy->number_of_1d_copies * copy->number_of_2d_copies;
   }
+#if defined(DORY_DMA_QUEUE_DEPTH) && !defined(SINGLE_CORE_DMA)
+  dory_dma_unshare_queue(copy);
+#endif
 #ifdef SINGLE_CORE_DMA
   }
 #endif
 }
 
+typedef uint8_t dory_v4u __attribute__((vector_size (4)));
+
+void dory_hwc_to_chw(const void *src, void *dst, int pixels, int channels) {
+  // the pixels are divided between the cores, 4 at a time for the 4x4 blocks
+  int core_id = pi_core_id();
+  int chunk = ((pixels + NUM_CORES - 1) / NUM_CORES + 3) & ~3;
+  int start = MIN(chunk * core_id, pixels);
+  int stop = MIN(start + chunk, pixels);
+  const uint8_t *in = (const uint8_t *) src;
+  uint8_t *out = (uint8_t *) dst;
+  int p = start;
+
+  if ((((uintptr_t) src | (uintptr_t) dst | pixels | channels) & 3) == 0) {
+    // 4 channels of 4 pixels: interleave the pixels two by two, then the pairs
+    for (; p + 4 <= stop; p += 4) {
+      for (int c = 0; c < channels; c += 4) {
+        dory_v4u a = *(const dory_v4u *) (in + p * channels + c);
+        dory_v4u b = *(const dory_v4u *) (in + (p + 1) * channels + c);
+        dory_v4u d = *(const dory_v4u *) (in + (p + 2) * channels + c);
+        dory_v4u e = *(const dory_v4u *) (in + (p + 3) * channels + c);
+        dory_v4u ab_lo = __builtin_shuffle(a, b, (dory_v4u) {0, 4, 1, 5});
+        dory_v4u ab_hi = __builtin_shuffle(a, b, (dory_v4u) {2, 6, 3, 7});
+        dory_v4u de_lo = __builtin_shuffle(d, e, (dory_v4u) {0, 4, 1, 5});
+        dory_v4u de_hi = __builtin_shuffle(d, e, (dory_v4u) {2, 6, 3, 7});
+        *(dory_v4u *) (out + c * pixels + p) = __builtin_shuffle(ab_lo, de_lo, (dory_v4u) {0, 1, 4, 5});
+        *(dory_v4u *) (out + (c + 1) * pixels + p) = __builtin_shuffle(ab_lo, de_lo, (dory_v4u) {2, 3, 6, 7});
+        *(dory_v4u *) (out + (c + 2) * pixels + p) = __builtin_shuffle(ab_hi, de_hi, (dory_v4u) {0, 1, 4, 5});
+        *(dory_v4u *) (out + (c + 3) * pixels + p) = __builtin_shuffle(ab_hi, de_hi, (dory_v4u) {2, 3, 6, 7});
+      }
+    }
+  }
+  for (; p < stop; p++)
+    for (int c = 0; c < channels; c++)
+      out[c * pixels + p] = in[p * channels + c];
+
+  // the tile is transposed and can be executed
+  pi_cl_team_barrier(0);
+}
+
 void dory_dma_memcpy_1d_async(DMA_copy *copy) {
   if (pi_core_id() == 0) {
+    DORY_TRACE(DORY_TRACE_DMA_ISSUE, copy->dir);
     mchan_transfer_t trans = {
       .cmd = copy->length_1d_copy * copy->number_of_1d_copies * copy->number_of_2d_copies | (copy->dir << MCHAN_CMD_SHIFT_DIRECTION) | MCHAN_FLAGS_1D,
       .size = copy->length_1d_copy * copy->number_of_1d_copies * copy->number_of_2d_copies,
       .ext = copy->ext,
       .loc = copy->loc
     };
+#ifdef DORY_DMA_QUEUE_DEPTH
+    dory_dma_reserve(copy, DORY_DMA_QUEUE_DEPTH);
+#endif
     mchan_transfer_push_1d(trans);
   }
 }
 
 void dory_dma_memcpy_2d_async(DMA_copy *copy) {
   if (pi_core_id() == 0) {
+    DORY_TRACE(DORY_TRACE_DMA_ISSUE, copy->dir);
     const int size_2d = copy->number_of_1d_copies * copy->length_1d_copy * copy->number_of_2d_copies;
     const int stride = (copy->number_of_2d_copies == 1) ? copy->stride_1d : copy->stride_2d;
     const int size_1d = (copy->number_of_2d_copies == 1) ? copy->length_1d_copy : copy->length_1d_copy * copy->number_of_1d_copies;
@@ -95,6 +206,9 @@ void dory_dma_memcpy_2d_async(DMA_copy *copy) {
       .ext_size_1d = size_1d,
       .ext_stride_1d = stride
     };
+#ifdef DORY_DMA_QUEUE_DEPTH
+    dory_dma_reserve(copy, DORY_DMA_QUEUE_DEPTH);
+#endif
     mchan_transfer_push_2d(trans);
   }
 }
@@ -117,6 +231,11 @@ void dory_dma_memcpy_3d_async(DMA_copy *copy) {
   void *ext = copy->ext + copy->stride_2d*start_pixel;
   void *loc = copy->loc + copy->length_1d_copy*copy->number_of_1d_copies*start_pixel;
   const int size_2d = copy->number_of_1d_copies * copy->length_1d_copy;
+#if defined(DORY_DMA_QUEUE_DEPTH) && !defined(SINGLE_CORE_DMA)
+  dory_dma_share_queue();
+#endif
+  if (start_pixel < stop_pixel)
+    DORY_TRACE(DORY_TRACE_DMA_ISSUE, copy->dir);
   for (int i = start_pixel; i < stop_pixel; i++) {
     mchan_transfer_t trans = {
       .cmd = size_2d | copy->dir << MCHAN_CMD_SHIFT_DIRECTION | MCHAN_FLAGS_2D,
@@ -126,13 +245,19 @@ void dory_dma_memcpy_3d_async(DMA_copy *copy) {
       .ext_size_1d = copy->length_1d_copy,
       .ext_stride_1d = copy->stride_1d
     };
+#ifdef DORY_DMA_QUEUE_DEPTH
+    dory_dma_reserve(copy, DORY_DMA_CORE_QUEUE_DEPTH);
+#endif
     mchan_transfer_push_2d(trans);
-#ifdef ALWAYS_BLOCK_DMA_TRANSFERS // needed on GAP8 board
+#if defined(ALWAYS_BLOCK_DMA_TRANSFERS) && !defined(DORY_DMA_QUEUE_DEPTH) // needed on GAP8 board
     dory_dma_barrier(copy);
 #endif
     loc += size_2d;
     ext += copy->stride_2d;
   }
+#if defined(DORY_DMA_QUEUE_DEPTH) && !defined(SINGLE_CORE_DMA)
+  dory_dma_unshare_queue(copy);
+#endif
 #ifdef SINGLE_CORE_DMA
   }
 #endif
@@ -156,6 +281,7 @@ void dory_dma_free(DMA_copy *copy) {
 }
 
 void dory_dma_barrier(DMA_copy *copy) {
+  DORY_TRACE(DORY_TRACE_DMA_WAIT_START, 0);
 #ifdef SINGLE_CORE_DMA
   // if DMA is only used by a single core (only 1 ctrl interface), other cores must not access its register file. Instead, they should all wait for core 0 to confirm the transfer is over.
   if (pi_core_id() == 0)
@@ -164,6 +290,14 @@ void dory_dma_barrier(DMA_copy *copy) {
 #else
   mchan_transfer_wait(copy->tid);
 #endif
+#ifdef DORY_DMA_QUEUE_DEPTH
+  // the commands of the other transfers may still be in flight: the count is
+  // only cleared once none is pending
+  dory_dma_pending_tids[pi_core_id()] &= ~(1 << copy->tid);
+  if (dory_dma_pending_tids[pi_core_id()] == 0)
+    dory_dma_in_flight[pi_core_id()] = 0;
+#endif
+  DORY_TRACE(DORY_TRACE_DMA_WAIT_END, 0);
 }
 
 int dory_dma_allocate() {
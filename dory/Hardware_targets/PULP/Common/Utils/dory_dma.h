@@ -36,16 +36,34 @@ typedef struct
 
 void dory_dma_memcpy_hwc_to_chw(DMA_copy *copy);
 
+/*
+ * Transposes a tile of 8 bits activations from HWC in src to CHW in dst, on
+ * the cluster instead of the DMA: called by all the cores once src is
+ * transferred contiguously in L1.
+ */
+void dory_hwc_to_chw(const void *src, void *dst, int pixels, int channels);
+
 void dory_dma_memcpy_1d_async(DMA_copy *copy);
 
 void dory_dma_memcpy_2d_async(DMA_copy *copy);
 
 void dory_dma_memcpy_3d_async(DMA_copy *copy);
 
+/*
+ * Submits a copy to the batch of transfers of copy->tid. With
+ * DORY_DMA_QUEUE_DEPTH, the mchan commands in flight are counted and a core
+ * only waits for its batch when its part of the command queue is full,
+ * instead of after every command as with ALWAYS_BLOCK_DMA_TRANSFERS: core 0
+ * uses the whole queue for the copies it pushes alone, each core a share of
+ * it for the copies split between the cores.
+ */
 void dory_dma_memcpy_async(DMA_copy *copy);
 
 void dory_dma_free(DMA_copy *copy);
 
+/*
+ * Waits for the batch of transfers of copy->tid.
+ */
 void dory_dma_barrier(DMA_copy *copy);
 
 int dory_dma_allocate();
@@ -0,0 +1,115 @@
+/*
+ * dory_trace.c
+ *
+ * Copyright (C) 2019-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dory_trace.h"
+#include "pmsis.h"
+
+#ifdef TRACE
+#ifdef TRACE_FILE
+#include "bsp/fs/hostfs.h"
+#endif
+
+// One ring buffer per core, so that the cores never write the same counter
+static dory_trace_event_t trace_events[NUM_CORES][TRACE_EVENTS];
+static uint32_t trace_count[NUM_CORES];
+static uint32_t trace_run = 0;
+
+/* Forked on all the cores at the beginning of every network run */
+void dory_trace_start(void *args) {
+  pi_cl_team_barrier(0);
+  pi_perf_conf(1 << PI_PERF_CYCLES);
+  pi_perf_reset();
+  pi_perf_start();
+  dory_trace_record(DORY_TRACE_RUN_START, trace_run);
+  pi_cl_team_barrier(0);
+  if (pi_core_id() == 0)
+    trace_run++;
+}
+
+void dory_trace_record(int type, int arg) {
+  int core = pi_core_id();
+  dory_trace_event_t *event = &trace_events[core][trace_count[core] & (TRACE_EVENTS - 1)];
+  event->cycles = pi_perf_read(PI_PERF_CYCLES);
+  event->type = type;
+  event->core = core;
+  event->arg = arg;
+  trace_count[core]++;
+}
+
+#ifdef TRACE_FILE
+static pi_fs_file_t *trace_file;
+
+static void trace_write(const void *data, int size) {
+  pi_fs_write(trace_file, (void *) data, size);
+}
+#else
+static void trace_write(const void *data, int size) {
+  const uint32_t *words = (const uint32_t *) data;
+  for (int i = 0; i < size / 4; i++)
+    printf("%s%08x%s", i % 8 == 0 ? "TRACE " : "", words[i], i % 8 == 7 || i == size / 4 - 1 ? "\n" : " ");
+}
+#endif
+
+/*
+ * Writes a header (magic, version, cores, ring size and number of events of
+ * every core) followed by the events of every core, oldest first, and empties
+ * the buffers. Called by the fabric controller once the cluster is idle.
+ */
+void dory_trace_dump() {
+  uint32_t header[4 + NUM_CORES] = {DORY_TRACE_MAGIC, DORY_TRACE_VERSION, NUM_CORES, TRACE_EVENTS};
+  for (int core = 0; core < NUM_CORES; core++)
+    header[4 + core] = trace_count[core] < TRACE_EVENTS ? trace_count[core] : TRACE_EVENTS;
+
+#ifdef TRACE_FILE
+  struct pi_hostfs_conf conf;
+  struct pi_device fs;
+  pi_hostfs_conf_init(&conf);
+  pi_open_from_conf(&fs, &conf);
+  if (pi_fs_mount(&fs)) {
+    printf("ERROR: Cannot mount the host filesystem to write the trace.\n");
+    return;
+  }
+  trace_file = pi_fs_open(&fs, TRACE_FILE, PI_FS_FLAGS_WRITE);
+  if (trace_file == NULL) {
+    printf("ERROR: Cannot open file %s to write the trace.\n", TRACE_FILE);
+    pi_fs_unmount(&fs);
+    return;
+  }
+#else
+  printf("TRACE BEGIN\n");
+#endif
+
+  trace_write(header, sizeof(header));
+  for (int core = 0; core < NUM_CORES; core++) {
+    // once the ring wrapped, the oldest event is the next one to be overwritten
+    int oldest = trace_count[core] < TRACE_EVENTS ? 0 : trace_count[core] & (TRACE_EVENTS - 1);
+    trace_write(&trace_events[core][oldest], (header[4 + core] - oldest) * sizeof(dory_trace_event_t));
+    if (oldest > 0)
+      trace_write(&trace_events[core][0], oldest * sizeof(dory_trace_event_t));
+    trace_count[core] = 0;
+  }
+
+#ifdef TRACE_FILE
+  pi_fs_close(trace_file);
+  pi_fs_unmount(&fs);
+  printf("Trace written to %s\n", TRACE_FILE);
+#else
+  printf("TRACE END\n");
+#endif
+}
+#endif
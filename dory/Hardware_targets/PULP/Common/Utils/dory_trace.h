@@ -0,0 +1,86 @@
+/*
+ * dory_trace.h
+ *
+ * Copyright (C) 2019-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Event trace
+ *
+ *  With -DTRACE, every cluster core records timestamped events in its own
+ *  ring buffer of TRACE_EVENTS entries in L2, keeping the most recent ones.
+ *  The buffers take NUM_CORES * TRACE_EVENTS * 8 bytes of L2 out of what the
+ *  network can use: the default of 128 events per core (8 kB with 8 cores)
+ *  keeps the last tiles of a run, raise it with -DTRACE_EVENTS=<power of 2>
+ *  to trace more.
+ *  Timestamps are cluster cycles from the start of the network run: the cycle
+ *  counters of all the cores are started together by dory_trace_start, so
+ *  TRACE can't be used together with PERF_LAYER or PERF_FINAL.
+ *  dory_trace_dump writes the buffers in binary to TRACE_FILE on the host
+ *  filesystem, or as hex lines on stdout when TRACE_FILE is not defined;
+ *  scripts/trace2json.py converts both to a Chrome trace.
+ *  Without -DTRACE, DORY_TRACE expands to nothing.
+ */
+
+#ifndef _DORY_TRACE_H
+#define _DORY_TRACE_H
+#include <stdint.h>
+
+// Argument of each event in brackets
+enum {
+  DORY_TRACE_RUN_START,    // (network run)
+  DORY_TRACE_LAYER_START,  // (layer)
+  DORY_TRACE_LAYER_END,    // (layer)
+  DORY_TRACE_DMA_ISSUE,    // (direction: 0 L1->L2, 1 L2->L1)
+  DORY_TRACE_DMA_WAIT_START,
+  DORY_TRACE_DMA_WAIT_END,
+  DORY_TRACE_KERNEL_START, // (tile)
+  DORY_TRACE_KERNEL_END,   // (tile)
+  DORY_TRACE_L3_READ_START,  // (size in 16 bytes blocks)
+  DORY_TRACE_L3_READ_END,
+  DORY_TRACE_L3_WRITE_START, // (size in 16 bytes blocks)
+  DORY_TRACE_L3_WRITE_END
+};
+
+typedef struct {
+  uint32_t cycles;
+  uint8_t type;
+  uint8_t core;
+  uint16_t arg;
+} dory_trace_event_t;
+
+#define DORY_TRACE_MAGIC 0x43525444  // "DTRC"
+#define DORY_TRACE_VERSION 1
+
+#ifdef TRACE
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 128
+#endif
+#if (TRACE_EVENTS & (TRACE_EVENTS - 1)) != 0
+#error "TRACE_EVENTS must be a power of 2"
+#endif
+#if defined PERF_LAYER || defined PERF_FINAL
+#error "TRACE uses the cycle counters of PERF_LAYER and PERF_FINAL"
+#endif
+
+void dory_trace_start(void *args);
+void dory_trace_record(int type, int arg);
+void dory_trace_dump();
+#define DORY_TRACE(type, arg) dory_trace_record(type, arg)
+#define DORY_TRACE_SIZE(size) ((size) >> 4 > 0xffff ? 0xffff : (size) >> 4)
+#else
+#define DORY_TRACE(type, arg)
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * dory_weights_decoder.c
+ *
+ * Copyright (C) 2019-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dory_weights_decoder.h"
+#include "pmsis.h"
+
+#define MIN(a,b) ((a)<(b)?(a):(b))
+
+void dory_weights_decode(const void *src, void *dst, int channels, int channel_size, int tail_size) {
+  const uint32_t *header = (const uint32_t *) src;
+  int core_id = pi_core_id();
+  int chunk = (channels + NUM_CORES - 1) / NUM_CORES;
+  int start = MIN(chunk * core_id, channels);
+  int stop = MIN(start + chunk, channels);
+
+  // core 0 may still be waiting for the tile
+  pi_cl_team_barrier(0);
+
+  for (int c = start; c < stop; c++) {
+    const uint32_t *in = (const uint32_t *) ((const uint8_t *) src + (header[c] >> 4));
+    int8_t *out = (int8_t *) dst + c * channel_size;
+    int bits = header[c] & 0xf;
+    // bits of the current word not read yet, in the low ones of buffer
+    uint32_t buffer = 0;
+    int available = 0;
+    for (int i = 0; i < channel_size; i++) {
+      uint32_t value;
+      if (available < bits) {
+        uint32_t word = *in++;
+        value = buffer | (word << available);
+        buffer = word >> (bits - available);
+        available += 32 - bits;
+      } else {
+        value = buffer;
+        buffer >>= bits;
+        available -= bits;
+      }
+      out[i] = ((int32_t) (value << (32 - bits))) >> (32 - bits);
+    }
+  }
+
+  // bias, k and lambda
+  const uint8_t *tail_in = (const uint8_t *) src + header[channels];
+  uint8_t *tail_out = (uint8_t *) dst + channels * channel_size;
+  chunk = (tail_size + NUM_CORES - 1) / NUM_CORES;
+  start = MIN(chunk * core_id, tail_size);
+  stop = MIN(start + chunk, tail_size);
+  for (int i = start; i < stop; i++)
+    tail_out[i] = tail_in[i];
+
+  // the tile is expanded and src can be overwritten
+  pi_cl_team_barrier(0);
+}
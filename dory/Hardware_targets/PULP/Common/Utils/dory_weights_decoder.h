@@ -0,0 +1,41 @@
+/*
+ * dory_weights_decoder.h
+ *
+ * Copyright (C) 2019-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Compressed weights
+ *
+ *  The weights tiles of the layers selected by weights_compression_plan are
+ *  stored compressed in L3 (see HW_node.compressed_weights_tiles): the 8 bits
+ *  weights of every output channel use the smallest width holding them all,
+ *  packed from the least significant bit in 32 bits words. A tile starts with
+ *  one word per channel, (offset of its stream << 4) | width, followed by the
+ *  offset of the bias, k and lambda, which are stored as they are.
+ */
+
+#ifndef _DORY_WEIGHTS_DECODER_H
+#define _DORY_WEIGHTS_DECODER_H
+#include <stdint.h>
+
+/*
+ * Expands the compressed tile src, 4 bytes aligned, in dst: the weights of
+ * the channels one after the other, followed by tail_size bytes of bias, k
+ * and lambda. Called by all the cores, each expanding a share of the
+ * channels, once core 0 waited for src to be read.
+ */
+void dory_weights_decode(const void *src, void *dst, int channels, int channel_size, int tail_size);
+
+#endif
@@ -1,4 +1,5 @@
 #include "mem.h"
+#include "dory_trace.h"
 #include "pmsis.h"
 #include "bsp/bsp.h"
 #include "bsp/fs.h"
@@ -31,8 +32,10 @@ typedef struct pi_default_ram_conf ram_conf_t;
 #define ram_conf_init(conf) pi_default_ram_conf_init(conf)
 #endif
 
-#define BUFFER_SIZE 128
-static uint8_t buffer[BUFFER_SIZE];
+// Size of each of the two L2 staging buffers used by load_file_to_ram.
+#ifndef LOAD_BUFFER_SIZE
+#define LOAD_BUFFER_SIZE 4096
+#endif
 
 static struct pi_device flash;
 static flash_conf_t flash_conf;
@@ -107,16 +110,35 @@ void cl_ram_free(void *ptr, size_t size) {
 
 void cl_ram_read(void *dest, void *src, const size_t size) {
   pi_cl_ram_req_t req;
+  DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(size));
   pi_cl_ram_read(&ram, src, dest, size, &req);
   pi_cl_ram_read_wait(&req);
+  DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
+}
+
+void cl_ram_read_async(void *dest, void *src, const size_t size, pi_cl_ram_req_t *req) {
+  DORY_TRACE(DORY_TRACE_L3_READ_START, DORY_TRACE_SIZE(size));
+  pi_cl_ram_read(&ram, src, dest, size, req);
+}
+
+void cl_ram_read_wait(pi_cl_ram_req_t *req) {
+  pi_cl_ram_read_wait(req);
+  DORY_TRACE(DORY_TRACE_L3_READ_END, 0);
 }
 
 void cl_ram_write(void *dest, void *src, const size_t size) {
   pi_cl_ram_req_t req;
+  DORY_TRACE(DORY_TRACE_L3_WRITE_START, DORY_TRACE_SIZE(size));
   pi_cl_ram_write(&ram, dest, src, size, &req);
   pi_cl_ram_write_wait(&req);
+  DORY_TRACE(DORY_TRACE_L3_WRITE_END, 0);
 }
 
+/*
+ * Streams a file from the flash filesystem into ram through two L2 staging
+ * buffers: while one block is being written to ram, the next one is read
+ * from flash into the other buffer.
+ */
 size_t load_file_to_ram(const void *dest, const char *filename) {
   pi_fs_file_t *fd = pi_fs_open(&fs, filename, 0);
   if (fd == NULL) {
@@ -126,12 +148,43 @@ size_t load_file_to_ram(const void *dest, const char *filename) {
 
   const size_t size = fd->size;
 
+  uint8_t *buffer[2];
+  buffer[0] = pi_l2_malloc(2 * LOAD_BUFFER_SIZE);
+  if (buffer[0] == NULL) {
+    printf("ERROR: Cannot allocate the load buffers! Exiting...");
+    pmsis_exit(-5);
+  }
+  buffer[1] = buffer[0] + LOAD_BUFFER_SIZE;
+
+  pi_task_t task_read, task_write;
+  int db = 0;
+
+  size_t read_bytes = size < LOAD_BUFFER_SIZE ? size : LOAD_BUFFER_SIZE;
+  if (pi_fs_read(fd, buffer[db], read_bytes) != read_bytes) {
+    printf("ERROR: Cannot read file %s! Exiting...", filename);
+    pmsis_exit(-4);
+  }
+
   size_t offset = 0;
-  do {
-    const size_t read_bytes = pi_fs_read(fd, buffer, BUFFER_SIZE);
-    ram_write(dest + offset, buffer, read_bytes);
-    offset += read_bytes;
-  } while (offset < size);
+  while (offset < size) {
+    const size_t write_bytes = read_bytes;
+    const size_t next_offset = offset + write_bytes;
+    read_bytes = size - next_offset < LOAD_BUFFER_SIZE ? size - next_offset : LOAD_BUFFER_SIZE;
+
+    if (read_bytes > 0)
+      pi_fs_read_async(fd, buffer[!db], read_bytes, pi_task_block(&task_read));
+    pi_ram_write_async(&ram, (uint32_t)(dest + offset), buffer[db], write_bytes, pi_task_block(&task_write));
+
+    pi_task_wait_on(&task_write);
+    if (read_bytes > 0)
+      pi_task_wait_on(&task_read);
+
+    offset = next_offset;
+    db = !db;
+  }
+
+  pi_l2_free(buffer[0], 2 * LOAD_BUFFER_SIZE);
+  pi_fs_close(fd);
 
   return offset;
 }
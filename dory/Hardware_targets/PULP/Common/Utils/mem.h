@@ -2,6 +2,7 @@
 #define __MEM_H__
 
 #include<stddef.h>
+#include "bsp/ram.h"
 
 void  mem_init();
 struct pi_device *get_ram_ptr();
@@ -13,6 +14,8 @@ void *cl_ram_malloc(size_t size);
 void  cl_ram_free(void *ptr, size_t size);
 void  cl_ram_read(void *dest, void *src, size_t size);
 void  cl_ram_write(void *dest, void *src, size_t size);
+void  cl_ram_read_async(void *dest, void *src, size_t size, pi_cl_ram_req_t *req);
+void  cl_ram_read_wait(pi_cl_ram_req_t *req);
 size_t load_file_to_ram(const void *dest, const char *filename);
 
 #endif  // __MEM_H__
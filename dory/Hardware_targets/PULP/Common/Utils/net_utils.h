@@ -15,8 +15,16 @@ typedef struct {
   unsigned int ram;
   unsigned int out_mult;
   unsigned int out_shift;
+  unsigned int input_stream;
 } layer_args_t;
 
+// Producer of the network input while the first layer is running: wait_rows is
+// called by all the cores and returns once the first rows of the input are in L2.
+typedef struct {
+  void (*wait_rows)(void *arg, int rows);
+  void *arg;
+} input_stream_t;
+
 void print_perf(const char *name, const int cycles, const int macs);
 void checksum(const char *name, const uint8_t *d, size_t size, uint32_t sum_true);
 #endif
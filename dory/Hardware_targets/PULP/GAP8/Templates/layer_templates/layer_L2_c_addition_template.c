@@ -27,6 +27,7 @@ ${verbose_log}
 #include "dory_get_tile.h"
 #include "dory_dma.h"
 #include "pulp_nn_kernels.h"
+#include "dory_trace.h"
 
 % if ULTRA_VERBOSE:
 #define VERBOSE_PRINT(...) printf(__VA_ARGS__)
@@ -143,6 +144,7 @@ void ${func_name}(
     y_length_nof_byte = (last_nof)   ? ${y_length_nof_byte_last} : ${y_tile_size_nof_byte};
     asm volatile("": : :"memory");
     pi_cl_team_barrier(0);
+    DORY_TRACE(DORY_TRACE_KERNEL_START, iter);
     % if optional_type == '8bit':
     pulp_nn_add(
       x,
@@ -175,6 +177,7 @@ void ${func_name}(
       1
       );
     % endif
+    DORY_TRACE(DORY_TRACE_KERNEL_END, iter);
 
     pi_cl_team_barrier(0);
     // wait for DMA write
@@ -26,6 +26,10 @@
 #include "dory_get_tile.h"
 #include "dory_dma.h"
 #include "pulp_nn_kernels.h"
+#include "dory_trace.h"
+% if stream_input:
+#include "net_utils.h"
+% endif
 
 % if ULTRA_VERBOSE:
 #define VERBOSE_PRINT(...) printf(__VA_ARGS__)
@@ -49,6 +53,10 @@ void ${func_name}(
   unsigned int hyperram =(unsigned int)  real_arg[8];
   unsigned int out_mult_in =(unsigned int)  real_arg[9];
   unsigned int out_shift_in = (unsigned int) real_arg[10];
+% if stream_input:
+  input_stream_t *input_stream = (input_stream_t *) real_arg[11];
+  int x_rows;
+% endif
 
   /////////////////////
   // DMA declaration //
@@ -81,7 +89,7 @@ void ${func_name}(
   DMA_copy_lambda.dir = 1;
   DMA_copy_lambda.tid = dory_dma_channel;
   
-  % if flag_DW == 1:
+  % if flag_DW == 1 and not dw_cluster_transpose:
   DMA_copy_x.hwc_to_chw = 1;
   % else:
   DMA_copy_x.hwc_to_chw = 0;
@@ -122,13 +130,16 @@ void ${func_name}(
   volatile unsigned short  W_tile_size_byte;
   volatile unsigned short W_length_nif_byte;
   volatile ${type} *x, *W, *y, *b;
+  // L1 buffers receiving the tile in transfer: they become x, W, k and lambda
+  // once the tile is executed
+  volatile ${type} *x_load, *W_load;
 % if FLAG_BATCHNORM == 1:
 % if act_dim_bit == 32:
-  volatile int32_t *k;
-  volatile int32_t *lambda;
+  volatile int32_t *k, *k_load;
+  volatile int32_t *lambda, *lambda_load;
 % else:
-  volatile int64_t *k;
-  volatile int64_t *lambda;
+  volatile int64_t *k, *k_load;
+  volatile int64_t *lambda, *lambda_load;
 % endif
 % endif
   volatile int y_tile_size_nof;
@@ -136,6 +147,8 @@ void ${func_name}(
   volatile int y_tile_size_w;
   volatile int y_tile_size_byte;
   volatile int y_length_nof_byte;
+  // double buffering indices: next L1 buffer to be filled (x, W) or written (y)
+  int db_x = 0, db_W = 0, db_y = 0;
   // last-tile flags
   int iter;
   // tile loop indeces
@@ -150,6 +163,11 @@ void ${func_name}(
   volatile ${type} *pwt_buffer;
   pwt_buffer = im2col + ${im2col_dim};
 % endif
+% if dw_cluster_transpose:
+  // HWC input tile in transfer, transposed in x_load by the cluster
+  volatile ${type} *x_hwc = l1_buffer + ${l1_x_hwc_offset};
+  int x_hwc_pixels = 0, x_hwc_channels = 0;
+% endif
 % if FLAG_RELU == 1:
   uint16_t out_mult = out_mult_in;
 % endif
@@ -175,9 +193,11 @@ void ${func_name}(
 % else:
   int total_tiles = ${tile_dim_nof * tile_dim_h * tile_dim_w};
 % endif
-  // tile loop nest
-  for(iter=0; iter < total_tiles; iter++) {
-    // check if last in any dimension
+  // tile loop nest: at iteration iter, tile iter is transferred in L1 while
+  // tile iter-1 is executed and the output of tile iter-2 is written back to L2
+  for(iter=0; iter < total_tiles + 1; iter++) {
+    if (iter < total_tiles) {
+      // check if last in any dimension
       x_tile_size_nif = (_i_nif_load+1 == ${tile_dim_nif}) ? ${x_tile_size_nif_last} : ${x_tile_size_nif};
       x_tile_size_h   = (_i_h_load+1 == ${tile_dim_h})   ? ${x_tile_size_h_last} : ${x_tile_size_h};
       x_tile_size_w   = (_i_w_load+1 == ${tile_dim_w})   ? ${x_tile_size_w_last} : ${x_tile_size_w};
@@ -190,11 +210,6 @@ void ${func_name}(
         pad_offset_h = ${padding_top};
       if(_i_w_load > 0)
         pad_offset_w = ${padding_left};
-      y_tile_size_h   = (_i_h_load+1 == ${tile_dim_h})   ? ${y_tile_size_h_last} : ${y_tile_size_h};
-      y_tile_size_w   = (_i_w_load+1 == ${tile_dim_w})   ? ${y_tile_size_w_last} : ${y_tile_size_w};
-      y_tile_size_nof = (_i_nof_load+1 == ${tile_dim_nof}) ? ${y_tile_size_nof_last} : ${y_tile_size_nof};
-      y_tile_size_byte = y_tile_size_nof*y_tile_size_h*y_tile_size_w*${y_data_size_byte}/8;
-      y_length_nof_byte = (_i_nof_load+1 == ${tile_dim_nof})   ? ${y_length_nof_byte_last} : ${y_tile_size_nof_byte};
       W_tile_size_nof = (_i_nof_load+1 == ${tile_dim_nof}) ? ${W_tile_size_nof_last} : ${W_tile_size_nof};
       W_tile_size_nif = (_i_nif_load+1 == ${tile_dim_nif}) ? ${W_tile_size_nif_last} : ${W_tile_size_nif};
       % if flag_DW == 1:
@@ -206,23 +221,38 @@ void ${func_name}(
       // transfer of next input tile in double buffering
       if (_i_nif_load!=_i_nif_exec || _i_w_load!=_i_w_exec || _i_h_load!=_i_h_exec)
       {
+      % if stream_input:
+        // the input is still being written: wait for the last row of the tile
+        if (input_stream != NULL) {
+          x_rows = _i_h_load*${x_tile_size_h - conv_overlap1} - pad_offset_h + x_tile_size_h;
+          input_stream->wait_rows(input_stream->arg, x_rows < ${x_h} ? x_rows : ${x_h});
+        }
+      % endif
+        x_load = (${type} *) (l1_buffer + ${l1_x_offset} + db_x*${x_tile_size_byte});
         DMA_copy_x.ext = dory_get_tile_3d(l2_x, _i_h_load, _i_w_load, _i_nif_load, ${x_tile_size_h}, ${x_tile_size_w}, ${x_tile_size_nif}, ${x_w}, ${nif*g},  ${conv_overlap1}, ${conv_overlap2},0, pad_offset_h, pad_offset_w, 0, ${x_data_size_byte});
-        DMA_copy_x.loc = (l1_buffer + ${l1_x_offset});
+        % if dw_cluster_transpose:
+        DMA_copy_x.loc = (void *) x_hwc;
+        x_hwc_pixels = x_tile_size_h * x_tile_size_w;
+        x_hwc_channels = x_length_nif_byte;
+        % else:
+        DMA_copy_x.loc = (void *) x_load;
+        % endif
         DMA_copy_x.number_of_2d_copies = x_tile_size_h;
         DMA_copy_x.number_of_1d_copies = x_tile_size_w;
         DMA_copy_x.length_1d_copy = x_length_nif_byte;
         dory_dma_memcpy_async(&DMA_copy_x);
-        dory_dma_barrier(&DMA_copy_x);
+        db_x = !db_x;
       }
       // transfer of next weight tile if changed input or output channels
       if (_i_nif_load!=_i_nif_exec || _i_nof_load!=_i_nof_exec)
       {
+        W_load = (${type} *) (l1_buffer + ${l1_W_offset} + db_W*${W_tile_size_byte});
         % if flag_DW == 0:
         DMA_copy_W.ext = dory_get_tile_3d(l2_W, _i_nof_load, 0, _i_nif_load, ${W_tile_size_nof}, ${fs1}*${fs2}, ${W_tile_size_nif}, ${fs1}*${fs2}, ${nif}, 0,0,0,0,0,0, ${W_data_size_byte});
         % else:
         DMA_copy_W.ext = dory_get_tile_3d(l2_W, _i_nof_load, 0, 0, ${W_tile_size_nof}, ${fs1}*${fs2}, ${W_tile_size_nif}, ${fs1}*${fs2}, ${nif}, 0,0,0,0,0,0, ${W_data_size_byte});
         % endif
-        DMA_copy_W.loc = (l1_buffer + ${l1_W_offset});
+        DMA_copy_W.loc = (void *) W_load;
         % if flag_DW == 0:
         DMA_copy_W.number_of_2d_copies = W_tile_size_nof;
         DMA_copy_W.length_1d_copy = W_length_nif_byte;
@@ -230,148 +260,177 @@ void ${func_name}(
         DMA_copy_W.length_1d_copy = (int) W_tile_size_nof * ${W_data_size_byte} * ${ fs1 * fs2} / 8;
         % endif
         dory_dma_memcpy_async(&DMA_copy_W);
-        dory_dma_barrier(&DMA_copy_W);
         % if FLAG_BATCHNORM == 1:
 
+        % if act_dim_bit == 32:
+        k_load = (int32_t *) (l1_buffer + ${l1_k_offset} + db_W*${k_tile_size_byte_transfer});
+        lambda_load = (int32_t *) (l1_buffer + ${l1_lambda_offset} + db_W*${lambda_tile_size_byte_transfer});
+        % else:
+        k_load = (int64_t *) (l1_buffer + ${l1_k_offset} + db_W*${k_tile_size_byte_transfer});
+        lambda_load = (int64_t *) (l1_buffer + ${l1_lambda_offset} + db_W*${lambda_tile_size_byte_transfer});
+        % endif
+
         DMA_copy_k.ext = (uint32_t) l2_W+${l2_off_k} + ${k_tile_size_byte_transfer}*_i_nof_load;
-        DMA_copy_k.loc = (uint32_t) l1_buffer + ${l1_k_offset};
+        DMA_copy_k.loc = (uint32_t) k_load;
         DMA_copy_k.length_1d_copy = (uint16_t) W_tile_size_nof * ${int(act_dim_bit/8)};
         dory_dma_memcpy_async(&DMA_copy_k);
-        dory_dma_barrier(&DMA_copy_k);
 
         DMA_copy_lambda.ext = (uint32_t) l2_W+${l2_off_lambda} + ${lambda_tile_size_byte_transfer}*_i_nof_load;
-        DMA_copy_lambda.loc = (uint32_t) l1_buffer + ${l1_lambda_offset};
+        DMA_copy_lambda.loc = (uint32_t) lambda_load;
         DMA_copy_lambda.length_1d_copy = (uint16_t) W_tile_size_nof * ${int(act_dim_bit/8)};
         dory_dma_memcpy_async(&DMA_copy_lambda);
-        dory_dma_barrier(&DMA_copy_lambda);
         % endif
+        db_W = !db_W;
       }
-    // creation of the pointers to input, output, weights, lambda and k
-    % if flag_DW == 1:
-    asm volatile("": : :"memory");
-    % endif
-    x = (${type} *) (l1_buffer + ${l1_x_offset});
-    % if FLAG_BATCHNORM == 1:
-    % if act_dim_bit == 32:
-    k = (int32_t *) (l1_buffer + ${l1_k_offset});
-    lambda = (int32_t *) (l1_buffer + ${l1_lambda_offset});
-    % else:
-    k = (int64_t *) (l1_buffer + ${l1_k_offset});
-    lambda = (int64_t *) (l1_buffer + ${l1_lambda_offset});
-    % endif
-    % endif
-    % if has_bias == 1:
-    b = (${type} *) (l1_buffer + ${l1_b_offset} + _i_nof_load*${bias_tile_size_byte});
-    % endif
-    W = (${type} *) (l1_buffer + ${l1_W_offset});
-    y = (${type} *) (l1_buffer + ${l1_y_offset});
-    p_r = 0;
-    p_l = 0;
-    p_t = 0;
-    p_b = 0;
-    if (_i_h_load == 0)
-      p_t = ${padding_top};
-    if (_i_w_load == 0)
-      p_l = ${padding_left};
-    if (_i_h_load == ${tile_dim_h}-1)
-      p_b = ${padding_bottom};
-    if (_i_w_load == ${tile_dim_w}-1)
-      p_r = ${padding_right};
-    pi_cl_team_barrier(0);
-    % if tile_dim_nof*tile_dim_nif*tile_dim_h*tile_dim_w == 1 or flag_DW == 1:
-    asm volatile("": : :"memory");
-    % endif
+    }
+
+    if (iter > 0) {
+      // check if last in any dimension
+      x_tile_size_nif = (_i_nif_exec+1 == ${tile_dim_nif}) ? ${x_tile_size_nif_last} : ${x_tile_size_nif};
+      x_tile_size_h   = (_i_h_exec+1 == ${tile_dim_h})   ? ${x_tile_size_h_last} : ${x_tile_size_h};
+      x_tile_size_w   = (_i_w_exec+1 == ${tile_dim_w})   ? ${x_tile_size_w_last} : ${x_tile_size_w};
+      y_tile_size_h   = (_i_h_exec+1 == ${tile_dim_h})   ? ${y_tile_size_h_last} : ${y_tile_size_h};
+      y_tile_size_w   = (_i_w_exec+1 == ${tile_dim_w})   ? ${y_tile_size_w_last} : ${y_tile_size_w};
+      y_tile_size_nof = (_i_nof_exec+1 == ${tile_dim_nof}) ? ${y_tile_size_nof_last} : ${y_tile_size_nof};
+      y_tile_size_byte = y_tile_size_nof*y_tile_size_h*y_tile_size_w*${y_data_size_byte}/8;
+      y_length_nof_byte = (_i_nof_exec+1 == ${tile_dim_nof})   ? ${y_length_nof_byte_last} : ${y_tile_size_nof_byte};
+      // creation of the pointers to input, output, weights, lambda and k
+      % if flag_DW == 1:
+      asm volatile("": : :"memory");
+      % endif
+      % if has_bias == 1:
+      b = (${type} *) (l1_buffer + ${l1_b_offset} + _i_nof_exec*${bias_tile_size_byte});
+      % endif
+      y = (${type} *) (l1_buffer + ${l1_y_offset} + db_y*${y_tile_size_byte});
+      p_r = 0;
+      p_l = 0;
+      p_t = 0;
+      p_b = 0;
+      if (_i_h_exec == 0)
+        p_t = ${padding_top};
+      if (_i_w_exec == 0)
+        p_l = ${padding_left};
+      if (_i_h_exec == ${tile_dim_h}-1)
+        p_b = ${padding_bottom};
+      if (_i_w_exec == ${tile_dim_w}-1)
+        p_r = ${padding_right};
+      % if tile_dim_nof*tile_dim_nif*tile_dim_h*tile_dim_w == 1 or flag_DW == 1:
+      asm volatile("": : :"memory");
+      % endif
+      DORY_TRACE(DORY_TRACE_KERNEL_START, iter - 1);
   % if flag_DW == 0 and optional_type == '8bit' and (fs1*fs2>1 or stride>1):
-    pulp_nn_conv_Ho_parallel(
+      pulp_nn_conv_Ho_parallel(
   % elif flag_DW == 0 and optional_type == '8bit' and fs1*fs2==1  and 'FullyConnected' not in func_name:
-    pulp_nn_pointwise_HoWo_parallel(
+      pulp_nn_pointwise_HoWo_parallel(
   % elif flag_DW == 0 and optional_type == '8bit' and y_data_size_byte == 32 and ('FullyConnected' in func_name):
-    pulp_nn_linear_out_32( 
+      pulp_nn_linear_out_32( 
   % elif flag_DW == 0 and optional_type == '8bit' and ('FullyConnected' in func_name):
-    pulp_nn_linear( 
+      pulp_nn_linear( 
   % elif flag_DW == 0 and 'mixed' in optional_type  and ('Conv' in func_name):
-    ${"x" if 'hw' in optional_type else ""}pulp_nn_conv_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
+      ${"x" if 'hw' in optional_type else ""}pulp_nn_conv_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
   % elif flag_DW == 0 and 'mixed' in optional_type  and ('Gemm' in func_name or 'MatMul' in func_name or 'FullyConnected' in func_name) and y_data_size_byte == 32:
-    ${"x" if 'hw' in optional_type else ""}pulp_nn_linear_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
+      ${"x" if 'hw' in optional_type else ""}pulp_nn_linear_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
   % elif flag_DW == 0 and 'mixed' in optional_type  and ('Gemm' in func_name or 'MatMul' in func_name or 'FullyConnected' in func_name):
-    pulp_nn_linear_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
+      pulp_nn_linear_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
   % elif flag_DW == 1 and optional_type == '8bit' and fs1 == 3 and fs2 == 3 and stride==1:
-    pulp_nn_depthwise_generic(
+      pulp_nn_depthwise_generic(
   % elif flag_DW == 1 and optional_type == '8bit' and fs1*fs2 < 4:
-    pulp_nn_depthwise_generic_less_4_weights(
+      pulp_nn_depthwise_generic_less_4_weights(
   % elif flag_DW == 1 and optional_type == '8bit':
-    pulp_nn_depthwise_generic(
+      pulp_nn_depthwise_generic(
   % elif flag_DW == 1 and 'mixed' in optional_type:
-    ${"x" if 'hw' in optional_type else ""}pulp_nn_depthwise_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
+      ${"x" if 'hw' in optional_type else ""}pulp_nn_depthwise_${data_type_x[0]}${x_data_size_byte}_${data_type_y[0]}${y_data_size_byte}_${data_type_weights[0]}${W_data_size_byte}(
   % endif
   % if 'Gemm' in func_name or 'FullyConnected' in func_name:
-      % if has_bias:
-      x, b, y, W,
-      % else:
-      x, 0, y, W,
-      % endif
-      % if FLAG_BATCHNORM == 1 and y_data_size_byte != 32:
-      k, lambda,
-      % elif y_data_size_byte != 32:
-      0, 0,
-      % endif
-      % if y_data_size_byte != 32:
-        % if FLAG_RELU == 1:
-      out_mult, out_shift,
+        % if has_bias:
+        x, b, y, W,
         % else:
-        1, out_shift,
+        x, 0, y, W,
         % endif
-      % endif
-      x_tile_size_nif, y_tile_size_nof${"," if y_data_size_byte != 32 else ""}
-      % if y_data_size_byte != 32:
-      ${FLAG_RELU}, ${FLAG_BATCHNORM}
-      % endif
-      );
+        % if FLAG_BATCHNORM == 1 and y_data_size_byte != 32:
+        k, lambda,
+        % elif y_data_size_byte != 32:
+        0, 0,
+        % endif
+        % if y_data_size_byte != 32:
+          % if FLAG_RELU == 1:
+        out_mult, out_shift,
+          % else:
+          1, out_shift,
+          % endif
+        % endif
+        x_tile_size_nif, y_tile_size_nof${"," if y_data_size_byte != 32 else ""}
+        % if y_data_size_byte != 32:
+        ${FLAG_RELU}, ${FLAG_BATCHNORM}
+        % endif
+        );
   % else:
-      x, im2col,
-      % if has_bias:
-      b,
-      % else:
-      NULL,
-      % endif
-      y, W,
-      % if flag_DW == 1:
-      pwt_buffer,
-      % endif
-      % if FLAG_BATCHNORM == 1:
-      k, lambda,
-      % else:
-      0, 0,
-      % endif
-      out_mult, out_shift,
-      x_tile_size_w, x_tile_size_h, x_tile_size_nif,
-      y_tile_size_w, y_tile_size_h, y_tile_size_nof,
-      ${fs2}, ${fs1},
-      p_t, p_b, p_l, p_r, ${stride}, ${stride},
-      ${FLAG_RELU}, ${FLAG_BATCHNORM}
-      );
+        x, im2col,
+        % if has_bias:
+        b,
+        % else:
+        NULL,
+        % endif
+        y, W,
+        % if flag_DW == 1:
+        pwt_buffer,
+        % endif
+        % if FLAG_BATCHNORM == 1:
+        k, lambda,
+        % else:
+        0, 0,
+        % endif
+        out_mult, out_shift,
+        x_tile_size_w, x_tile_size_h, x_tile_size_nif,
+        y_tile_size_w, y_tile_size_h, y_tile_size_nof,
+        ${fs2}, ${fs1},
+        p_t, p_b, p_l, p_r, ${stride}, ${stride},
+        ${FLAG_RELU}, ${FLAG_BATCHNORM}
+        );
   % endif
+      DORY_TRACE(DORY_TRACE_KERNEL_END, iter - 1);
+    }
+    // wait for the transfer of tile iter and the write back of tile iter-2
+    dory_dma_barrier(&DMA_copy_x);
     pi_cl_team_barrier(0);
+
+    if (iter > 0) {
     % if tile_dim_nif != 1 and flag_DW == 0:
-    if(_i_nif_load == 0) 
-    {
+      if(_i_nif_exec == 0) 
+      {
     % endif
-      DMA_copy_y.ext = dory_get_tile_3d(l2_y, _i_h_load, _i_w_load, _i_nof_load, ${y_tile_size_h}, ${y_tile_size_w}, ${y_tile_size_nof}, ${y_w}, ${int(nof*factor)}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte});
-      DMA_copy_y.loc = (l1_buffer + ${l1_y_offset});
+      DMA_copy_y.ext = dory_get_tile_3d(l2_y, _i_h_exec, _i_w_exec, _i_nof_exec, ${y_tile_size_h}, ${y_tile_size_w}, ${y_tile_size_nof}, ${y_w}, ${int(nof*factor)}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte});
+      DMA_copy_y.loc = (void *) y;
       DMA_copy_y.number_of_2d_copies = y_tile_size_h;
       DMA_copy_y.number_of_1d_copies = y_tile_size_w;
       DMA_copy_y.length_1d_copy = y_length_nof_byte;
-      dory_dma_memcpy_async(&DMA_copy_y); 
-      dory_dma_barrier(&DMA_copy_y);  
-% if tile_dim_nif != 1 and flag_DW == 0:
+      dory_dma_memcpy_async(&DMA_copy_y);
+      db_y = !db_y;
+    % if tile_dim_nif != 1 and flag_DW == 0:
+      }
+    % endif
     }
-% endif
+  % if dw_cluster_transpose:
+    // transposition of the input tile just transferred, while the output one is written back
+    if (x_hwc_pixels > 0) {
+      dory_hwc_to_chw((void *) x_hwc, (void *) x_load, x_hwc_pixels, x_hwc_channels);
+      x_hwc_pixels = 0;
+    }
+  % endif
+    if (iter == total_tiles)
+      break;
     // update prev iterators
 
     _i_nof_exec = _i_nof_load;
     _i_nif_exec = _i_nif_load;
     _i_h_exec = _i_h_load;
     _i_w_exec = _i_w_load;
+    x = x_load;
+    W = W_load;
+    % if FLAG_BATCHNORM == 1:
+    k = k_load;
+    lambda = lambda_load;
+    % endif
   % if tile_dim_nif != 1 and flag_DW == 0:
     // loop nest is nof,h,w,nif
     _i_nif_load += 1;
@@ -396,11 +455,11 @@ void ${func_name}(
   % if tile_dim_nif != 1 and flag_DW == 0:
     }
   % endif 
-    pi_cl_team_barrier(0);
   }
 
-% if not TEST:
   // wait for final write
+  dory_dma_barrier(&DMA_copy_y);
+% if not TEST:
   dory_dma_free(&DMA_copy_y);
 % endif
 }
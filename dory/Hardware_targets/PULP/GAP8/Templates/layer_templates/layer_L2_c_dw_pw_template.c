@@ -0,0 +1,199 @@
+/*
+ * layer_L2_c_dw_pw_template.c
+ *
+ * Copyright (C) 2018-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "${func_name}.h"
+% if sdk == 'gap_sdk':
+#include "pulp.h"
+   % endif
+#include "pmsis.h"
+#include "dory_get_tile.h"
+#include "dory_dma.h"
+#include "pulp_nn_kernels.h"
+#include "dory_trace.h"
+
+% if ULTRA_VERBOSE:
+#define VERBOSE_PRINT(...) printf(__VA_ARGS__)
+% endif
+
+// Fused depthwise + pointwise layer. The depthwise output of each tile of
+// output rows stays in L1 and is consumed by the pointwise; the weights of
+// both layers are copied in L1 once.
+void ${func_name}(
+  void *args
+) {
+  //////////////////////////////////////////////////////////////////////////
+  // arguments assigning: keeping same interface between L2 and L3 memory //
+  //////////////////////////////////////////////////////////////////////////
+  unsigned int *real_arg = (unsigned int *) args;
+  unsigned int l3_x =(unsigned int)  real_arg[0];
+  unsigned int l3_y =(unsigned int)  real_arg[1];
+  unsigned int l3_W =(unsigned int)  real_arg[2];
+  unsigned int l2_x =(unsigned int)  real_arg[3];
+  unsigned int l2_x_2 =(unsigned int)  real_arg[4];
+  unsigned int l2_y =(unsigned int)  real_arg[5];
+  unsigned int l2_W =(unsigned int)  real_arg[6];
+  unsigned int l1_buffer =(unsigned int)  real_arg[7];
+  unsigned int hyperram =(unsigned int)  real_arg[8];
+  unsigned int out_mult_in =(unsigned int)  real_arg[9];
+  unsigned int out_shift_in = (unsigned int) real_arg[10];
+
+  /////////////////////
+  // DMA declaration //
+  /////////////////////
+  uint32_t dory_dma_channel = dory_dma_allocate();
+  volatile DMA_copy DMA_copy_W, DMA_copy_x, DMA_copy_y;
+
+  DMA_copy_W.hwc_to_chw = 0;
+  DMA_copy_W.stride_2d = 0;
+  DMA_copy_W.stride_1d = 0;
+  DMA_copy_W.number_of_2d_copies = 1;
+  DMA_copy_W.number_of_1d_copies = 1;
+  DMA_copy_W.dir = 1;
+  DMA_copy_W.tid = dory_dma_channel;
+
+  // the depthwise kernel works on CHW input tiles
+  DMA_copy_x.hwc_to_chw = 1;
+  DMA_copy_x.stride_2d = ${x_stride_w_byte};
+  DMA_copy_x.stride_1d = ${x_stride_c_byte};
+  DMA_copy_x.number_of_1d_copies = ${x_w};
+  DMA_copy_x.length_1d_copy = ${x_length_nif_byte};
+  DMA_copy_x.dir = 1;
+  DMA_copy_x.tid = dory_dma_channel;
+
+  DMA_copy_y.hwc_to_chw = 0;
+  DMA_copy_y.stride_2d = ${y_stride_w_byte};
+  DMA_copy_y.stride_1d = ${y_stride_c_byte};
+  DMA_copy_y.number_of_1d_copies = ${y_w};
+  DMA_copy_y.length_1d_copy = ${y_length_nof_byte};
+  DMA_copy_y.dir = 0;
+  DMA_copy_y.tid = dory_dma_channel;
+
+  volatile int p_t, p_b;
+  volatile unsigned short x_tile_size_h;
+  volatile int y_tile_size_h;
+  volatile int pad_offset_h;
+  volatile ${type} *x, *y, *x_load;
+  volatile ${type} *mid = (${type} *) (l1_buffer + ${l1_mid_offset});
+  volatile ${type} *W_dw = (${type} *) (l1_buffer + ${l1_W_offset});
+  volatile ${type} *W_pw = (${type} *) (l1_buffer + ${l1_W_offset + off_pw_W});
+% if act_dim_bit == 32:
+  volatile int32_t *k_dw = (int32_t *) (l1_buffer + ${l1_W_offset + off_dw_k});
+  volatile int32_t *lambda_dw = (int32_t *) (l1_buffer + ${l1_W_offset + off_dw_lambda});
+  volatile int32_t *k_pw = (int32_t *) (l1_buffer + ${l1_W_offset + off_pw_k});
+  volatile int32_t *lambda_pw = (int32_t *) (l1_buffer + ${l1_W_offset + off_pw_lambda});
+% else:
+  volatile int64_t *k_dw = (int64_t *) (l1_buffer + ${l1_W_offset + off_dw_k});
+  volatile int64_t *lambda_dw = (int64_t *) (l1_buffer + ${l1_W_offset + off_dw_lambda});
+  volatile int64_t *k_pw = (int64_t *) (l1_buffer + ${l1_W_offset + off_pw_k});
+  volatile int64_t *lambda_pw = (int64_t *) (l1_buffer + ${l1_W_offset + off_pw_lambda});
+% endif
+  // double buffering indices: next L1 buffer to be filled (x) or written (y)
+  int db_x = 0, db_y = 0;
+  int iter;
+  int _i_h_load = 0, _i_h_exec = 0;
+  volatile ${type} *im2col;
+  im2col = l1_buffer + ${buffer_l1_all};
+  volatile ${type} *pwt_buffer;
+  pwt_buffer = im2col + ${im2col_dim};
+  uint16_t out_mult = out_mult_in;
+  uint16_t out_shift = out_shift_in;
+
+  ///////////////////////////////////////////
+  // Weights of both layers, loaded once   //
+  ///////////////////////////////////////////
+  DMA_copy_W.ext = (uint32_t) l2_W;
+  DMA_copy_W.loc = (uint32_t) W_dw;
+  DMA_copy_W.length_1d_copy = (uint16_t) ${W_size_byte};
+  dory_dma_memcpy_async(&DMA_copy_W);
+
+  int total_tiles = ${tile_dim_h};
+  // at iteration iter, rows tile iter is transferred in L1 while tile iter-1
+  // goes through the depthwise and the pointwise and is written back to L2
+  for(iter=0; iter < total_tiles + 1; iter++) {
+    if (iter < total_tiles) {
+      x_tile_size_h = (_i_h_load+1 == ${tile_dim_h}) ? ${x_tile_size_h_last} : ${x_tile_size_h};
+      pad_offset_h = (_i_h_load > 0) ? ${padding_top} : 0;
+      x_load = (${type} *) (l1_buffer + ${l1_x_offset} + db_x*${x_tile_size_byte});
+      DMA_copy_x.ext = dory_get_tile_3d(l2_x, _i_h_load, 0, 0, ${x_tile_size_h}, ${x_w}, ${nif}, ${x_w}, ${nif}, ${conv_overlap1}, 0, 0, pad_offset_h, 0, 0, ${x_data_size_byte});
+      DMA_copy_x.loc = (void *) x_load;
+      DMA_copy_x.number_of_2d_copies = x_tile_size_h;
+      dory_dma_memcpy_async(&DMA_copy_x);
+      db_x = !db_x;
+    }
+
+    if (iter > 0) {
+      x_tile_size_h = (_i_h_exec+1 == ${tile_dim_h}) ? ${x_tile_size_h_last} : ${x_tile_size_h};
+      y_tile_size_h = (_i_h_exec+1 == ${tile_dim_h}) ? ${y_tile_size_h_last} : ${y_tile_size_h};
+      y = (${type} *) (l1_buffer + ${l1_y_offset} + db_y*${y_tile_size_byte});
+      p_t = (_i_h_exec == 0) ? ${padding_top} : 0;
+      p_b = (_i_h_exec == ${tile_dim_h}-1) ? ${padding_bottom} : 0;
+      asm volatile("": : :"memory");
+      DORY_TRACE(DORY_TRACE_KERNEL_START, iter - 1);
+  % if fs1 == 3 and fs2 == 3 and stride == 1:
+      pulp_nn_depthwise_generic(
+  % elif fs1*fs2 < 4:
+      pulp_nn_depthwise_generic_less_4_weights(
+  % else:
+      pulp_nn_depthwise_generic(
+  % endif
+        x, im2col, NULL, mid, W_dw, pwt_buffer,
+        k_dw, lambda_dw,
+        1, ${dw_out_shift},
+        ${x_w}, x_tile_size_h, ${nif},
+        ${y_w}, y_tile_size_h, ${nif},
+        ${fs2}, ${fs1},
+        p_t, p_b, ${padding_left}, ${padding_right}, ${stride}, ${stride},
+        1, 1
+        );
+      pi_cl_team_barrier(0);
+      pulp_nn_pointwise_HoWo_parallel(
+        mid, im2col, NULL, y, W_pw,
+        k_pw, lambda_pw,
+        out_mult, out_shift,
+        ${y_w}, y_tile_size_h, ${nif},
+        ${y_w}, y_tile_size_h, ${nof},
+        1, 1,
+        0, 0, 0, 0, 1, 1,
+        1, 1
+        );
+      DORY_TRACE(DORY_TRACE_KERNEL_END, iter - 1);
+    }
+    // wait for the transfer of tile iter and the write back of tile iter-2
+    dory_dma_barrier(&DMA_copy_x);
+    pi_cl_team_barrier(0);
+
+    if (iter > 0) {
+      DMA_copy_y.ext = dory_get_tile_3d(l2_y, _i_h_exec, 0, 0, ${y_tile_size_h}, ${y_w}, ${nof}, ${y_w}, ${nof}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte});
+      DMA_copy_y.loc = (void *) y;
+      DMA_copy_y.number_of_2d_copies = y_tile_size_h;
+      dory_dma_memcpy_async(&DMA_copy_y);
+      db_y = !db_y;
+    }
+    if (iter == total_tiles)
+      break;
+    _i_h_exec = _i_h_load;
+    x = x_load;
+    _i_h_load += 1;
+  }
+
+  // wait for final write
+  dory_dma_barrier(&DMA_copy_y);
+% if not TEST:
+  dory_dma_free(&DMA_copy_y);
+% endif
+}
@@ -0,0 +1,213 @@
+/*
+ * layer_L2_c_fused_group_template.c
+ *
+ * Copyright (C) 2018-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "${func_name}.h"
+% if sdk == 'gap_sdk':
+#include "pulp.h"
+   % endif
+#include "pmsis.h"
+#include "dory_get_tile.h"
+#include "dory_dma.h"
+#include "pulp_nn_kernels.h"
+#include "dory_trace.h"
+% if stream_input:
+#include "net_utils.h"
+% endif
+
+% if ULTRA_VERBOSE:
+#define VERBOSE_PRINT(...) printf(__VA_ARGS__)
+% endif
+<%
+  n_layers = len(layers)
+  k_type = 'int32_t' if act_dim_bit == 32 else 'int64_t'
+%>
+// Group of ${n_layers} fused layers. Each band of ${y_tile_size_h} output rows is computed
+// end-to-end in L1: every layer produces the rows, halos included, needed by
+// the next one, and only the input and output bands are moved from/to L2.
+// First input row of each band
+static const uint16_t ${func_name}_x_band_start[${tile_dim_h}] = {${", ".join(str(start) for start in x_band_start)}};
+// Input rows, top padding, bottom padding and output rows of each layer for each band
+static const uint16_t ${func_name}_bands[${tile_dim_h}][${n_layers}][4] = {
+% for band in bands:
+  {${", ".join("{" + ", ".join(str(v) for v in entry) + "}" for entry in band)}},
+% endfor
+};
+
+void ${func_name}(
+  void *args
+) {
+  //////////////////////////////////////////////////////////////////////////
+  // arguments assigning: keeping same interface between L2 and L3 memory //
+  //////////////////////////////////////////////////////////////////////////
+  unsigned int *real_arg = (unsigned int *) args;
+  unsigned int l3_x =(unsigned int)  real_arg[0];
+  unsigned int l3_y =(unsigned int)  real_arg[1];
+  unsigned int l3_W =(unsigned int)  real_arg[2];
+  unsigned int l2_x =(unsigned int)  real_arg[3];
+  unsigned int l2_x_2 =(unsigned int)  real_arg[4];
+  unsigned int l2_y =(unsigned int)  real_arg[5];
+  unsigned int l2_W =(unsigned int)  real_arg[6];
+  unsigned int l1_buffer =(unsigned int)  real_arg[7];
+  unsigned int hyperram =(unsigned int)  real_arg[8];
+  unsigned int out_mult_in =(unsigned int)  real_arg[9];
+  unsigned int out_shift_in = (unsigned int) real_arg[10];
+% if stream_input:
+  input_stream_t *input_stream = (input_stream_t *) real_arg[11];
+% endif
+
+  /////////////////////
+  // DMA declaration //
+  /////////////////////
+  uint32_t dory_dma_channel = dory_dma_allocate();
+  volatile DMA_copy DMA_copy_W, DMA_copy_x, DMA_copy_y;
+
+  DMA_copy_W.hwc_to_chw = 0;
+  DMA_copy_W.stride_2d = 0;
+  DMA_copy_W.stride_1d = 0;
+  DMA_copy_W.number_of_2d_copies = 1;
+  DMA_copy_W.number_of_1d_copies = 1;
+  DMA_copy_W.dir = 1;
+  DMA_copy_W.tid = dory_dma_channel;
+
+  DMA_copy_x.hwc_to_chw = 0;
+  DMA_copy_x.stride_2d = ${x_stride_w_byte};
+  DMA_copy_x.stride_1d = ${x_stride_c_byte};
+  DMA_copy_x.number_of_1d_copies = ${x_w};
+  DMA_copy_x.length_1d_copy = ${x_stride_c_byte};
+  DMA_copy_x.dir = 1;
+  DMA_copy_x.tid = dory_dma_channel;
+
+  DMA_copy_y.hwc_to_chw = 0;
+  DMA_copy_y.stride_2d = ${y_stride_w_byte};
+  DMA_copy_y.stride_1d = ${y_stride_c_byte};
+  DMA_copy_y.number_of_1d_copies = ${y_w};
+  DMA_copy_y.length_1d_copy = ${y_stride_c_byte};
+  DMA_copy_y.dir = 0;
+  DMA_copy_y.tid = dory_dma_channel;
+
+  const uint16_t *band;
+  volatile ${type} *x, *y, *x_load;
+  volatile ${type} *W = (${type} *) (l1_buffer + ${l1_W_offset});
+% for i, layer in enumerate(layers):
+  % if i < n_layers - 1:
+  volatile ${type} *y_${i} = (${type} *) (l1_buffer + ${layer['l1_y_offset']});
+  % endif
+% endfor
+  // double buffering indices: next L1 buffer to be filled (x) or written (y)
+  int db_x = 0, db_y = 0;
+  int iter;
+  int _i_h_load = 0, _i_h_exec = 0;
+  volatile ${type} *im2col;
+  im2col = l1_buffer + ${buffer_l1_all};
+  uint16_t out_mult = out_mult_in;
+  uint16_t out_shift = out_shift_in;
+
+  /////////////////////////////////////////
+  // Weights of all layers, loaded once  //
+  /////////////////////////////////////////
+  DMA_copy_W.ext = (uint32_t) l2_W;
+  DMA_copy_W.loc = (uint32_t) W;
+  DMA_copy_W.length_1d_copy = (uint16_t) ${W_size_byte};
+  dory_dma_memcpy_async(&DMA_copy_W);
+
+  int total_tiles = ${tile_dim_h};
+  // at iteration iter, the input band iter is transferred in L1 while band
+  // iter-1 goes through all the layers and is written back to L2
+  for(iter=0; iter < total_tiles + 1; iter++) {
+    if (iter < total_tiles) {
+  % if stream_input:
+      // the input is still being written: wait for the last row of the band
+      if (input_stream != NULL)
+        input_stream->wait_rows(input_stream->arg, ${func_name}_x_band_start[_i_h_load] + ${func_name}_bands[_i_h_load][0][0]);
+  % endif
+      x_load = (${type} *) (l1_buffer + ${l1_x_offset} + db_x*${x_tile_size_byte});
+      DMA_copy_x.ext = l2_x + ${func_name}_x_band_start[_i_h_load] * ${x_stride_w_byte};
+      DMA_copy_x.loc = (void *) x_load;
+      DMA_copy_x.number_of_2d_copies = ${func_name}_bands[_i_h_load][0][0];
+      dory_dma_memcpy_async(&DMA_copy_x);
+      db_x = !db_x;
+    }
+
+    if (iter > 0) {
+      y = (${type} *) (l1_buffer + ${l1_y_offset} + db_y*${y_tile_size_byte});
+      asm volatile("": : :"memory");
+      DORY_TRACE(DORY_TRACE_KERNEL_START, iter - 1);
+% for i, layer in enumerate(layers):
+<%
+  x_i = 'x' if i == 0 else 'y_%d' % (i - 1)
+  y_i = 'y' if i == n_layers - 1 else 'y_%d' % i
+%>
+      band = ${func_name}_bands[_i_h_exec][${i}];
+  % if layer['op'] == 'maxpool':
+      pulp_nn_maxpool(
+        ${x_i}, ${y_i},
+        ${layer['x_w']}, band[0], ${layer['nif']},
+        ${layer['y_w']}, band[3],
+        ${layer['fs2']}, ${layer['fs1']},
+        band[1], band[2], ${layer['padding_left']}, ${layer['padding_right']}, ${layer['stride']}, ${layer['stride']}
+        );
+  % else:
+    % if layer['fs1'] * layer['fs2'] == 1 and layer['stride'] == 1:
+      pulp_nn_pointwise_HoWo_parallel(
+    % else:
+      pulp_nn_conv_Ho_parallel(
+    % endif
+        ${x_i}, im2col, NULL, ${y_i}, W + ${layer['off_W']},
+        (${k_type} *) (W + ${layer['off_k']}), (${k_type} *) (W + ${layer['off_lambda']}),
+    % if i == n_layers - 1:
+        out_mult, out_shift,
+    % else:
+        1, ${layer['out_shift']},
+    % endif
+        ${layer['x_w']}, band[0], ${layer['nif']},
+        ${layer['y_w']}, band[3], ${layer['nof']},
+        ${layer['fs2']}, ${layer['fs1']},
+        band[1], band[2], ${layer['padding_left']}, ${layer['padding_right']}, ${layer['stride']}, ${layer['stride']},
+        1, 1
+        );
+  % endif
+  % if i < n_layers - 1:
+      pi_cl_team_barrier(0);
+  % endif
+% endfor
+      DORY_TRACE(DORY_TRACE_KERNEL_END, iter - 1);
+    }
+    // wait for the transfer of band iter and the write back of band iter-2
+    dory_dma_barrier(&DMA_copy_x);
+    pi_cl_team_barrier(0);
+
+    if (iter > 0) {
+      DMA_copy_y.ext = l2_y + _i_h_exec * ${y_tile_size_h * y_stride_w_byte};
+      DMA_copy_y.loc = (void *) y;
+      DMA_copy_y.number_of_2d_copies = ${func_name}_bands[_i_h_exec][${n_layers - 1}][3];
+      dory_dma_memcpy_async(&DMA_copy_y);
+      db_y = !db_y;
+    }
+    if (iter == total_tiles)
+      break;
+    _i_h_exec = _i_h_load;
+    x = x_load;
+    _i_h_load += 1;
+  }
+
+  // wait for final write
+  dory_dma_barrier(&DMA_copy_y);
+% if not TEST:
+  dory_dma_free(&DMA_copy_y);
+% endif
+}
@@ -26,6 +26,7 @@ ${verbose_log}
 #include "dory_get_tile.h"
 #include "dory_dma.h"
 #include "pulp_nn_kernels.h"
+#include "dory_trace.h"
 % if ULTRA_VERBOSE:
 #define VERBOSE_PRINT(...) printf(__VA_ARGS__)
 % endif
@@ -136,6 +137,7 @@ void ${func_name}(
     if (_i_w_load == ${tile_dim_w}-1)
       p_r = ${padding_right};
     pi_cl_team_barrier(0);
+    DORY_TRACE(DORY_TRACE_KERNEL_START, iter);
 
 // aggiungere padding su tutti i lati, acc_out, and filter asymettric
   % if 'Max' in optional:
@@ -176,6 +178,7 @@ void ${func_name}(
     ${FLAG_RELU}
 % endif
     );
+    DORY_TRACE(DORY_TRACE_KERNEL_END, iter);
     pi_cl_team_barrier(0);
     // transfering of output to L2
     DMA_copy_y.ext = dory_get_tile_3d(l2_y, _i_h_load, _i_w_load, _i_nof_load, ${y_tile_size_h}, ${y_tile_size_w}, ${y_tile_size_nof}, ${y_w}, ${nof}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte});
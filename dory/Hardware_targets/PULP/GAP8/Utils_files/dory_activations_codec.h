@@ -0,0 +1 @@
+../../Common/Utils/dory_activations_codec.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../Common/Utils/dory_weights_decoder.c
\ No newline at end of file
@@ -30,6 +30,7 @@ n_inputs = DORY_HW_graph[0].n_test_inputs
 #include "mem.h"
 % endif
 #include "${prefix}network.h"
+#include "dory_trace.h"
 #include "pmsis.h"
 
 #include "bsp/bsp.h"
@@ -391,6 +392,9 @@ void application(void * args) {
 
     end_perf_counter(true);
   }
+#ifdef TRACE
+  dory_trace_dump();
+#endif
 
 #ifdef LOAD_CHECKSUM_INPUTS
   ram_free(ram_input, input_size);
@@ -0,0 +1,134 @@
+/*
+ * camera_preprocess.c
+ *
+ * Copyright (C) 2023 University of Bologna, Italy, ETH Zurich Switzerland.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "camera_preprocess.h"
+#include "pmsis.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Source coordinate in Q8 of the center of output pixel i, clamped to the crop
+static inline int center_q8(int i, int step_q16, int start, int size) {
+  int c = (start << 8) + (((2 * i + 1) * step_q16) >> 9) - 128;
+  return MIN(MAX(c, start << 8), (start + size - 1) << 8);
+}
+
+// Bilinear interpolation, Q8 result
+static inline int bilinear_q8(const camera_preprocess_t *p, int y_q8, int x_q8) {
+  const int y0 = y_q8 >> 8, fy = y_q8 & 0xff;
+  const int x0 = x_q8 >> 8, fx = x_q8 & 0xff;
+  const int y1 = MIN(y0 + 1, p->crop_y + p->crop_height - 1);
+  const int x1 = MIN(x0 + 1, p->crop_x + p->crop_width - 1);
+  const uint8_t *r0 = p->frame + y0 * p->camera_width;
+  const uint8_t *r1 = p->frame + y1 * p->camera_width;
+  const int top = r0[x0] * (256 - fx) + r0[x1] * fx;
+  const int bottom = r1[x0] * (256 - fx) + r1[x1] * fx;
+  return (top * (256 - fy) + bottom * fy) >> 8;
+}
+
+// Average of the crop pixels falling in the output pixel, Q8 result
+static inline int area_q8(const camera_preprocess_t *p, int y_start, int y_end, int x_start, int x_end) {
+  int sum = 0;
+  for (int y = y_start; y < y_end; y++) {
+    const uint8_t *row = p->frame + y * p->camera_width;
+    for (int x = x_start; x < x_end; x++)
+      sum += row[x];
+  }
+  return (sum << 8) / ((y_end - y_start) * (x_end - x_start));
+}
+
+void camera_preprocess_rows(const camera_preprocess_t *p, int rows_start, int rows_stop) {
+  const int core_id = pi_core_id();
+  const int chunk = (rows_stop - rows_start + NUM_CORES - 1) / NUM_CORES;
+  const int start = MIN(rows_start + core_id * chunk, rows_stop);
+  const int stop = MIN(start + chunk, rows_stop);
+  const int step_y_q16 = (p->crop_height << 16) / p->height;
+  const int step_x_q16 = (p->crop_width << 16) / p->width;
+  const int round = 1 << (p->shift + 7);
+
+  for (int i = start; i < stop; i++) {
+    const int y_q8 = center_q8(i, step_y_q16, p->crop_y, p->crop_height);
+    const int y_start = p->crop_y + i * p->crop_height / p->height;
+    const int y_end = MAX(p->crop_y + (i + 1) * p->crop_height / p->height, y_start + 1);
+    uint8_t *out = p->output + i * p->width * p->channels;
+    for (int j = 0; j < p->width; j++) {
+      int pixel;
+      if (p->area) {
+        const int x_start = p->crop_x + j * p->crop_width / p->width;
+        const int x_end = MAX(p->crop_x + (j + 1) * p->crop_width / p->width, x_start + 1);
+        pixel = area_q8(p, y_start, y_end, x_start, x_end);
+      } else {
+        pixel = bilinear_q8(p, y_q8, center_q8(j, step_x_q16, p->crop_x, p->crop_width));
+      }
+      int value = ((pixel - p->mean) * p->mult + round) >> (p->shift + 8);
+      value = MIN(MAX(value, p->out_min), p->out_max);
+      for (int c = 0; c < p->channels; c++)
+        *out++ = (uint8_t) value;
+    }
+  }
+}
+
+void camera_preprocess(void *args) {
+  const camera_preprocess_t *p = (camera_preprocess_t *) args;
+  camera_preprocess_rows(p, 0, p->height);
+  pi_cl_team_barrier(0);
+}
+
+int camera_preprocess_frame_rows(const camera_preprocess_t *p, int rows) {
+  const int i = rows - 1;
+  if (p->area)
+    return MAX(p->crop_y + rows * p->crop_height / p->height, p->crop_y + i * p->crop_height / p->height + 1);
+  const int y_q8 = center_q8(i, (p->crop_height << 16) / p->height, p->crop_y, p->crop_height);
+  return MIN((y_q8 >> 8) + 1, p->crop_y + p->crop_height - 1) + 1;
+}
+
+void camera_stream_wait_rows(void *arg, int rows) {
+  camera_stream_t *stream = (camera_stream_t *) arg;
+  const int start = stream->rows;
+  if (rows <= start)
+    return;
+  const int frame_rows = camera_preprocess_frame_rows(&stream->preprocess, rows);
+  while (*stream->camera_rows < frame_rows)
+    ;
+  camera_preprocess_rows(&stream->preprocess, start, rows);
+  // every core has read stream->rows before it is updated
+  pi_cl_team_barrier(0);
+  if (pi_core_id() == 0)
+    stream->rows = rows;
+  pi_cl_team_barrier(0);
+}
+
+void camera_frame_thumbnail(const uint8_t *frame, uint8_t *thumbnail, int width, int height, int step) {
+  for (int i = 0; i < height / step; i++) {
+    const uint8_t *row = frame + i * step * width;
+    for (int j = 0; j < width / step; j++)
+      *thumbnail++ = row[j * step];
+  }
+}
+
+int camera_frame_difference(const uint8_t *frame, const uint8_t *thumbnail, int width, int height, int step) {
+  int sad = 0;
+  for (int i = 0; i < height / step; i++) {
+    const uint8_t *row = frame + i * step * width;
+    for (int j = 0; j < width / step; j++) {
+      const int d = row[j * step] - *thumbnail++;
+      sad += d < 0 ? -d : d;
+    }
+  }
+  return sad / ((height / step) * (width / step));
+}
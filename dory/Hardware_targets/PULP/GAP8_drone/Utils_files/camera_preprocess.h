@@ -0,0 +1,83 @@
+/*
+ * camera_preprocess.h
+ *
+ * Copyright (C) 2023 University of Bologna, Italy, ETH Zurich Switzerland.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CAMERA_PREPROCESS_H__
+#define __CAMERA_PREPROCESS_H__
+#include <stdint.h>
+
+typedef struct {
+  const uint8_t *frame;   // grayscale camera frame
+  uint8_t *output;        // network input, HWC
+  uint16_t camera_width;
+  uint16_t crop_x;        // region of interest of the frame
+  uint16_t crop_y;
+  uint16_t crop_width;
+  uint16_t crop_height;
+  uint16_t width;         // network input dimensions
+  uint16_t height;
+  uint16_t channels;      // the gray level is replicated on every channel
+  uint8_t area;           // area average instead of bilinear interpolation
+  int32_t mean;           // Q8, in pixel units
+  int32_t mult;           // scale = mult / 2^shift
+  int32_t shift;
+  int32_t out_min;
+  int32_t out_max;
+} camera_preprocess_t;
+
+typedef struct {
+  camera_preprocess_t preprocess;
+  volatile int *camera_rows;  // rows of the frame already written by the camera
+  int rows;                   // rows of the network input already computed
+} camera_stream_t;
+
+/**
+ * Crop, resize and requantize the frame into the network input.
+ * To be forked on the cluster cores, each one computes a band of output rows.
+ */
+void camera_preprocess(void *args);
+
+/**
+ * Compute the rows [start, stop) of the network input, split on the cores
+ * calling it. No synchronization is done.
+ */
+void camera_preprocess_rows(const camera_preprocess_t *p, int start, int stop);
+
+/**
+ * Rows of the frame needed to compute the first rows of the network input.
+ */
+int camera_preprocess_frame_rows(const camera_preprocess_t *p, int rows);
+
+/**
+ * input_stream_t.wait_rows of a frame captured in bands of rows: waits for the
+ * camera and computes the network input up to the requested row.
+ * Called by all the cores of the team.
+ */
+void camera_stream_wait_rows(void *arg, int rows);
+
+/**
+ * Subsample the frame every step pixels in both directions into a thumbnail
+ * of (height / step) x (width / step) pixels.
+ */
+void camera_frame_thumbnail(const uint8_t *frame, uint8_t *thumbnail, int width, int height, int step);
+
+/**
+ * Mean absolute difference between the subsampled frame and a thumbnail.
+ * Cheap enough to run on the FC, leaving the cluster idle on static scenes.
+ */
+int camera_frame_difference(const uint8_t *frame, const uint8_t *thumbnail, int width, int height, int step);
+#endif
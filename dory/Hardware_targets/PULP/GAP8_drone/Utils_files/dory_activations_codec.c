@@ -0,0 +1 @@
+../../GAP8/Utils_files/dory_activations_codec.c
\ No newline at end of file
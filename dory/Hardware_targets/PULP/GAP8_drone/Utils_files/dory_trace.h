@@ -0,0 +1 @@
+../../GAP8/Utils_files/dory_trace.h
\ No newline at end of file
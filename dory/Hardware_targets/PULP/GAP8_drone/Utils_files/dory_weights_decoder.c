@@ -0,0 +1 @@
+../../GAP8/Utils_files/dory_weights_decoder.c
\ No newline at end of file
@@ -16,11 +16,12 @@
 # limitations under the License.
 
 from dory.Hardware_targets.PULP.Common import C_Parser_PULP
+from dory.Hardware_targets.PULP.GAP8_drone_db.HW_Parser import reserve_frame_ring
 import os
 
 class C_Parser(C_Parser_PULP):
-    def __init__(self, *args, **kwargs):
-        super(C_Parser, self).__init__(*args, **kwargs)
+    def __init__(self, graph, config_file, *args, **kwargs):
+        super(C_Parser, self).__init__(graph, reserve_frame_ring(graph[0], config_file), *args, **kwargs)
         if self.precision_library == "mixed-hw":
             assert False, "optional='mixed-hw' not compatible with GAP8!"
 
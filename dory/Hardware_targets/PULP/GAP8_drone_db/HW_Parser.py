@@ -18,9 +18,28 @@
 from dory.Hardware_targets.PULP.Common import onnx_manager_PULP
 from dory.Hardware_targets.PULP.GAP8.HW_Pattern_rewriter import Pattern_rewriter
 from dory.Hardware_targets.PULP.GAP8.Tiler import Tiler
+import numpy as np
 import os
 
+
+def reserve_frame_ring(node, config_file):
+    # The input frame ring of main.c is allocated with the network L2 buffer: its size is reserved
+    # with the code, so that the tiler and the network see the L2 actually left to them.
+    # A slot holds a camera frame or the network input, node being the first layer. The default
+    # ring has 3 slots, LATEST_FRAME_WINS needs "frame ring slots": 4 in the config file.
+    camera = config_file.get("preprocessing", {}).get("camera", [122, 162])
+    input_size = int(np.ceil(node.input_channels * np.prod(node.input_dimensions) * node.input_activation_bits / 8))
+    ring_size = config_file.get("frame ring slots", 3) * max(camera[0] * camera[1], input_size)
+    config_file = dict(config_file)
+    config_file["code reserved space"] += ring_size
+    config_file["frame ring size"] = ring_size
+    return config_file
+
+
 class onnx_manager(onnx_manager_PULP):
+    def __init__(self, graph, config_file, config_file_dir, n_inputs=1):
+        super().__init__(graph, reserve_frame_ring(graph[0], config_file), config_file_dir, n_inputs)
+
     def get_file_path(self):
         return "/".join(os.path.realpath(__file__).split("/")[:-1])
 
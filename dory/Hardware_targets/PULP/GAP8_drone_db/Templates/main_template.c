@@ -31,6 +31,7 @@ n_inputs = DORY_HW_graph[0].n_test_inputs
 % endif
 #include "${prefix}network.h"
 #include "pmsis.h"
+#include <string.h>
 
 #include "bsp/bsp.h"
 #include "bsp/buffer.h"
@@ -53,28 +54,49 @@ n_inputs = DORY_HW_graph[0].n_test_inputs
 // --- custom ---
 #include "himax_registers.h"
 #include "himax_utils.h"
+#include "camera_preprocess.h"
+#include "net_utils.h"
+#include "dory_trace.h"
 
 // DEBUG PRINTS
 // #define VERBOSE 1
-// #define PERF 1 // print FPS performances of the network
+// #define PERF 1 // print FPS and per-stage timings of the pipeline
+#define PERF_PRINT_PERIOD 100 // frames
 
 /* OTHER DEBUG FLAGS */
 // #define LOAD_CHECKSUM_INPUT 1
 // #define DISABLE_DB
+% if stream_input:
+
+// The first layer reads the frame while it is being captured
+#ifndef LOAD_CHECKSUM_INPUT
+#define STREAM_INPUT 1
+#endif
+% endif
 
 // Defines
 #define FREQ_FC 250
 #define FREQ_CL 175
 
 // Camera
+% if preprocessing is None:
+#error "The network input can not be produced from the camera frame."
 #define CAMERA_WIDTH 162
 #define CAMERA_HEIGHT 122
-#define INPUT_WIDTH 162
-#define INPUT_HEIGHT 122
-#define INPUT_COLORS 1
+% else:
+#define CAMERA_WIDTH ${preprocessing["camera_width"]}
+#define CAMERA_HEIGHT ${preprocessing["camera_height"]}
+% endif
+#define INPUT_WIDTH ${DORY_HW_graph[0].input_dimensions[1]}
+#define INPUT_HEIGHT ${DORY_HW_graph[0].input_dimensions[0]}
+#define INPUT_COLORS ${DORY_HW_graph[0].input_channels}
 
 #define CAMERA_SIZE (CAMERA_HEIGHT * CAMERA_WIDTH)
 #define BUFF_SIZE (CAMERA_WIDTH * CAMERA_HEIGHT)
+// The frame is captured in bands of rows, each one with its own completion
+#define BAND_ROWS 8
+#define CAMERA_FPS 60
+#define N_BANDS ((CAMERA_HEIGHT + BAND_ROWS - 1) / BAND_ROWS)
 
 // LED
 static struct pi_device gpio_device;
@@ -95,10 +117,52 @@ uint8_t led = 0;
 #define CNN_OUTPUTS 2
 #endif
 
+// Capture policy: with LATEST_FRAME_WINS the camera keeps capturing into the
+// oldest frame waiting for the inference when the ring is full, and the network
+// always gets the newest frame, the older ones are dropped. Otherwise the
+// capture waits for a free slot and every captured frame is inferred, in order.
+#ifndef LATEST_FRAME_WINS
+#define LATEST_FRAME_WINS 0
+#endif
+
+// Frame gating: the network is not run on the frames whose mean absolute
+// difference from the last inferred frame, subsampled every GATING_STEP pixels,
+// is below GATING_THRESHOLD gray levels. The outputs of the last inference are
+// sent again, and the cluster stays idle.
+#ifndef FRAME_GATING
+#define FRAME_GATING 0
+#endif
+#define GATING_STEP 4
+#define GATING_THRESHOLD 3
+#define GATING_MAX_SKIP 30 // frames, the network runs at least once every GATING_MAX_SKIP + 1 frames
+
+// Input ring depth: one frame in acquisition, one in inference, one in publishing,
+// plus the newest complete frame with LATEST_FRAME_WINS
+#ifdef DISABLE_DB
+#define N_IMAGE_BUFFERS 1
+#elif LATEST_FRAME_WINS
+#define N_IMAGE_BUFFERS 4
+#else
+#define N_IMAGE_BUFFERS 3
+#endif
+<%
+l2_input_size = int(DORY_HW_graph[0].tiling_dimensions["L2"]["input_activation_memory"])
+%>\
+// A slot of the ring holds a camera frame, or a network input when it is
+// loaded from the checksum files. The ring is allocated after the network L2
+// buffer, in the L2 reserved for it at generation (see reserve_frame_ring in
+// HW_Parser.py): the network buffer is already smaller by as much.
+#define FRAME_SIZE (CAMERA_SIZE > ${l2_input_size} ? CAMERA_SIZE : ${l2_input_size})
+#define FRAME_RING_SIZE ${frame_ring_size}
+#if N_IMAGE_BUFFERS * FRAME_SIZE > FRAME_RING_SIZE
+#error "The frame ring does not fit in the L2 reserved for it, raise \"frame ring slots\" in the config file."
+#endif
+#define N_FRAMES 100000
+
 // Global Variables
-static pi_buffer_t buffer_streamer[2];
+static pi_buffer_t buffer_streamer[N_IMAGE_BUFFERS];
 static struct pi_device camera;
-static int32_t data_to_send[CNN_OUTPUTS];
+static int32_t data_to_send[N_IMAGE_BUFFERS][CNN_OUTPUTS];
 
 static struct pi_device wifi;
 static int open_wifi(struct pi_device *device) {
@@ -194,7 +258,7 @@ static void open_camera() {
   himax_set_format(&camera, QQVGA);
 
   // --- image FPS
-  himax_set_fps(&camera, 60, QQVGA);
+  himax_set_fps(&camera, CAMERA_FPS, QQVGA);
 
   // image rotation
   set_value = 3;
@@ -207,28 +271,173 @@ static void open_camera() {
   pi_time_wait_us(100000);
 }
 
-// PERFORMANCES
-void start_perf_counter() {
+// PIPELINE
+/* Frames flow through three stages, each one driven by its own FC task:
+ *   ACQUIRE: camera capture, in bands of rows, into a free slot of the input ring,
+ *            with the bands of the next frame queued behind when a slot is free
+ *   INFER:   frame preprocessing and network execution on the cluster
+ *   PUBLISH: UART send of the outputs (and JPEG streaming of the frame)
+ * The completion callbacks only account for the finished jobs and wake up the
+ * main loop, which retires the stages and starts the next job of every idle
+ * stage, so that the sustained frame rate is bounded by the slowest stage. Each
+ * slot of the input ring is flagged with the stages using it, and is free when
+ * no flag is set.
+ */
+typedef enum {
+  STAGE_ACQUIRE,
+  STAGE_INFER,
+  STAGE_PUBLISH,
+  N_STAGES
+} stage_id_t;
+
+#define STAGE_MAX_JOBS 2
+
+typedef struct {
+  volatile int pending; // jobs in flight, decremented by the callbacks
+  int busy;
+  int frames;           // frames completed by the stage
+  uint32_t start_us;    // timestamps of the last frame
+  uint32_t end_us;
+  uint32_t last_us;     // duration of the last frame
+  uint32_t busy_us;     // accumulated busy time
+} stage_t;
+
+// Per-stage timestamps, exported to find out which stage limits the frame rate
+stage_t pipeline_stages[N_STAGES];
+static pi_task_t stage_tasks[N_STAGES][STAGE_MAX_JOBS];
+static const char *stage_names[N_STAGES] = { "acquire", "infer", "publish" };
+// Released by every job that ends: the main loop sleeps on it when no stage can start.
+// A release is kept until the loop blocks the event again, and several releases
+// before the loop wakes up count as one.
+static pi_task_t pipeline_event;
+
+static void stage_callback(void *arg) {
+  stage_t *stage = (stage_t *)arg;
+  stage->pending--;
+  pi_task_release(&pipeline_event);
+}
+
+static void stage_begin(stage_id_t id, int n_jobs) {
+  stage_t *stage = &pipeline_stages[id];
+  stage->busy = 1;
+  stage->pending = n_jobs;
+  stage->start_us = pi_time_get_us();
+}
+
+static pi_task_t *stage_task(stage_id_t id, int job) {
+  return pi_task_callback(&stage_tasks[id][job], stage_callback, &pipeline_stages[id]);
+}
+
+// Returns 1 if the stage has just completed its frame
+static int stage_retire(stage_id_t id) {
+  stage_t *stage = &pipeline_stages[id];
+  if (!stage->busy || stage->pending > 0)
+    return 0;
+  stage->busy = 0;
+  stage->end_us = pi_time_get_us();
+  stage->last_us = stage->end_us - stage->start_us;
+  stage->busy_us += stage->last_us;
+  stage->frames++;
+  return 1;
+}
+
+static int stage_is_idle(stage_id_t id) {
+  return !pipeline_stages[id].busy;
+}
+
+#define SLOT_CAPTURE 1 // written by the camera
+#define SLOT_READY 2   // complete frame waiting for the inference
+#define SLOT_INFER 4   // read by the inference
+#define SLOT_PUBLISH 8 // outputs, and frame, being published
+
+static int slot_flags[N_IMAGE_BUFFERS];
+static int slot_frame[N_IMAGE_BUFFERS];        // capture order of the frame in the slot
+static uint32_t slot_time_us[N_IMAGE_BUFFERS]; // end of the capture of the frame
+
+typedef struct {
+  int captured;    // frames completely written by the camera
+  int dropped;     // frames overwritten or skipped before being inferred, or not captured for lack of a free slot
+  int processed;   // frames inferred
+  int skipped;     // frames not inferred by the frame gating
+  uint32_t age_us; // age of the last published outputs, from the end of the capture
+} frame_counters_t;
+
+// Frame counters, exported to check the age of the information sent to the controller
+frame_counters_t frame_counters;
+
+// Slot with exactly the given flags holding the oldest (or newest) frame, -1 if none
+static int slot_find(int flags, int newest) {
+  int found = -1;
+  for (int i = 0; i < N_IMAGE_BUFFERS; i++) {
+    if (slot_flags[i] != flags)
+      continue;
+    if (found < 0 || (newest ? slot_frame[i] > slot_frame[found] : slot_frame[i] < slot_frame[found]))
+      found = i;
+  }
+  return found;
+}
+
+void print_pipeline_stats(uint32_t elapsed_us) {
 #ifdef PERF
-  // configure
-  pi_perf_conf(1 << PI_PERF_CYCLES);
-  // perf measurement begin
-  pi_perf_reset();
-  pi_perf_start();
+  for (int i = 0; i < N_STAGES; i++) {
+    stage_t *stage = &pipeline_stages[i];
+    printf("%-8s frames: %6d, last: %6d us, avg: %6d us\n", stage_names[i], stage->frames,
+           stage->last_us, stage->frames ? stage->busy_us / stage->frames : 0);
+  }
+  printf("captured: %d, dropped: %d, processed: %d, skipped: %d, age: %d us\n", frame_counters.captured,
+         frame_counters.dropped, frame_counters.processed, frame_counters.skipped, frame_counters.age_us);
+  printf("%f FPS \n", (float)pipeline_stages[STAGE_PUBLISH].frames * 1000000.f / (float)elapsed_us);
 #endif
 }
 
-void end_perf_counter(bool verbose) {
-#ifdef PERF
-  // performance measurements: end
-  pi_perf_stop();
-  float perf_cyc = pi_perf_read(PI_PERF_CYCLES);
-  float perf_s = 1. / ((float)perf_cyc / (float)(FREQ_FC * 1000 * 1000));
-  // printf("%d\n", perf_cyc);
-  printf("%f FPS \n", perf_s);
+// PREPROCESSING
+/* The inference job first turns the camera frame into the network input on the
+ * cluster (crop, resize and requantization), writing it where the first layer
+ * reads its input from, and then runs the network. The FC meanwhile captures
+ * the next frame.
+ */
+typedef struct {
+  camera_stream_t stream;
+  ${prefix}network_args_t *network_args;
+} infer_args_t;
+
+static void infer_cluster(void *args) {
+  infer_args_t *infer_args = (infer_args_t *)args;
+#ifndef STREAM_INPUT
+  if (infer_args->stream.preprocess.frame != NULL)
+    pi_cl_team_fork(NUM_CORES, camera_preprocess, &infer_args->stream.preprocess);
 #endif
+  ${prefix}network_run_cluster(infer_args->network_args);
 }
 
+/* With STREAM_INPUT the inference starts as soon as the capture of its frame
+ * has started: the first layer waits for the rows of each input tile, which
+ * are preprocessed once the camera has delivered the bands they come from.
+ */
+static volatile int camera_rows[N_IMAGE_BUFFERS];
+static pi_task_t band_tasks[N_IMAGE_BUFFERS][N_BANDS];
+
+static void band_callback(void *arg) {
+  volatile int *rows = (volatile int *)arg;
+  *rows = *rows + BAND_ROWS < CAMERA_HEIGHT ? *rows + BAND_ROWS : CAMERA_HEIGHT;
+  pi_task_release(&pipeline_event);
+}
+
+// The camera writes the bands of a frame right after the ones already queued
+static void camera_queue_frame(void *frame, int slot) {
+  camera_rows[slot] = 0;
+  for (int band = 0; band < N_BANDS; band++) {
+    const int rows = band < N_BANDS - 1 ? BAND_ROWS : CAMERA_HEIGHT - band * BAND_ROWS;
+    pi_camera_capture_async(&camera, frame + band * BAND_ROWS * CAMERA_WIDTH, rows * CAMERA_WIDTH,
+                            pi_task_callback(&band_tasks[slot][band], band_callback, (void *)&camera_rows[slot]));
+  }
+}
+
+#if FRAME_GATING
+static uint8_t gating_reference[(CAMERA_HEIGHT / GATING_STEP) * (CAMERA_WIDTH / GATING_STEP)];
+static int32_t gating_outputs[CNN_OUTPUTS]; // outputs of the last inferred frame
+#endif
+
 // CNN POST-PROCESSING
 #ifdef DEBUG
 static inline float sigmoid(float x) {
@@ -272,8 +481,6 @@ void application(void * args) {
     printf("Uart open failed !\n");
     pmsis_exit(-1);
   }
-  pi_task_t task_uart = {0};
-  pi_task_block(&task_uart);
   printf("Uart opened !\n");
 
   // configure LED
@@ -285,14 +492,12 @@ void application(void * args) {
   ${prefix}network_initialize(&network);
 
   // Allocating space the network and inputs
-<%
-l2_input_size = int(DORY_HW_graph[0].tiling_dimensions["L2"]["input_activation_memory"])
-%>\
   const size_t network_l2_buffer_size = ${l2_buffer_size};
   const size_t network_l2_input_size = ${l2_input_size};
-  // Total size is network (which contains already space for 1 input) + one more input
-  // for double buffering.
-  const size_t total_l2_size = network_l2_buffer_size + network_l2_input_size;
+  const size_t frame_size = FRAME_SIZE;
+  // Total size is network (which contains already space for 1 input) + the
+  // frame ring
+  const size_t total_l2_size = network_l2_buffer_size + FRAME_RING_SIZE;
 
   void *l2_buffer = pmsis_l2_malloc(total_l2_size);
   if (NULL == l2_buffer) {
@@ -305,28 +510,76 @@ l2_input_size = int(DORY_HW_graph[0].tiling_dimensions["L2"]["input_activation_m
   printf("\nL2 Buffer alloc initial\t@ 0x%08x:\tOk\n", (unsigned int)l2_buffer);
 #endif
 
-  /* Double buffer */
-  const int N_IMAGE_BUFFERS = 2;
-
   /*             MEMORY LAYOUT
    *
-   *          +-----------------+  <-- input_addr[0], network_start_addr[0]
-   *          |    input #0     |
-   *          +-----------------+  <-- network_start_addr[1]
-   *          |                 |
+   *          +-----------------+  <-- network_input_addr, l2_buffer
+   *          |  network input  |
+   *          +-----------------+
    *          |                 |
-   *       |  |     Shared      | ^
+   *       |  |                 | ^
    * dir 1 |  |   Network Mem.  | | dir 0
    *       V  |                 | |
    *          |                 |
-   *          +-----------------+  <-- input_addr[1]
-   *          |    input #1     |
+   *          +-----------------+  <-- input_addr[0]
+   *          |    frame #0     |
    *          +-----------------+
+   *          |       ...       |
+   *          +-----------------+  <-- input_addr[N_IMAGE_BUFFERS - 1]
+   *          |    frame #N-1   |
+   *          +-----------------+
+   *
+   * The input layer is allocated first in direction 1, i.e. at the beginning of
+   * the network memory, where the inference stage preprocesses the frame.
    */
 
-  const void *input_addr[2] = { l2_buffer, l2_buffer + network_l2_buffer_size };
-  const void *network_start_addr[2] = { l2_buffer, l2_buffer + network_l2_input_size };
-  int buffer_idx = 0;
+  void *network_input_addr = l2_buffer;
+  void *input_addr[N_IMAGE_BUFFERS];
+  for (int i = 0; i < N_IMAGE_BUFFERS; i++)
+    input_addr[i] = l2_buffer + network_l2_buffer_size + i * frame_size;
+
+  ${prefix}network_args_t network_args = {
+    .l2_buffer = l2_buffer,
+    .l2_buffer_size = network_l2_buffer_size,
+    .l2_final_output = data_to_send[0],
+    .exec = 0,
+    .initial_allocator_dir = 1,
+    % if not l3_supported:
+    .l2_input_h = ${prefix}L2_input_h
+    % endif
+  };
+
+  % if preprocessing is not None:
+  infer_args_t infer_args = {
+    .stream.preprocess = {
+      .frame = NULL,
+      .output = network_input_addr,
+      .camera_width = CAMERA_WIDTH,
+      .crop_x = ${preprocessing["crop"][1]},
+      .crop_y = ${preprocessing["crop"][0]},
+      .crop_width = ${preprocessing["crop"][3]},
+      .crop_height = ${preprocessing["crop"][2]},
+      .width = INPUT_WIDTH,
+      .height = INPUT_HEIGHT,
+      .channels = INPUT_COLORS,
+      .area = ${preprocessing["area"]},
+      .mean = ${preprocessing["mean"]},
+      .mult = ${preprocessing["mult"]},
+      .shift = ${preprocessing["shift"]},
+      .out_min = ${preprocessing["out_min"]},
+      .out_max = ${preprocessing["out_max"]}
+    },
+    .network_args = &network_args
+  };
+  input_stream_t input_stream = {
+    .wait_rows = camera_stream_wait_rows,
+    .arg = &infer_args.stream
+  };
+  % endif
+  // Same stacks as the network cluster task, set up by network_initialize
+  struct pi_cluster_task infer_task = {0};
+  pi_cluster_task(&infer_task, infer_cluster, &infer_args);
+  infer_task.stack_size = network.cluster_task.stack_size;
+  infer_task.slave_stack_size = network.cluster_task.slave_stack_size;
 
 #ifdef LOAD_CHECKSUM_INPUT
   size_t input_size = 1000000;
@@ -359,112 +612,213 @@ l2_input_size = int(DORY_HW_graph[0].tiling_dimensions["L2"]["input_activation_m
   printf("Opened streamer\n");
 #endif
 
-#ifdef PERF
-  pi_perf_conf(1 << PI_PERF_CYCLES);
-#endif
-
-// ==========================================================================
-// =======================   First camera fetch   ===========================
-// ==========================================================================
-
-    pi_camera_control(&camera, PI_CAMERA_CMD_START, 0);
-    pi_camera_capture(&camera, input_addr[buffer_idx], BUFF_SIZE);
-    pi_camera_control(&camera, PI_CAMERA_CMD_STOP, 0);
-
-#ifdef LOAD_CHECKSUM_INPUT
-    ram_read(input_addr[buffer_idx], ram_input, network_l2_input_size);
-#endif
-
 // ==========================================================================
 // ==============================   Loop   ==================================
 // ==========================================================================
 
-  printf("*For* loop...\n");
-
-  for (int iter = 0; iter < 100000; iter++) {
-    start_perf_counter();
+  printf("*Pipeline* loop...\n");
+
+  stage_t *acquire = &pipeline_stages[STAGE_ACQUIRE];
+  stage_t *infer = &pipeline_stages[STAGE_INFER];
+  stage_t *publish = &pipeline_stages[STAGE_PUBLISH];
+  // slot used by each stage, acquire_next holds the frame queued behind the one in capture,
+  // publish_next the outputs waiting for the publish stage
+  int acquire_slot = -1, acquire_next = -1, infer_slot = -1, publish_slot = -1, publish_next = -1;
+  uint32_t camera_stop_us = 0;
+  int frame_id = 0, infer_frame = -1;
+#if FRAME_GATING
+  int gating_skipped = GATING_MAX_SKIP; // the first frame has no reference
+#endif
+  uint32_t pipeline_start_us = pi_time_get_us();
 
-    LED_TOGGLE;
+  while (publish->frames < N_FRAMES) {
+    // Armed before the scan: a job ending from now on wakes up the loop
+    pi_task_block(&pipeline_event);
+    int started = 0;
 
-    // Next image fetch
+    // Retire the stages whose jobs are over
 
-#ifndef DISABLE_DB  // if *not* defined
-    pi_task_t camera_task;
-    pi_camera_control(&camera, PI_CAMERA_CMD_START, 0);
-    pi_camera_capture_async(&camera, input_addr[!buffer_idx], BUFF_SIZE, pi_task_block(&camera_task));
+    while (acquire_slot >= 0 && camera_rows[acquire_slot] == CAMERA_HEIGHT) {
+      acquire->end_us = pi_time_get_us();
+      acquire->last_us = acquire->end_us - acquire->start_us;
+      acquire->busy_us += acquire->last_us;
+      acquire->frames++;
+#ifdef LOAD_CHECKSUM_INPUT
+      ram_read(input_addr[acquire_slot], ram_input, network_l2_input_size);
 #endif
-
-    ${prefix}network_args_t network_args = {
-      .l2_buffer = network_start_addr[buffer_idx],
-      .l2_buffer_size = network_l2_buffer_size,
-      .l2_final_output = data_to_send,
-      .exec = 0,
-      .initial_allocator_dir = !buffer_idx, // opposite of buffer_idx
-      % if not l3_supported:
-      .l2_input_h = ${prefix}L2_input_h
-      % endif
-    };
-
-    ${prefix}network_run_async(&network, &network_args);
-    ${prefix}network_run_wait(&network);
-
-    // Print CNN outputs: Steering and collision
-#ifdef DEBUG
-    int32_t angle = data_to_send[0];
-    int32_t prob_of_col = data_to_send[1];
-    // printf("network.c: Steering Angle: %d, Collision: %d \n",  angle,
-    // prob_of_col);
-
-    // de-quantize and convert to float --> only for debugging ! this is done by
-    // the STM32
-    float quantum = 0.0006;
-    float angle_float = (float)angle * quantum;
-    float prob_of_col_float = sigmoid((float)prob_of_col * quantum);
-    printf("network.c: Steering Angle: %.2f, Collision: %.2f \n", angle_float,
-           prob_of_col_float);
+      frame_counters.captured++;
+      slot_flags[acquire_slot] &= ~SLOT_CAPTURE;
+      slot_time_us[acquire_slot] = acquire->end_us;
+      // a frame streamed into the inference while it was captured is already taken
+      if (slot_frame[acquire_slot] > infer_frame)
+        slot_flags[acquire_slot] |= SLOT_READY;
+      // the camera goes on with the frame queued behind
+      acquire_slot = acquire_next;
+      acquire_next = -1;
+      acquire->start_us = acquire->end_us;
+      if (acquire_slot < 0) {
+        // nothing queued: the camera is stopped, so that it never streams rows with
+        // no buffer to write them to
+        pi_camera_control(&camera, PI_CAMERA_CMD_STOP, 0);
+        camera_stop_us = acquire->end_us;
+        acquire->busy = 0;
+      }
+    }
+
+    if (stage_retire(STAGE_INFER)) {
+      frame_counters.processed++;
+#if FRAME_GATING
+      memcpy(gating_outputs, data_to_send[infer_slot], sizeof(gating_outputs));
 #endif
-
-    /* UART synchronous send */
-    // pi_uart_write(&uart, (char *) data_to_send, CNN_OUTPUTS*4);
-
-    /* UART asynchronous send */
-    pi_uart_write_async(&uart, (char *)data_to_send, CNN_OUTPUTS * 4,
-                        pi_task_block(&task_uart));
-    // pi_task_wait_on(&task_uart);
-
-#ifdef DISABLE_DB  // if defined
-    pi_task_t camera_task;
-    pi_camera_control(&camera, PI_CAMERA_CMD_START, 0);
-    pi_camera_capture_async(&camera, input_addr[buffer_idx], BUFF_SIZE, pi_task_block(&camera_task));
+      slot_flags[infer_slot] = (slot_flags[infer_slot] & ~SLOT_INFER) | SLOT_PUBLISH;
+      publish_next = infer_slot;
+    }
+
+    if (stage_retire(STAGE_PUBLISH)) {
+      slot_flags[publish_slot] &= ~SLOT_PUBLISH;
+      frame_counters.age_us = publish->end_us - slot_time_us[publish_slot];
+      if (publish->frames % PERF_PRINT_PERIOD == 0)
+        print_pipeline_stats(pi_time_get_us() - pipeline_start_us);
+    }
+
+    // Queue the next frame as soon as a slot of the ring is free, behind the frame in
+    // capture while it still has rows to write, so that the camera keeps running
+
+    if (acquire_next < 0 && (acquire_slot < 0 || camera_rows[acquire_slot] < CAMERA_HEIGHT)) {
+      int slot = slot_find(0, 0);
+#if LATEST_FRAME_WINS
+      // no free slot: overwrite the oldest frame waiting for the inference
+      if (slot < 0 && (slot = slot_find(SLOT_READY, 0)) >= 0)
+        frame_counters.dropped++;
 #endif
-
-    // Wait for image
-
-    pi_task_wait_on(&camera_task);
-    pi_camera_control(&camera, PI_CAMERA_CMD_STOP, 0);
-
-#ifdef JPEG_STREAMER
-    frame_streamer_send(streamer, &buffer_streamer[buffer_idx]);
+      if (slot >= 0) {
+        slot_flags[slot] = SLOT_CAPTURE;
+        slot_frame[slot] = frame_id++;
+        camera_queue_frame(input_addr[slot], slot);
+        if (acquire_slot >= 0) {
+          acquire_next = slot;
+        } else {
+          // Started once the bands are queued, the camera delivers the next whole frame.
+          // The frames it delivered while it was stopped are lost.
+          acquire_slot = slot;
+          acquire->busy = 1;
+          acquire->start_us = pi_time_get_us();
+          if (frame_counters.captured > 0)
+            frame_counters.dropped += (acquire->start_us - camera_stop_us) / (1000000 / CAMERA_FPS);
+          pi_camera_control(&camera, PI_CAMERA_CMD_START, 0);
+        }
+        started = 1;
+      }
+    }
+
+    // Run the network on the oldest acquired frame, or on the newest one with LATEST_FRAME_WINS
+
+    if (stage_is_idle(STAGE_INFER) && publish_next < 0) {
+      int slot = slot_find(SLOT_READY, LATEST_FRAME_WINS);
+#if defined STREAM_INPUT && !FRAME_GATING
+      // the frame in capture can be inferred as well, it is the newest one
+      if (!stage_is_idle(STAGE_ACQUIRE) && slot_frame[acquire_slot] > infer_frame && (slot < 0 || LATEST_FRAME_WINS))
+        slot = acquire_slot;
 #endif
-
+#if LATEST_FRAME_WINS
+      // the older complete frames are stale
+      for (int i = 0; slot >= 0 && i < N_IMAGE_BUFFERS; i++) {
+        if (slot_flags[i] == SLOT_READY && slot_frame[i] < slot_frame[slot]) {
+          slot_flags[i] = 0;
+          frame_counters.dropped++;
+        }
+      }
+#endif
+#if FRAME_GATING
+      if (slot >= 0 && gating_skipped < GATING_MAX_SKIP &&
+          camera_frame_difference(input_addr[slot], gating_reference, CAMERA_WIDTH, CAMERA_HEIGHT, GATING_STEP) < GATING_THRESHOLD) {
+        // static scene: publish the outputs of the last inferred frame
+        memcpy(data_to_send[slot], gating_outputs, sizeof(gating_outputs));
+        infer_frame = slot_frame[slot];
+        slot_flags[slot] = (slot_flags[slot] & ~SLOT_READY) | SLOT_PUBLISH;
+        publish_next = slot;
+        gating_skipped++;
+        frame_counters.skipped++;
+        slot = -1;
+      } else if (slot >= 0) {
+        camera_frame_thumbnail(input_addr[slot], gating_reference, CAMERA_WIDTH, CAMERA_HEIGHT, GATING_STEP);
+        gating_skipped = 0;
+      }
+#endif
+      if (slot >= 0) {
+        infer_slot = slot;
+        infer_frame = slot_frame[slot];
+        slot_flags[slot] = (slot_flags[slot] & ~SLOT_READY) | SLOT_INFER;
+        LED_TOGGLE;
+        stage_begin(STAGE_INFER, 1);
 #ifdef LOAD_CHECKSUM_INPUT
-#ifdef DISABLE_DB
-    // store into buffer_idx
-    ram_read(input_addr[buffer_idx], ram_input, network_l2_input_size);
+        // The checksum input is already in the network format: read in place from the slot
+        network_args.l2_input = input_addr[slot];
+        infer_args.stream.preprocess.frame = NULL;
 #else
-    // store into next buffer_idx, i.e. !buffer_idx
-    ram_read(input_addr[!buffer_idx], ram_input, network_l2_input_size);
+        infer_args.stream.preprocess.frame = input_addr[slot];
 #endif
+#ifdef STREAM_INPUT
+        infer_args.stream.camera_rows = &camera_rows[slot];
+        infer_args.stream.rows = 0;
+        network_args.input_stream = &input_stream;
 #endif
+        network_args.l2_final_output = data_to_send[slot];
+        pi_cluster_send_task_to_cl_async(&network.cluster_dev, &infer_task, stage_task(STAGE_INFER, 0));
+        started = 1;
+      }
+    }
+
+    // Publish the outputs of the last inferred frame, once it is completely captured
 
-    // Update buffer
-#ifndef DISABLE_DB // if *not* defined
-    buffer_idx = !buffer_idx;
+    if (stage_is_idle(STAGE_PUBLISH) && publish_next >= 0 && !(slot_flags[publish_next] & SLOT_CAPTURE)) {
+      const int slot = publish_slot = publish_next;
+      publish_next = -1;
+
+      // Print CNN outputs: Steering and collision
+#ifdef DEBUG
+      int32_t angle = data_to_send[slot][0];
+      int32_t prob_of_col = data_to_send[slot][1];
+
+      // de-quantize and convert to float --> only for debugging ! this is done by
+      // the STM32
+      float quantum = 0.0006;
+      float angle_float = (float)angle * quantum;
+      float prob_of_col_float = sigmoid((float)prob_of_col * quantum);
+      printf("network.c: Steering Angle: %.2f, Collision: %.2f \n", angle_float,
+             prob_of_col_float);
 #endif
 
-    end_perf_counter(true);
+#ifdef JPEG_STREAMER
+      stage_begin(STAGE_PUBLISH, 2);
+      frame_streamer_send_async(streamer, &buffer_streamer[slot], stage_task(STAGE_PUBLISH, 1));
+#else
+      stage_begin(STAGE_PUBLISH, 1);
+#endif
+      /* UART asynchronous send */
+      pi_uart_write_async(&uart, (char *)data_to_send[slot], CNN_OUTPUTS * 4,
+                          stage_task(STAGE_PUBLISH, 0));
+      started = 1;
+    }
+
+    // A job just started can let an earlier stage start (e.g. the inference waits for
+    // the publish stage to take its outputs): scan again, else sleep until a job ends
+    if (!started)
+      pi_task_wait_on(&pipeline_event);
   }
 
+  pi_camera_control(&camera, PI_CAMERA_CMD_STOP, 0);
+  print_pipeline_stats(pi_time_get_us() - pipeline_start_us);
+#ifdef TRACE
+  // the last frame may still be in the cluster
+  while (pipeline_stages[STAGE_INFER].pending > 0) {
+    pi_task_block(&pipeline_event);
+    if (pipeline_stages[STAGE_INFER].pending > 0)
+      pi_task_wait_on(&pipeline_event);
+  }
+  dory_trace_dump();
+#endif
+
 #ifdef LOAD_CHECKSUM_INPUTS
   ram_free(ram_input, input_size);
 #endif
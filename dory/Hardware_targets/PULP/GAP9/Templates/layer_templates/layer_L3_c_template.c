@@ -89,24 +89,10 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
 
   % if n_tile_W > 1:
   // weight L3 tiling. Parameters
-  pi_cl_ram_req_t req_w, req_k, req_l, req_bias;
-  // first tile transfer. Weights, k, lambda
-  pi_cl_ram_read(ram, l3_W, db[i_db_w].w, ${weight_dim}, &req_w);
-  % if k_dim != 0:
-  pi_cl_ram_read(ram, l3_W+${(weight_dim+bias_dim)*n_tile_W}, db[i_db_w].k, ${k_dim}, &req_k);
-  pi_cl_ram_read(ram, l3_W+${(weight_dim+bias_dim+k_dim)*n_tile_W}, db[i_db_w].l, ${lambda_dim}, &req_l);
-  % endif 
-  % if bias_dim != 0:
-  pi_cl_ram_read(ram, l3_W+${weight_dim*n_tile_W}, db[i_db_w].bias, ${bias_dim}, &req_bias);
-  % endif 
+  pi_cl_ram_req_t req_w;
+  // first tile transfer. Weights, bias, k, lambda of a tile are contiguous in L3 and in L2
+  pi_cl_ram_read(ram, l3_W, db[i_db_w].w, ${l3_tile_dim}, &req_w);
   pi_cl_ram_read_wait(&req_w);
-  % if k_dim != 0:
-  pi_cl_ram_read_wait(&req_k);
-  pi_cl_ram_read_wait(&req_l);
-  % endif
-  % if bias_dim != 0:
-  pi_cl_ram_read_wait(&req_bias);
-  % endif 
   // switching buffers
   % endif
 
@@ -149,30 +135,13 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
   % if n_tile_W > 1:
   // loop over weight tiles
 
-  int offset_w = ${l3_offset_w + weight_dim};
-  % if k_dim != 0:
-  int offset_k = ${l3_offset_k + k_dim};
-  int offset_l = ${l3_offset_l + lambda_dim};
-  % endif
-  % if bias_dim != 0:
-  int offset_b = ${l3_offset_b + bias_dim};
-  % endif
+  int offset_w = ${l3_tile_dim};
 
   for(int k = 0; k < ${n_tile_W}; k++) {
     if (k < ${n_tile_W-1}) {
       // Fetch next weights
-      pi_cl_ram_read(ram, l3_W + offset_w, db[!i_db_w].w, ${weight_dim}, &req_w);
-      offset_w += ${weight_dim};
-      % if k_dim != 0:
-      pi_cl_ram_read(ram, l3_W + offset_k, db[!i_db_w].k, ${k_dim}, &req_k);
-      offset_k += ${k_dim};
-      pi_cl_ram_read(ram, l3_W + offset_l, db[!i_db_w].l, ${lambda_dim}, &req_l);
-      offset_l += ${lambda_dim};
-      % endif
-      % if bias_dim != 0:
-      pi_cl_ram_read(ram, l3_W + offset_b, db[!i_db_w].bias, ${bias_dim}, &req_bias);
-      offset_b += ${bias_dim};
-      % endif 
+      pi_cl_ram_read(ram, l3_W + offset_w, db[!i_db_w].w, ${l3_tile_dim}, &req_w);
+      offset_w += ${l3_tile_dim};
     }  
   % else:
     int k = 0;
@@ -203,13 +172,6 @@ else if (j == (${n_tile_y-1})) {
     % if n_tile_W > 1:
       // waiting for weights, lambda, and k
       pi_cl_ram_read_wait(&req_w);
-      % if k_dim != 0:
-      pi_cl_ram_read_wait(&req_k);
-      pi_cl_ram_read_wait(&req_l);
-      % endif
-      % if bias_dim != 0:
-      pi_cl_ram_read_wait(&req_bias);
-      % endif
       i_db_w = !i_db_w;
     }   
     % endif 
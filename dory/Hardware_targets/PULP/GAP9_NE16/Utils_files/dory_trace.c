@@ -0,0 +1 @@
+../../Common/Utils/dory_trace.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../Common/Utils/dory_activations_codec.c
\ No newline at end of file
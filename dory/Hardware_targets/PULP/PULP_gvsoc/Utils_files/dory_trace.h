@@ -0,0 +1 @@
+../../Common/Utils/dory_trace.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../Common/Utils/dory_weights_decoder.h
\ No newline at end of file
@@ -188,6 +188,8 @@ class DORY_node:
         node_dict["op_type"] = self.op_type
         node_dict["attribute"] = []
         added_parameters = ["name", "input_indexes", "constant_names", "output_index", "op_type"]
+        # the layers of fused nodes are not attributes of an onnx node
+        added_parameters += ["fused_chain", "unfused_nodes"]
         for key, value in self.__dict__.items():
             if not isinstance(value, np.ndarray) and not isinstance(value,str) and not isinstance(value,dict) and not isinstance(value,type(None)) and key not in added_parameters and not isinstance(value, bool):
                 node_dict["attribute"].append({"name": key, "ints": ([str(value)] if not isinstance(value,list) else [str(v) for v in value])})
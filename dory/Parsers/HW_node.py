@@ -63,6 +63,17 @@ class HW_node(DORY_node):
         self.check_sum_in = None
         self.check_sum_out = None
         self.L3_input = 0
+        # weights and activations both tiled from L3: "bands" or "weights" outer loop
+        self.L3_loop_order = "bands"
+        # depthwise input tiles transposed to CHW by the "dma" or by the "cluster", see Tiler_Conv2D_PULP
+        self.dw_input_transpose = "dma"
+        # weights tiles stored compressed in L3, see Network_planner.weights_compression_plan
+        self.compressed_weights = None
+        # activations read from and written to L3 compressed, see Network_planner.activations_compression_plan
+        self.compressed_input = None
+        self.compressed_output = None
+        # fraction of zeros in the test outputs
+        self.output_zero_fraction = None
         try:
             self.split_ints = HW_description['split_ints']
         except KeyError:
@@ -96,6 +107,10 @@ class HW_node(DORY_node):
                     else:
                         bias_memory+=weights_dim[0]*self.bias_bits/8*16
 
+            if self.fused_layers() > 1:
+                # weights and constants of fused layers are never tiled
+                self.tiling_dimensions["L{}".format(level-1)]["weight_memory"] = self.weight_memory
+                constants_memory = self.constants_memory
             self.tiling_dimensions["L{}".format(level-1)]["bias_memory"] = int(bias_memory)
             self.tiling_dimensions["L{}".format(level-1)]["constants_memory"] = int(constants_memory)
             self.tiling_dimensions["L{}".format(level-1)]["input_activation_memory"] = np.prod(self.tiling_dimensions["L{}".format(level-1)]["input_dimensions"])*self.input_activation_bits/8
@@ -179,14 +194,118 @@ class HW_node(DORY_node):
             self.l["value"] = self._to_uint8(self.l['value'].astype(np.int64).ravel(), self.constant_bits)
             self.check_sum_w += sum(self.l["value"])
 
+        if "DepthwisePointwise" in self.name:
+            self.dw_weights["value"] = self.dw_weights["value"].flatten().astype(np.uint8)
+            self.dw_k["value"] = self._to_uint8(self.dw_k['value'].astype(np.int64).ravel(), self.constant_bits)
+            self.dw_l["value"] = self._to_uint8(self.dw_l['value'].astype(np.int64).ravel(), self.constant_bits)
+            self.check_sum_w += sum(self.dw_weights["value"]) + sum(self.dw_k["value"]) + sum(self.dw_l["value"])
+
+        if "FusedGroup" in self.name:
+            for layer in self.fused_chain[:-1]:
+                if layer["op"] == "conv":
+                    layer["weights"]["value"] = layer["weights"]["value"].flatten().astype(np.uint8)
+                    layer["k"]["value"] = self._to_uint8(layer["k"]['value'].astype(np.int64).ravel(), self.constant_bits)
+                    layer["l"]["value"] = self._to_uint8(layer["l"]['value'].astype(np.int64).ravel(), self.constant_bits)
+                    self.check_sum_w += sum(layer["weights"]["value"]) + sum(layer["k"]["value"]) + sum(layer["l"]["value"])
+
+    def fused_layers(self):
+        # Number of layers of the exported network computed by this node
+        if "DepthwisePointwise" in self.name:
+            return 2
+        if "FusedGroup" in self.name:
+            return len(self.fused_chain)
+        return 1
+
+    def l3_weights_tiles(self):
+        # Number of output channels tiles of the weights read from L3
+        if "L3" not in self.tiling_dimensions or self.tiling_dimensions["L2"]["weights_dimensions"] is None:
+            return 1
+        return int(self.tiling_dimensions["L3"]["weights_dimensions"][0] / self.tiling_dimensions["L2"]["weights_dimensions"][0])
+
+    def has_weights(self):
+        # Layers whose weights blob is stored in L3 and read by the network, see layer_with_weights in network.h
+        return 'Conv' in self.name or 'FullyConnected' in self.name
+
+    def weights_blob(self):
+        # Weights, bias, k and l concatenated as they are stored in L3, padded to 4 bytes.
+        if self.compressed_weights is not None:
+            return self.compressed_weights["blob"]
+        constants = [0, 0, 0, 0]
+        for name in self.constant_names:
+            if "weight" in name:
+                constants[0] = name
+            elif "bias" in name:
+                constants[1] = name
+            elif "k" == name:
+                constants[2] = name
+            elif "l" == name:
+                constants[3] = name
+        fused = self.fused_layers() > 1
+        tensors = [self.dw_weights, self.dw_k, self.dw_l] if "DepthwisePointwise" in self.name else []
+        if "FusedGroup" in self.name:
+            for layer in self.fused_chain[:-1]:
+                if layer["op"] == "conv":
+                    tensors += [layer["weights"], layer["k"], layer["l"]]
+        tensors += [self.__dict__[constants[i]] for i in np.arange(4) if constants[i] != 0]
+        n_tiles = self.l3_weights_tiles()
+        if n_tiles > 1:
+            # weights, bias, k and l of each output channels tile one after the other,
+            # so that the L3 layer template reads a tile with a single transfer
+            chunks = [np.split(np.asarray(tensor["value"]), n_tiles) for tensor in tensors]
+            tensors = [{"value": tensor[tile]} for tile in range(n_tiles) for tensor in chunks]
+        weights = np.asarray([])
+        for tensor in tensors:
+            weights = np.concatenate((weights,tensor["value"]))
+            # a fused layer keeps each k and lambda word aligned, see tiler_dw_pw.dw_pw_weights_memory
+            # and tiler_fused_group.fused_group_weights_memory
+            while fused and len(weights) % 4 != 0:
+                weights = np.concatenate((weights, np.asarray([0])))
+        while len(weights) % 4 != 0:
+            weights = np.concatenate((weights, np.asarray([0])))
+        return weights.astype('uint8')
+
+    def compressed_weights_tiles(self):
+        '''
+        Lossless compression of the output channels tiles of the 8 bits weights read from L3,
+        expanded in L2 by all the cores with dory_weights_decode (dory_weights_decoder.h).
+        The weights of every output channel are stored with the smallest two's complement width
+        holding them all, as a stream of bits packed from the least significant one into 32 bits
+        little endian words. A tile starts with one word per channel, (offset of its stream << 4) |
+        width, and the offset of the bias, k and lambda, which follow the streams as they are.
+        Offsets are in bytes from the start of the tile, which is padded to 4 bytes.
+        Returns the compressed tiles.
+        '''
+        raw = self.weights_blob()
+        L2 = self.tiling_dimensions["L2"]
+        channels = L2["weights_dimensions"][0]
+        weights_size = int(L2["weight_memory"])
+        tile_size = weights_size + int(L2["bias_memory"]) + int(L2["constants_memory"])
+        channel_size = weights_size // channels
+        tiles = []
+        for tile in range(self.l3_weights_tiles()):
+            data = [int(v) for v in raw[tile * tile_size:(tile + 1) * tile_size]]
+            header, streams = [], b""
+            for c in range(channels):
+                w = [v - 256 if v > 127 else v for v in data[c * channel_size:(c + 1) * channel_size]]
+                bits = max([1] + [(v if v >= 0 else ~v).bit_length() + 1 for v in w])
+                header.append(((4 * (channels + 1) + len(streams)) << 4) | bits)
+                stream = "".join(format(v & ((1 << bits) - 1), "0{}b".format(bits)) for v in reversed(w))
+                streams += int(stream, 2).to_bytes((len(stream) + 31) // 32 * 4, "little")
+            header.append(4 * (channels + 1) + len(streams))
+            compressed = b"".join(word.to_bytes(4, "little") for word in header) + streams + bytes(data[weights_size:])
+            tiles.append(compressed + bytes(-len(compressed) % 4))
+        return tiles
+
     def add_checksum_activations_integer(self, load_directory, node_number, n_inputs=1):
         ###########################################################################
         ###### SECTION 4: GENERATE CHECKSUM BY USING OUT_LAYER{i}.TXT FILES  ######
         ###########################################################################
         self.check_sum_in = []
         self.check_sum_out = []
+        # a fused node reads the input of its first layer
+        input_number = node_number - self.fused_layers()
         for in_idx in range(n_inputs):
-            if node_number == 0:
+            if input_number < 0:
                 infile = 'input.txt' if n_inputs == 1 else f'input_{in_idx}.txt'
                 try:
                     try:
@@ -203,7 +322,7 @@ class HW_node(DORY_node):
                                              size=self.input_channels * self.input_dimensions[0] * self.input_dimensions[1],
                                              dtype=np.uint8)
             else:
-                infile = f'out_layer{node_number-1}.txt' if n_inputs == 1 else f'out_{in_idx}_layer{node_number-1}.txt'
+                infile = f'out_layer{input_number}.txt' if n_inputs == 1 else f'out_{in_idx}_layer{input_number}.txt'
                 try:
                     x = np.loadtxt(os.path.join(load_directory, infile), delimiter=',', dtype=np.int64, usecols=[0])
                 except ValueError:
@@ -223,6 +342,7 @@ class HW_node(DORY_node):
                 y = self._to_uint8(y.ravel(), self.output_activation_bits)
 
             self.check_sum_out.append(int(y.sum()))
+            self.output_zero_fraction = float(np.mean(y == 0))
 
     def export_to_dict(self):
         node_dict = {}
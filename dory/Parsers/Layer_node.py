@@ -142,6 +142,27 @@ class Layer_node(DORY_node):
             self.add_existing_parameter("bias_memory", int(bias_memory))
         else:
             self.add_existing_parameter("bias_memory", int(bias_memory*16))
+        if "DepthwisePointwise" in self.name:
+            # depthwise half of a fused layer: its weights are padded to a word in the weights blob
+            self.add_existing_parameter("MACs", self.MACs + int(np.prod(self.output_dimensions)*self.input_channels*np.prod(self.dw_kernel_shape)))
+            dw_weight_memory = int(self.input_channels*np.prod(self.dw_kernel_shape)*self.weight_bits/8)
+            self.add_existing_parameter("weight_memory", dw_weight_memory + (-dw_weight_memory) % 4 + self.weight_memory + (-self.weight_memory) % 4)
+            constants_memory += 2*self.input_channels*self.constant_bits/8
+        if "FusedGroup" in self.name:
+            # the input channels of the node are the ones of the first layer: MACs and weights are
+            # summed over all the fused convolutions, each weights tensor padded to a word in the weights blob
+            MACs = 0
+            weight_memory = 0
+            for layer in self.fused_chain:
+                if layer["op"] == "conv":
+                    MACs += np.prod(layer["output_dimensions"])*layer["output_channels"]*layer["input_channels"]*np.prod(layer["kernel_shape"])
+                    layer_weight_memory = int(layer["output_channels"]*layer["input_channels"]*np.prod(layer["kernel_shape"])*self.weight_bits/8)
+                    weight_memory += layer_weight_memory + (-layer_weight_memory) % 4
+            for layer in self.fused_chain[:-1]:
+                if layer["op"] == "conv":
+                    constants_memory += 2*layer["output_channels"]*self.constant_bits/8
+            self.add_existing_parameter("MACs", int(MACs))
+            self.add_existing_parameter("weight_memory", int(weight_memory))
         self.add_existing_parameter("constants_memory", int(constants_memory))
 
 
@@ -152,7 +173,12 @@ class Layer_node(DORY_node):
         node_dict["Layer_node_parameters"] = {}
         node_dict["Weights"] = {}
         for key, value in self.__dict__.items():
-            if not isinstance(value, dict) and key != "name" and key in DORY_node().__dict__.keys():
+            if key == "fused_chain":
+                # the layers of a fused node hold their weights: only their geometry is exported
+                node_dict["Layer_node_parameters"][key] = [{k: v for k, v in layer.items() if not isinstance(v, dict)} for layer in value]
+            elif key == "unfused_nodes":
+                node_dict["Layer_node_parameters"][key] = [node.name for node in value]
+            elif not isinstance(value, dict) and key != "name" and key in DORY_node().__dict__.keys():
                 node_dict["DORY_node_parameters"][key] = value
             elif not isinstance(value, dict) and key != "name":
                 node_dict["Layer_node_parameters"][key] = value
@@ -0,0 +1,630 @@
+# should work even without -*-
+# -*- coding: utf-8 -*-
+#!/bin/bash
+# Network_planner.py
+# Alessio Burrello <alessio.burrello@unibo.it>
+#
+# Copyright (C) 2019-2020 University of Bologna
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Network level plans computed by Parser_HW_to_C before the network is rendered: L2 memory,
+# weights compression, prefetch and residency, activations compression and cluster DVFS.
+
+# Libraries
+import numpy as np
+
+
+def aligned(size):
+    # L2 buffers are word aligned
+    return (size + 3) // 4 * 4
+
+
+def l3_bytes_per_second(HW_description, options):
+    # Bandwidth of the L3 memory in bytes/s: the "L3 bandwidth" option of the planner, else
+    # "bandwidth" bytes per cycle at "frequency" in the HW description, else 80 MB/s
+    L3 = HW_description["memory"]["L3"]
+    if "L3 bandwidth" in options:
+        return options["L3 bandwidth"]
+    if L3.get("bandwidth") and L3.get("frequency"):
+        return L3["bandwidth"] * L3["frequency"]
+    return 80e6
+
+
+def l3_tiled_size(node, tensor, memory):
+    # L2 footprint of a tensor as allocated by the network, doubled when it is tiled from L3.
+    # Compressed weights and activations also need the staging buffer of a compressed tile.
+    l2 = node.tiling_dimensions["L2"]
+    l3 = node.tiling_dimensions["L3"]
+    size = int(sum(l2[m] for m in memory) * (1 + int(l3[tensor] != l2[tensor])))
+    compressed = {"weights_dimensions": node.compressed_weights, "input_dimensions": node.compressed_input,
+                  "output_dimensions": node.compressed_output}.get(tensor)
+    if compressed is not None:
+        size += compressed["staging_size"]
+    return size
+
+
+def layer_l2_size(node):
+    # L2 used by a layer tiled from L3: input, output and weights
+    return l3_tiled_size(node, "input_dimensions", ["input_activation_memory"]) + \
+        l3_tiled_size(node, "output_dimensions", ["output_activation_memory"]) + \
+        l3_tiled_size(node, "weights_dimensions", ["weight_memory", "constants_memory", "bias_memory"])
+
+
+def predicted_cycles(node):
+    # Cycles of the whole layer predicted by the L2-L1 cost model, None if the layer has no cost model.
+    if getattr(node, "predicted_latency", None) is None:
+        return None
+    l3_tiles = 1
+    if node.HW_description["memory"]["levels"] > 2:
+        L3, L2 = node.tiling_dimensions["L3"], node.tiling_dimensions["L2"]
+        l3_tiles = int(np.ceil(L3["output_dimensions"][1] / L2["output_dimensions"][1]) *
+                       np.ceil(L3["output_dimensions"][0] / L2["output_dimensions"][0]))
+    return node.predicted_latency * l3_tiles
+
+
+def layer_cycles(node):
+    # Predicted cycles of the layer, or one MAC or one byte of activations per core per cycle without a cost model
+    cycles = predicted_cycles(node)
+    if cycles is None:
+        cycles = max(node.MACs, node.input_activation_memory + node.output_activation_memory) / 8
+    return cycles
+
+
+def weights_compression_plan(graph, HW_description, l2_buffer_size):
+    '''
+    Layers whose weights tiles are stored compressed in L3 (see HW_node.compressed_weights_tiles),
+    enabled by "compressed_weights" in the HW description: true, or a dictionary overriding the
+    defaults below. Only the 8 bits weights of layers tiled from L3 on the output channels are
+    candidates. Such a layer computes a tile while the next one is read, taking the longest of
+    the two; compressed, the read is shorter but all the cores then spend the decoding cycles to
+    expand the tile. A layer is compressed when this is faster and its compressed tile fits in
+    L2, in a staging buffer after the double buffer.
+    Sets node.compressed_weights of the compressed layers.
+    '''
+    compression = HW_description.get("compressed_weights", False)
+    # The GAP9 L3 template reads its weights tiles on its own
+    if not compression or HW_description["memory"]["levels"] <= 2 or HW_description["name"].startswith("PULP/GAP9"):
+        return
+    if not isinstance(compression, dict):
+        compression = {}
+    frequency = HW_description["accelerator frequency"]
+    l3_bandwidth = l3_bytes_per_second(HW_description, compression)
+    decode_cycles = compression.get("decode cycles", 6)  # per weight, on one of the 8 cores
+
+    raw_bytes, compressed_bytes, layers = 0, 0, 0
+    for node in graph:
+        if not node.has_weights() or node.fused_layers() > 1:
+            continue
+        n_tiles = node.l3_weights_tiles()
+        if n_tiles == 1 or node.weight_bits != 8:
+            continue
+        L3, L2 = node.tiling_dimensions["L3"], node.tiling_dimensions["L2"]
+        tiles = node.compressed_weights_tiles()
+        tile_size = int(L2["weight_memory"] + L2["bias_memory"] + L2["constants_memory"])
+        staging_size = aligned(2 * tile_size) - 2 * tile_size + aligned(max(len(tile) for tile in tiles))
+        if layer_l2_size(node) + staging_size > l2_buffer_size:
+            continue
+        # The "bands" loop order reads all the tiles again for every band of rows
+        reads = 1
+        if node.L3_loop_order == "bands":
+            reads = int(np.ceil(max(L3["output_dimensions"][1] / L2["output_dimensions"][1],
+                                    L3["input_dimensions"][1] / L2["input_dimensions"][1])))
+        tile_cycles = layer_cycles(node) / (n_tiles * reads)
+        tile_decode = L2["weight_memory"] * decode_cycles / 8
+        raw = max(tile_cycles / frequency, tile_size / l3_bandwidth)
+        compressed = max(tile_cycles / frequency, sum(len(tile) for tile in tiles) / n_tiles / l3_bandwidth) + tile_decode / frequency
+        if compressed >= raw:
+            continue
+        offsets = [0]
+        for tile in tiles:
+            offsets.append(offsets[-1] + len(tile))
+        node.compressed_weights = {
+            "blob": np.frombuffer(b"".join(tiles), dtype=np.uint8),
+            "offsets": offsets,
+            "staging_offset": aligned(2 * tile_size),
+            "staging_size": staging_size,
+            "decode_cycles": int(tile_decode * n_tiles * reads)}
+        raw_bytes += tile_size * n_tiles * reads
+        compressed_bytes += offsets[-1] * reads
+        layers += 1
+    print("Weights compression: {} layers, {} B read from L3 at every inference instead of {} B.".format(
+        layers, compressed_bytes, raw_bytes))
+
+
+def activations_compression_plan(graph, HW_description, l2_buffer_size):
+    '''
+    Layers whose output is written to L3 compressed and read back compressed by the next layer,
+    enabled by "compressed_activations" in the HW description: true, or a dictionary overriding
+    the defaults below. Each row of the output is stored as a bitmap of its non-zero bytes
+    followed by them, or as it is when this is not shorter, after a table with the offset of
+    every row (see dory_activations_codec.h): the next layer still reads a band of rows with a
+    single transfer. All the cores encode a band before it is written and decode it after it is
+    read, in staging buffers after the L2 double buffers of the activations.
+    Only the 8 bits outputs tiled from L3 in bands of rows, and read from L3 by the next layer
+    alone, are candidates. As for the weights, a band takes the longest of its computation and
+    its transfer, plus the coding cycles when compressed; the size of the compressed rows is
+    estimated from the zeros of the test outputs. An output is compressed when this makes the
+    two layers faster and both fit in L2 with their staging buffers.
+    Sets node.compressed_output of the producers and node.compressed_input of the consumers.
+    '''
+    compression = HW_description.get("compressed_activations", False)
+    # The GAP9 L3 template transfers its activations on its own
+    if not compression or HW_description["memory"]["levels"] <= 2 or HW_description["name"].startswith("PULP/GAP9"):
+        return
+    if not isinstance(compression, dict):
+        compression = {}
+    frequency = HW_description["accelerator frequency"]
+    l3_bandwidth = l3_bytes_per_second(HW_description, compression)
+    encode_cycles = compression.get("encode cycles", 6)  # per byte, on one core
+    decode_cycles = compression.get("decode cycles", 4)  # per byte, on one core
+
+    def bands_time(node, bands, transfer, coding):
+        # each band takes the longest of its computation and of its transfer, then it is coded
+        return bands * (max(layer_cycles(node) / bands / frequency, transfer / l3_bandwidth) + coding / frequency)
+
+    raw_bytes, compressed_bytes, layers = 0, 0, 0
+    for i in range(len(graph) - 1):
+        node, next_node = graph[i], graph[i + 1]
+        L3, L2 = node.tiling_dimensions["L3"], node.tiling_dimensions["L2"]
+        if L3["output_dimensions"] == L2["output_dimensions"] or next_node.L3_input == 0:
+            continue
+        if node.branch_out == 1 or node.branch_change == 1 or node.output_zero_fraction is None:
+            continue
+        if node.output_activation_bits != 8 or next_node.input_activation_bits != 8:
+            continue
+        # the "weights" loop order writes the output channels tiles of a band one at a time
+        if node.L3_loop_order == "weights" and node.l3_weights_tiles() > 1:
+            continue
+        rows = L3["output_dimensions"][1]
+        row_size = L3["output_dimensions"][0] * L3["output_dimensions"][2]
+        compressed_row = min(row_size, (row_size + 7) // 8 + (1 - node.output_zero_fraction) * row_size)
+
+        # rows of the bands as computed by Layer2D_template_writer.print_template_layer_L3
+        band_out = L2["output_dimensions"][1]
+        if L3["input_dimensions"][1] > L2["input_dimensions"][1]:
+            band_out = max(band_out, (L2["input_dimensions"][1] - node.kernel_shape[0] + node.strides[0]) // node.strides[0])
+        output_staging = aligned(l3_tiled_size(node, "output_dimensions", ["output_activation_memory"]))
+        output_staging += 4 * (rows + 1) + band_out * row_size - l3_tiled_size(node, "output_dimensions", ["output_activation_memory"])
+        next_L3, next_L2 = next_node.tiling_dimensions["L3"], next_node.tiling_dimensions["L2"]
+        band_in = next_L2["input_dimensions"][1]
+        if next_L3["output_dimensions"][1] > next_L2["output_dimensions"][1]:
+            band_in = max(band_in, next_L2["output_dimensions"][1] * next_node.strides[0] + next_node.kernel_shape[0] - next_node.strides[0])
+        band_in = min(band_in, rows)
+        input_staging = aligned(l3_tiled_size(next_node, "input_dimensions", ["input_activation_memory"]))
+        input_staging += 4 * (rows + 1) + band_in * row_size - l3_tiled_size(next_node, "input_dimensions", ["input_activation_memory"])
+        if layer_l2_size(node) + output_staging > l2_buffer_size or layer_l2_size(next_node) + input_staging > l2_buffer_size:
+            continue
+
+        # a core codes each row of a band
+        bands_out = int(np.ceil(rows / band_out))
+        bands_in = int(np.ceil(next_L3["output_dimensions"][1] / next_L2["output_dimensions"][1]))
+        encode = band_out * row_size * encode_cycles / min(band_out, 8)
+        decode = band_in * row_size * decode_cycles / min(band_in, 8)
+        raw = bands_time(node, bands_out, band_out * row_size, 0) + bands_time(next_node, bands_in, band_in * row_size, 0)
+        compressed = bands_time(node, bands_out, band_out * compressed_row, encode) + \
+            bands_time(next_node, bands_in, band_in * compressed_row, decode)
+        if compressed >= raw:
+            continue
+        node.compressed_output = {
+            "staging_offset": aligned(l3_tiled_size(node, "output_dimensions", ["output_activation_memory"])),
+            "staging_size": output_staging,
+            "rows": rows,
+            "row_size": row_size,
+            "l3_size": 4 * (rows + 1) + rows * row_size,
+            "l3_bytes": int(4 * (rows + 1) + rows * compressed_row),
+            "cycles": int(encode * bands_out)}
+        next_node.compressed_input = {
+            "staging_offset": aligned(l3_tiled_size(next_node, "input_dimensions", ["input_activation_memory"])),
+            "staging_size": input_staging,
+            "rows": rows,
+            "row_size": row_size,
+            "l3_bytes": int(4 * (rows + 1) + bands_in * band_in * compressed_row),
+            "cycles": int(decode * bands_in)}
+        raw_bytes += rows * row_size + bands_in * band_in * row_size
+        compressed_bytes += node.compressed_output["l3_bytes"] + next_node.compressed_input["l3_bytes"]
+        layers += 1
+    print("Activations compression: {} layers outputs, about {} B written to and read from L3 at every inference instead of {} B.".format(
+        layers, compressed_bytes, raw_bytes))
+
+
+def weights_prefetch_plan(graph, l2_buffer_size, resident_weights=None):
+    # Layers whose weights are read from L3 into L2 while the previous layer is executing.
+    # The slot is allocated by the directional allocator right after the previous layer's output,
+    # exactly where the layer would allocate its weights, so it is only planned when the previous
+    # layer leaves its output in L2 and the layer itself reads its input from it.
+    # Weights resident in L2 (see weights_residency_plan) are never read.
+    prefetch = [0] * len(graph)
+    if graph[0].HW_description['memory']['levels'] <= 2:
+        return prefetch
+    for i in range(1, len(graph)):
+        node, prev = graph[i], graph[i - 1]
+        if not node.has_weights():
+            continue
+        if resident_weights is not None and resident_weights["offset"][i] >= 0:
+            continue
+        if node.tiling_dimensions["L3"]["weights_dimensions"] != node.tiling_dimensions["L2"]["weights_dimensions"]:
+            continue
+        if node.L3_input != 0 or prev.branch_change == 1:
+            continue
+        if prev.tiling_dimensions["L3"]["output_dimensions"] != prev.tiling_dimensions["L2"]["output_dimensions"]:
+            continue
+        prev_memory = layer_l2_size(prev)
+        weights_memory = l3_tiled_size(node, "weights_dimensions", ["weight_memory", "constants_memory", "bias_memory"])
+        if prev_memory + weights_memory <= l2_buffer_size:
+            prefetch[i] = 1
+    return prefetch
+
+
+def weights_residency_plan(graph, HW_description, l2_buffer_size):
+    '''
+    Layers whose weights stay in a region of L2 reserved between network_initialize and
+    network_terminate, enabled by "resident_weights" in the HW description. They are read
+    from L3 once at initialization instead of at every inference.
+    The region is taken from the network L2 buffer, so every layer must still fit in what
+    is left: a layer needs its input, output and weights, the latter only if they are not
+    resident, plus the outputs of the previous layers still to be read by the next ones
+    (bypasses and residuals). With slack = buffer - need, a layer limits the region to its
+    slack, or to slack + its weights if they are resident. The region maximizing the L3 bytes
+    saved per inference is found by forcing resident the layers with the lowest slack, one
+    more at a time, and filling what is left with an exact subset sum over the others.
+    With "static_l2_plan", the L2 plan of what is left is computed as well, and the region is
+    shrunk by the overflow until the plan fits.
+    Only layers whose weights are not tiled from L3 are candidates.
+    Returns the offset of every layer in the region (-1 if not resident) and its size, or
+    None when residency is disabled or no layer fits.
+    '''
+    if not HW_description.get("resident_weights", False) or HW_description["memory"]["levels"] <= 2:
+        return None
+
+    inputs, consumers = activation_inputs(graph)
+
+    def output_size(j):
+        if j == -1:
+            return l3_tiled_size(graph[0], "input_dimensions", ["input_activation_memory"])
+        return l3_tiled_size(graph[j], "output_dimensions", ["output_activation_memory"])
+
+    weights, slack = [], []
+    for i, node in enumerate(graph):
+        w = l3_tiled_size(node, "weights_dimensions", ["weight_memory", "constants_memory", "bias_memory"])
+        live = sum(output_size(j) for j in consumers if j < i and j != inputs[i][0] and max(consumers[j], default=-1) >= i)
+        need = layer_l2_size(node) + live
+        candidate = node.has_weights() and \
+            node.tiling_dimensions["L3"]["weights_dimensions"] == node.tiling_dimensions["L2"]["weights_dimensions"]
+        weights.append(aligned(w) if candidate else 0)
+        slack.append(max(l2_buffer_size - need, 0))
+
+    def region(limit):
+        order = sorted(range(len(graph)), key=lambda i: slack[i])
+        best, best_layers = 0, []
+        for k in range(len(order) + 1):
+            forced = order[:k]
+            if any(weights[i] == 0 for i in forced):
+                break
+            cap = min([slack[i] + weights[i] for i in forced] + [slack[order[k]] if k < len(order) else l2_buffer_size, limit])
+            forced_size = sum(weights[i] for i in forced)
+            if forced_size > cap:
+                continue
+            # Subset sum in 4 bytes units: bit s of reachable[j] is set if s is a sum of the first j others
+            others = [i for i in order[k:] if weights[i] > 0]
+            limit_units = (cap - forced_size) // 4
+            mask = (1 << (limit_units + 1)) - 1
+            reachable = [1]
+            for i in others:
+                reachable.append((reachable[-1] | (reachable[-1] << (weights[i] // 4))) & mask)
+            total = reachable[-1].bit_length() - 1
+            if forced_size + total * 4 <= best:
+                continue
+            best, best_layers = forced_size + total * 4, list(forced)
+            for j in range(len(others), 0, -1):
+                if not (reachable[j - 1] >> total) & 1:
+                    best_layers.append(others[j - 1])
+                    total -= weights[others[j - 1]] // 4
+        if best == 0:
+            return None
+        offset, size = [-1] * len(graph), 0
+        for i in sorted(best_layers):
+            offset[i] = size
+            size += weights[i]
+        return {"offset": offset, "size": size}
+
+    resident = region(l2_buffer_size)
+    while resident is not None and HW_description.get("static_l2_plan", False):
+        plan, _ = l2_memory_placement(graph, HW_description, l2_buffer_size - resident["size"], resident)
+        # without a plan the directional allocator is used, which the slack already accounts for
+        if plan is None or plan["size"] <= l2_buffer_size - resident["size"]:
+            break
+        resident = region(resident["size"] - (plan["size"] - (l2_buffer_size - resident["size"])))
+
+    if resident is None:
+        return None
+    offset = resident["offset"]
+    print("Weights residency: {} layers, {} B of weights resident in L2, {} B read from L3 at every inference.".format(
+        sum(1 for o in offset if o >= 0), resident["size"], sum(l3_tiled_size(node, "weights_dimensions", ["weight_memory", "constants_memory", "bias_memory"])
+                                                               for i, node in enumerate(graph) if offset[i] < 0 and node.has_weights())))
+    return resident
+
+
+def input_streaming(graph):
+    # The first layer can read its input while it is still being written when it is
+    # executed from L2 by the convolution or the fused group templates, which load
+    # the input one band of rows at a time.
+    node = graph[0]
+    if node.HW_description['memory']['levels'] > 2:
+        if node.L3_input != 0:
+            return False
+        for tensor in ["input_dimensions", "output_dimensions", "weights_dimensions"]:
+            if node.tiling_dimensions["L3"][tensor] != node.tiling_dimensions["L2"][tensor]:
+                return False
+    if "FusedGroup" in node.name:
+        return True
+    return "Conv" in node.name and "DepthwisePointwise" not in node.name
+
+
+def dvfs_plan(graph, HW_description, l2_buffer_size, resident_weights=None):
+    '''
+    Cluster frequency of every layer, enabled by "dvfs" in the HW description: true, or a
+    dictionary overriding the defaults below.
+    A layer takes its predicted cluster cycles plus the L3 transfers, whose time does not
+    depend on the cluster frequency: blocking reads add to the latency, while the prefetch of
+    the next weights and the double-buffered transfers of L3-tiled layers overlap with the
+    computation. The cluster spends its leakage over the whole layer, an energy per active
+    cycle and a smaller one per cycle spent waiting for L3. At a fixed voltage, lowering the
+    frequency only saves the waiting cycles, so memory-bound layers slow down until their
+    computation hides behind the L3 transfers and compute-bound layers stay at the maximum.
+    The frequency of each layer is the one with the lowest energy within the latency slack,
+    frequency switches included. Returns None when DVFS is disabled.
+    '''
+    dvfs = HW_description.get("dvfs", False)
+    if not dvfs:
+        return None
+    if not isinstance(dvfs, dict):
+        dvfs = {}
+    f_max = HW_description["accelerator frequency"]
+    frequencies = sorted(set([f for f in dvfs.get("cluster frequencies", [f_max * k // 4 for k in range(1, 4)]) if f < f_max] + [f_max]))
+    slack = dvfs.get("latency slack", 0.05)
+    switch_latency = dvfs.get("switch latency us", 50) * 1e-6
+    leakage = dvfs.get("leakage mW", 5.0) * 1e-3
+    active_energy = dvfs.get("active nJ/cycle", 0.28) * 1e-9
+    idle_energy = dvfs.get("idle nJ/cycle", 0.05) * 1e-9
+    l3_supported = HW_description["memory"]["levels"] > 2
+    l3_bandwidth = l3_bytes_per_second(HW_description, dvfs) if l3_supported else 1
+    prefetch = weights_prefetch_plan(graph, l2_buffer_size, resident_weights)
+
+    def weights_memory(node):
+        if node.compressed_weights is not None:
+            return node.compressed_weights["offsets"][-1]
+        if node.has_weights():
+            return node.weight_memory + node.constants_memory + node.bias_memory
+        return 0
+
+    def l3_tiled(node, tensor):
+        return l3_supported and node.tiling_dimensions["L3"][tensor] != node.tiling_dimensions["L2"][tensor]
+
+    plan = {"frequency": [], "layers": []}
+    current = f_max
+    for i, node in enumerate(graph):
+        cycles = layer_cycles(node)
+        if node.compressed_weights is not None:
+            cycles += node.compressed_weights["decode_cycles"]
+        for compressed in [node.compressed_input, node.compressed_output]:
+            if compressed is not None:
+                cycles += compressed["cycles"]
+        blocking, overlapped = 0, 0
+        if l3_supported:
+            if l3_tiled(node, "weights_dimensions"):
+                overlapped += weights_memory(node)
+            elif prefetch[i] == 0 and (resident_weights is None or resident_weights["offset"][i] < 0):
+                blocking += weights_memory(node)
+            if i + 1 < len(graph) and prefetch[i + 1] == 1:
+                overlapped += weights_memory(graph[i + 1])
+            if node.compressed_input is not None:
+                overlapped += node.compressed_input["l3_bytes"]
+            elif l3_tiled(node, "input_dimensions"):
+                overlapped += node.input_activation_memory
+            if node.compressed_output is not None:
+                overlapped += node.compressed_output["l3_bytes"]
+            elif l3_tiled(node, "output_dimensions"):
+                overlapped += node.output_activation_memory
+        blocking /= l3_bandwidth
+        overlapped /= l3_bandwidth
+
+        def latency(f):
+            return blocking + max(cycles / f, overlapped)
+
+        def energy(f):
+            return leakage * latency(f) + active_energy * cycles + idle_energy * (f * latency(f) - cycles)
+
+        bound = latency(f_max) * (1 + slack)
+        best, best_energy = current, None
+        for f in frequencies:
+            switch = switch_latency if f != current else 0
+            if latency(f) + switch > bound:
+                continue
+            e = energy(f) + (leakage + idle_energy * f_max) * switch
+            if best_energy is None or e < best_energy:
+                best, best_energy = f, e
+        if best_energy is None:
+            best = f_max
+        switch = switch_latency if best != current else 0
+        plan["frequency"].append(int(best))
+        plan["layers"].append({
+            "name": node.prefixed_name,
+            "cycles": int(cycles),
+            "l3_us": (blocking + overlapped) * 1e6,
+            "latency_max_us": latency(f_max) * 1e6,
+            "latency_us": (latency(best) + switch) * 1e6,
+            "energy_max_uj": energy(f_max) * 1e6,
+            "energy_uj": (energy(best) + (leakage + idle_energy * f_max) * switch) * 1e6,
+        })
+        current = best
+    return plan
+
+
+def activation_inputs(graph):
+    # Activation inputs of every node: the main input (-1 is the network input, None if there is
+    # none) and the list of the other ones, the bypasses. Also returns the consumers of the output
+    # of every node, and of the network input as -1.
+    producer = {node.output_index: i for i, node in enumerate(graph)}
+    network_input = graph[0].input_indexes[0]
+    inputs = []
+    for i, node in enumerate(graph):
+        ins = [-1 if idx == network_input else producer[idx] for idx in node.input_indexes
+               if idx == network_input or idx in producer]
+        main = i - 1 if (i - 1) in ins else ins[0] if len(ins) > 0 else None
+        inputs.append((main, [j for j in ins if j != main]))
+    consumers = {j: [c for c in range(len(graph)) if j == inputs[c][0] or j in inputs[c][1]] for j in range(-1, len(graph))}
+    return inputs, consumers
+
+
+def l2_memory_plan(graph, HW_description, budget, resident_weights=None):
+    # Static L2 plan: fixed offsets in the network L2 buffer for every activation, weight and bypass
+    # buffer, computed from their liveness, see l2_memory_placement.
+    # Returns None when the network can't be planned within the budget, in which case the directional
+    # allocator is used.
+    if not HW_description.get("static_l2_plan", False):
+        return None
+    print("\nPlanning the L2 memory.")
+    plan, reason = l2_memory_placement(graph, HW_description, budget, resident_weights)
+    if plan is not None and plan["size"] > budget:
+        plan, reason = None, "peak memory {} exceeds the L2 budget {}".format(plan["size"], budget)
+    if plan is None:
+        print("L2 memory planner: {}, falling back to the directional allocator.".format(reason))
+        return None
+    print("L2 memory planner: peak memory {} B out of {} B, {} of {} residuals kept in L2.".format(
+        plan["size"], budget, plan["residuals"] - sum(plan["spill"]), plan["residuals"]))
+    return plan
+
+
+def l2_memory_placement(graph, HW_description, budget, resident_weights=None):
+    # Tensors are placed greedily, biggest first, at the lowest offset not overlapping any tensor alive
+    # at the same time. Residuals (outputs consumed after the next layer) stay in L2 for their whole
+    # lifetime when the plan fits the budget; otherwise the biggest ones are spilled to L3 one by one
+    # and read back by their consumers.
+    # Returns the plan, whose size is its peak memory, above the budget if it can't fit even with all
+    # the residuals spilled, or None and the reason why the network can't be planned.
+    l3_supported = HW_description["memory"]["levels"] > 2
+    # The application loads (or preprocesses) the network input at the beginning of the buffer,
+    # unless it always passes its own input buffer ("bound_l2_input" in the HW description)
+    input_in_buffer = l3_supported and not HW_description.get("bound_l2_input", False)
+    prefetch = weights_prefetch_plan(graph, budget, resident_weights)
+
+    def size(node, tensor, memory):
+        if l3_supported:
+            return l3_tiled_size(node, tensor, memory)
+        return int(sum(node.tiling_dimensions["L2"][m] for m in memory))
+
+    def output_in_l3(j):
+        return l3_supported and graph[j].tiling_dimensions["L3"]["output_dimensions"] != graph[j].tiling_dimensions["L2"]["output_dimensions"]
+
+    def input_in_l3(i):
+        return l3_supported and i > 0 and graph[i].L3_input != 0
+
+    def unsupported(reason):
+        return None, reason
+
+    # Main input and bypass of every node
+    inputs, consumers = activation_inputs(graph)
+    for i, node in enumerate(graph):
+        main, bypasses = inputs[i]
+        if main is None or len(bypasses) > 1:
+            return unsupported("node {} has {} activation inputs".format(node.name, int(main is not None) + len(bypasses)))
+    inputs = [(main, bypasses[0] if len(bypasses) > 0 else None) for main, bypasses in inputs]
+
+    for i, node in enumerate(graph):
+        main, bypass = inputs[i]
+        if output_in_l3(i) and (consumers[i] != [i + 1] or not input_in_l3(i + 1) or inputs[i + 1][0] != i):
+            return unsupported("output of node {} is in L3 and not consumed by the next layer only".format(node.name))
+        if input_in_l3(i) and (main != i - 1 or not output_in_l3(main)):
+            return unsupported("input of node {} is in L3 but not produced by the previous layer".format(node.name))
+        if bypass is not None and ((bypass == -1 and not l3_supported) or (bypass != -1 and output_in_l3(bypass))):
+            return unsupported("bypass of node {} is not in the L2 buffer".format(node.name))
+
+    # Residuals that can be spilled to L3 instead of being kept in L2
+    residuals = [j for j in range(len(graph)) if l3_supported and not output_in_l3(j) and any(c > j + 1 for c in consumers[j])]
+
+    def place(spilled):
+        # Liveness: tensor -> [size, first layer, last layer]
+        tensors = {}
+        def use(key, tensor_size, layer):
+            if key in tensors:
+                tensors[key][0] = max(tensors[key][0], tensor_size)
+                tensors[key][1] = min(tensors[key][1], layer)
+                tensors[key][2] = max(tensors[key][2], layer)
+            else:
+                tensors[key] = [tensor_size, layer, layer]
+
+        def activation(j, c):
+            # A spilled residual is read back from L3 in a buffer of its own by every consumer after the next layer
+            return ("reload", j, c) if j in spilled and c > j + 1 else ("act", j)
+
+        for i, node in enumerate(graph):
+            main, bypass = inputs[i]
+            if output_in_l3(i):
+                # Only the L2 tiles of the output
+                use(("out", i), size(node, "output_dimensions", ["output_activation_memory"]), i)
+            else:
+                use(("act", i), size(node, "output_dimensions", ["output_activation_memory"]), i)
+
+            if input_in_l3(i):
+                use(("in", i), size(node, "input_dimensions", ["input_activation_memory"]), i)
+            elif main != -1 or input_in_buffer:
+                use(activation(main, i), size(node, "input_dimensions", ["input_activation_memory"]), i)
+            if bypass is not None and (bypass != -1 or input_in_buffer):
+                # Sized by its producer
+                use(activation(bypass, i), tensors[("act", bypass)][0], i)
+
+            resident = resident_weights is not None and resident_weights["offset"][i] >= 0
+            if l3_supported and node.has_weights() and not resident:
+                weights_size = size(node, "weights_dimensions", ["weight_memory", "constants_memory", "bias_memory"])
+                use(("w", i), weights_size, i)
+                if prefetch[i] == 1:
+                    # Read while the previous layer is running
+                    use(("w", i), weights_size, i - 1)
+
+        # The network input is pinned at the beginning of the buffer, where the application loads it
+        order = sorted(tensors, key=lambda key: (key != ("act", -1), -tensors[key][0]))
+        placed = {}
+        for key in order:
+            tensor_size, first, last = tensors[key]
+            offset = 0
+            alive = sorted((placed[k], aligned(tensors[k][0])) for k in placed
+                           if tensors[k][1] <= last and first <= tensors[k][2])
+            for other_offset, other_size in alive:
+                if offset + aligned(tensor_size) <= other_offset:
+                    break
+                offset = max(offset, other_offset + other_size)
+            placed[key] = offset
+        peak = max(placed[k] + aligned(tensors[k][0]) for k in placed)
+        return peak, placed, activation
+
+    spilled = []
+    peak, placed, activation = place(spilled)
+    # Spill the residuals occupying the most memory over time first
+    candidates = sorted(residuals, key=lambda j: -size(graph[j], "output_dimensions", ["output_activation_memory"]) * (max(consumers[j]) - j))
+    while peak > budget and len(candidates) > 0:
+        spilled.append(candidates.pop(0))
+        peak, placed, activation = place(spilled)
+
+    plan = {"size": peak, "input_in_buffer": input_in_buffer, "input": [], "output": [], "weights": [], "bypass": [], "residuals": len(residuals),
+            "spill": [1 if j in spilled else 0 for j in range(len(graph))], "reload_input": [], "reload_bypass": []}
+    # -2 marks the network input, read wherever the application placed it
+    for i in range(len(graph)):
+        main, bypass = inputs[i]
+        plan["input"].append(-2 if main == -1 else placed.get(("in", i), placed.get(activation(main, i), -1)))
+        plan["output"].append(placed.get(("out", i), placed.get(("act", i), -1)))
+        plan["weights"].append(placed.get(("w", i), -1))
+        plan["bypass"].append(-1 if bypass is None else -2 if bypass == -1 else placed[activation(bypass, i)])
+        plan["reload_input"].append(main if activation(main, i)[0] == "reload" else -1)
+        plan["reload_bypass"].append(bypass if bypass is not None and activation(bypass, i)[0] == "reload" else -1)
+    return plan, None
@@ -44,10 +44,15 @@ class Parser_DORY_to_HW:
 
     def mapping_to_HW_nodes(self):
         print("\nBackend: Matching patterns from generated DORY ONNX to HW Nodes.")
-        for i, node in enumerate(self.DORY_Graph):
-            string_matching, indexes = self.pattern_matching(node, i)
-            if isinstance(string_matching, str):
-                self.DORY_Graph = self.Pattern_rewriter(self.DORY_Graph).execute(string_matching, indexes)
+        # Repeated until the graph does not change, since a rule can match nodes
+        # produced by other rules (e.g. DepthwisePointwise on BNReluConvolution).
+        n_nodes = 0
+        while n_nodes != len(self.DORY_Graph):
+            n_nodes = len(self.DORY_Graph)
+            for i, node in enumerate(self.DORY_Graph):
+                string_matching, indexes = self.pattern_matching(node, i)
+                if isinstance(string_matching, str):
+                    self.DORY_Graph = self.Pattern_rewriter(self.DORY_Graph).execute(string_matching, indexes)
 
     def check_graph(self):
         for node in self.DORY_Graph:
@@ -184,9 +189,12 @@ class Parser_DORY_to_HW:
 
     def formatting_constant_parameters_tensors_and_activations(self):
         print("\nDORY Backend: Formatting constants and adding checksums")
+        # fused nodes stand for several layers of the exported network
+        fused = 0
         for i, node in enumerate(self.DORY_Graph):            
+            fused += node.fused_layers() - 1
             node.add_checksum_w_integer()           
-            node.add_checksum_activations_integer(self.network_directory, i, self.n_inputs)
+            node.add_checksum_activations_integer(self.network_directory, i + fused, self.n_inputs)
 
     def full_graph_parsing(self):
         print("#####################################################")
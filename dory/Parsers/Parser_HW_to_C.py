@@ -19,12 +19,14 @@
 # limitations under the License.
 
 # Libraries
+import csv
 import numpy as np
 import os
 
 # DORY modules
 import dory.Utils.Templates_writer.Network_template_writer as Network_writer
 import dory.Utils.Templates_writer.Makefile_template_writer as Makefile_writer
+import dory.Parsers.Network_planner as Network_planner
 
 from dory.Parsers.HW_node import HW_node
 
@@ -51,6 +53,18 @@ class Parser_HW_to_C:
 
     def mapping_network_to_C_file(self):
         print("\nGenerating the .c file of the network.")
+        l2_buffer_size = self.HW_description["memory"]["L2"]["dimension"] - self.config_file["code reserved space"]
+        Network_planner.weights_compression_plan(self.HWgraph, self.HW_description, l2_buffer_size)
+        Network_planner.activations_compression_plan(self.HWgraph, self.HW_description, l2_buffer_size)
+        self.resident_weights = Network_planner.weights_residency_plan(self.HWgraph, self.HW_description, l2_buffer_size)
+        if self.resident_weights is not None:
+            l2_buffer_size -= self.resident_weights["size"]
+        self.dvfs_plan = Network_planner.dvfs_plan(
+            self.HWgraph,
+            self.HW_description,
+            l2_buffer_size,
+            self.resident_weights)
+        l2_plan = Network_planner.l2_memory_plan(self.HWgraph, self.HW_description, l2_buffer_size, self.resident_weights)
         Network_writer.print_template_network(
             self.HWgraph,
             self.HW_description,
@@ -60,7 +74,12 @@ class Parser_HW_to_C:
             self.app_directory,
             self.inc_dir_rel,
             self.src_dir_rel,
-            self.tmpl_dir)
+            self.tmpl_dir,
+            l2_plan=l2_plan,
+            dvfs_plan=self.dvfs_plan,
+            resident_weights=self.resident_weights,
+            prefetch_weights=Network_planner.weights_prefetch_plan(self.HWgraph, l2_buffer_size, self.resident_weights),
+            stream_input=Network_planner.input_streaming(self.HWgraph))
 
     def mapping_makefile(self):
         print("\nGenerating the Makefile.")
@@ -81,6 +100,10 @@ class Parser_HW_to_C:
                 return "add_layer_1D_template.c"
             else:
                 return "layer_L2_c_addition_template.c"
+        elif "DepthwisePointwise" in node.name:
+            return "layer_L2_c_dw_pw_template.c"
+        elif "FusedGroup" in node.name:
+            return "layer_L2_c_fused_group_template.c"
         else:
             return "layer_L2_c_conv_template.c"
 
@@ -108,27 +131,27 @@ class Parser_HW_to_C:
 
     def create_hex_weights_files(self):
         print("\nGenerating .hex weight files.")
+        packed = self.HW_description.get("packed_weights", False)
+        blobs = []
         for i, node in enumerate(self.HWgraph):
-            constants = [0, 0, 0, 0]
-            for name in node.constant_names:
-                if "weight" in name:
-                    constants[0] = name
-                elif "bias" in name:
-                    constants[1] = name
-                elif "k" == name:
-                    constants[2] = name
-                elif "l" == name:
-                    constants[3] = name
-            weights = np.asarray([])
-            for i in np.arange(4):
-                if constants[i]!= 0:
-                    weights = np.concatenate((weights,node.__dict__[constants[i]]["value"]))
-            while len(weights) % 4 != 0:
-                weights = np.concatenate((weights, np.asarray([0])))
-            if weights.shape[0] != 0:
+            # Same layers and order as the weights files of network.c
+            if not node.has_weights():
+                continue
+            weights = node.weights_blob()
+            if weights.shape[0] == 0:
+                print("  Weights ERROR: layer {} has no weights to store in L3. Exiting...".format(node.prefixed_name))
+                os._exit(0)
+            if packed:
+                blobs.append(weights)
+            else:
                 string_layer = node.prefixed_name + "_weights.hex"
                 save_s = os.path.join(self.hex_dir, string_layer)
-                weights.astype('uint8').tofile(save_s)
+                weights.tofile(save_s)
+        if packed and len(blobs) > 0:
+            # All layers in a single blob, so that the weights are streamed to L3 in one pass at boot.
+            # The per-layer offsets are generated in network.h.
+            save_s = os.path.join(self.hex_dir, self.HWgraph[0].prefix + "weights.hex")
+            np.concatenate(blobs).tofile(save_s)
 
     def create_hex_input(self):
         print("\nGenerating .hex input file.")
@@ -154,6 +177,38 @@ class Parser_HW_to_C:
             save_s = os.path.join(self.hex_dir, string_layer)
             x_in.astype('uint8').tofile(save_s)
 
+    def create_perf_model_file(self):
+        # Cycles predicted by the L2-L1 cost model, in the same format as scripts/perf2csv.py
+        # so that they can be checked against a PERF_LAYER run with scripts/perf_model_check.py.
+        rows = []
+        for node in self.HWgraph:
+            latency = Network_planner.predicted_cycles(node)
+            if latency is None:
+                continue
+            rows.append([node.prefixed_name, latency, node.MACs, "{:.2f}".format(node.MACs / latency)])
+        if len(rows) == 0:
+            return
+        print("\nGenerating perf_model.csv.")
+        with open(os.path.join(self.app_directory, "perf_model.csv"), "w") as f:
+            csv.writer(f).writerows([["Name", "Latency", "Ops", "Perf"]] + rows)
+
+    def create_dvfs_plan_file(self):
+        # Predicted latency and cluster energy of every layer with the DVFS plan and at the maximum frequency,
+        # see Network_planner.dvfs_plan.
+        if self.dvfs_plan is None:
+            return
+        print("\nGenerating dvfs_plan.csv.")
+        rows = [["Name", "Cycles", "L3 us", "Frequency", "Latency max us", "Latency us", "Energy max uJ", "Energy uJ"]]
+        for frequency, layer in zip(self.dvfs_plan["frequency"], self.dvfs_plan["layers"]):
+            rows.append([layer["name"], layer["cycles"], "{:.1f}".format(layer["l3_us"]), frequency,
+                         "{:.1f}".format(layer["latency_max_us"]), "{:.1f}".format(layer["latency_us"]),
+                         "{:.2f}".format(layer["energy_max_uj"]), "{:.2f}".format(layer["energy_uj"])])
+        totals = [sum(layer[key] for layer in self.dvfs_plan["layers"]) for key in ["latency_max_us", "latency_us", "energy_max_uj", "energy_uj"]]
+        rows.append(["Total", "", "", "", "{:.1f}".format(totals[0]), "{:.1f}".format(totals[1]), "{:.2f}".format(totals[2]), "{:.2f}".format(totals[3])])
+        print("  Latency {:.1f} us -> {:.1f} us, cluster energy {:.2f} uJ -> {:.2f} uJ".format(*totals))
+        with open(os.path.join(self.app_directory, "dvfs_plan.csv"), "w") as f:
+            csv.writer(f).writerows(rows)
+
     @property
     def src_dir(self):
         return os.path.join(self.app_directory, self.src_dir_rel)
@@ -198,5 +253,7 @@ class Parser_HW_to_C:
         self.copy_utils_files()
         self.create_hex_weights_files()
         self.create_hex_input()
+        self.create_perf_model_file()
+        self.create_dvfs_plan_file()
         print("Done!")
 
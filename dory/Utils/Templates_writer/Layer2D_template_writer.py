@@ -91,6 +91,8 @@ def print_template_layer_L3(node):
     tk['n_tile_W'] = factor_ch_out
     tk['n_tile_x'] = factor_h_in
     tk['n_tile_y'] = factor_h_out
+    tk['n_tile_h'] = max(factor_h_in, factor_h_out)
+    tk['l3_loop_order'] = node.L3_loop_order
     tk['verbose'] = False
     if tk['padding'] > 0:
         tk['func_name'] = [node.prefixed_name + "_L2", node.prefixed_name + "_L2_p_t", node.prefixed_name + "_L2_p_b"]
@@ -109,21 +111,6 @@ def print_template_layer_L3(node):
 
     tk['has_bias'] = int(len([1 for name in node.constant_names if "bias" in name])>0)
 
-    offset = 0
-    tk['l3_offset_w'] = offset
-    offset += node.tiling_dimensions["L3"]["weight_memory"]
-
-    if tk['has_bias'] == 1:
-        tk['l3_offset_b'] = offset
-        offset += node.tiling_dimensions["L3"]["bias_memory"]
-
-    if not isinstance(node.tiling_dimensions["L2"]["constants_memory"], type(None)):
-        tk['l3_offset_k'] = offset
-        offset += int(node.tiling_dimensions["L3"]["constants_memory"] / 2)
-
-        tk['l3_offset_l'] = offset
-        offset += int(node.tiling_dimensions["L3"]["constants_memory"] / 2)
-
     tk['weight_dim'] = int( node.tiling_dimensions["L2"]["weight_memory"] )
     if tk['has_bias'] == 1:
         tk['bias_dim'] = node.tiling_dimensions["L2"]["bias_memory"]
@@ -135,7 +122,34 @@ def print_template_layer_L3(node):
     else:
         tk['lambda_dim'] = 0
         tk['k_dim'] = 0
+    # weights, bias, k and lambda of an output channels tile, contiguous in L3 (see HW_node.weights_blob) and in L2
+    tk['l3_tile_dim'] = tk['weight_dim'] + tk['bias_dim'] + tk['k_dim'] + tk['lambda_dim']
+    # compressed weights tiles, see Network_planner.weights_compression_plan
+    tk['compressed_weights'] = node.compressed_weights is not None
+    if tk['compressed_weights']:
+        tk['w_tile_offset'] = node.compressed_weights["offsets"]
+        tk['w_staging_offset'] = node.compressed_weights["staging_offset"]
+        tk['w_channel_size'] = tk['weight_dim'] // n_out_L2
+        tk['w_tail_dim'] = tk['l3_tile_dim'] - tk['weight_dim']
+    # compressed activations in L3, see Network_planner.activations_compression_plan
+    tk['compressed_input'] = node.compressed_input is not None
+    if tk['compressed_input']:
+        tk['x_staging_offset'] = node.compressed_input["staging_offset"]
+        tk['x_rows'] = node.compressed_input["rows"]
+        tk['x_row_size'] = node.compressed_input["row_size"]
+    tk['compressed_output'] = node.compressed_output is not None
+    if tk['compressed_output']:
+        tk['y_staging_offset'] = node.compressed_output["staging_offset"]
+        tk['y_rows'] = node.compressed_output["rows"]
+        tk['y_row_size'] = node.compressed_output["row_size"]
     tk['dim_out'] = int( n_out_L2 * w_out_L2 * h_out_L2 * node.output_activation_bits / 8 )
+    # L2 output buffer of a band: all the output channels, but the tile of the "weights" loop order
+    if factor_ch_out > 1 and factor_h_out > 1 and node.L3_loop_order == "bands":
+        tk['dim_out_band'] = tk['dim_out'] * factor_ch_out
+    else:
+        tk['dim_out_band'] = tk['dim_out']
+    tk['y_ch_byte'] = int( n_out * node.output_activation_bits / 8 )
+    tk['y_ch_tile_byte'] = int( n_out_L2 * node.output_activation_bits / 8 )
     tk['dim_in'] = int( n_in_L2 * w_in_L2 * h_in_L2 * node.input_activation_bits / 8 )
 
     tk['verbose_log'] = ""
@@ -254,7 +268,10 @@ def print_template_layer(node, layer_type, double_buffering = 2):
     ################################################################################
 
     tk['nof'] = n_out
-    if node.HW_description['memory']['levels'] > 2:
+    if node.HW_description['memory']['levels'] > 2 and node.L3_loop_order == "weights" and node.tiling_dimensions["L3"]["output_dimensions"][1] > node.tiling_dimensions["L2"]["output_dimensions"][1]:
+        # each weights tile writes its own band of output channels, see loop_order_conv2d_L3
+        tk['factor'] = 1
+    elif node.HW_description['memory']['levels'] > 2:
         tk['factor'] = node.tiling_dimensions["L3"]["output_dimensions"][0] / n_out
     else:
         tk['factor'] = 1
@@ -424,10 +441,17 @@ def print_template_layer(node, layer_type, double_buffering = 2):
         buffer_l1_all = W_buffer_size + x_buffer_size + y_buffer_size + tk['k_tile_size_byte'] + tk['lambda_tile_size_byte'] + 40 + tk['b_size_byte']
         tk['im2col_dim'] = (8 * (fs1 * (tile_h_in + padding_bottom + padding_top) + fs1)) * int( 8 / min(ds_x, ds_y, ds_W))
     elif "Addition" in node.name:
-        buffer_l1_all = x_buffer_size * tk['double_buffering'] + y_buffer_size + tk['k_tile_size_byte'] + tk['lambda_tile_size_byte'] + 40 + tk['b_size_byte']
+        # both inputs, see l1_x2_offset
+        buffer_l1_all = x_buffer_size * 2 + y_buffer_size + tk['k_tile_size_byte'] + tk['lambda_tile_size_byte'] + 40 + tk['b_size_byte']
     elif "Pool" in node.name:
         buffer_l1_all = x_buffer_size + y_buffer_size + tk['k_tile_size_byte'] + tk['lambda_tile_size_byte'] + 40 + tk['b_size_byte']
     tk['buffer_l1_all'] = buffer_l1_all
+    # HWC staging buffer of the depthwise input tiles transposed by the cluster, after im2col and
+    # the weights transposition buffer
+    tk['dw_cluster_transpose'] = DW == 1 and node.dw_input_transpose == "cluster"
+    if tk['dw_cluster_transpose']:
+        pwt_dim = 8 * fs1 * fs2 * int(8 / min(ds_x, ds_y, ds_W))
+        tk['l1_x_hwc_offset'] = (buffer_l1_all + tk['im2col_dim'] + pwt_dim + 3) // 4 * 4
 
     tk['conv1d'] = node.conv1d
     tk['dilations'] = node.dilations
@@ -435,3 +459,187 @@ def print_template_layer(node, layer_type, double_buffering = 2):
     tk['verbose_log'] = l
 
     return tk
+
+def print_template_layer_dw_pw(node, layer_type, double_buffering = 2):
+    # Fused depthwise + pointwise layer: the depthwise geometry is in the dw_* attributes,
+    # the pointwise is always 1x1 with stride 1 and no padding. Only output rows are tiled.
+    ks =      node.dw_kernel_shape
+    s =       node.dw_strides
+    p =       node.dw_pads
+    padding_top = p[0]; padding_left = p[1]; padding_bottom = p[2]; padding_right = p[3];
+    conv_overlap1 = 2 * (ks[0] // 2) + ks[0] % 2 - 1 - (s[0] - 1)
+    conv_overlap2 = 2 * (ks[1] // 2) + ks[1] % 2 - 1 - (s[1] - 1)
+    tk = OrderedDict([])
+    tk['ULTRA_VERBOSE'] = False
+    tk['verbose_log'] = ""
+    tk['node'] = node
+    tk['sdk'] = node.HW_description["software development kit"]["name"]
+    tk['optional_type'] = layer_type
+    tk['func_name'] = node.prefixed_name
+    tk['type'] = f"{node.input_activation_type}8_t"
+    tk['conv_overlap1'] = conv_overlap1
+    tk['conv_overlap2'] = conv_overlap2
+    tk['padding_top'] = padding_top
+    tk['padding_bottom'] = padding_bottom
+    tk['padding_left'] = padding_left
+    tk['padding_right'] = padding_right
+    tk['stride'] = s[0]
+    tk['fs1'] = ks[0]
+    tk['fs2'] = ks[1]
+    tk['act_dim_bit'] = node.constant_bits
+    tk['dw_out_shift'] = node.dw_outshift["value"]
+
+    n_in       = node.tiling_dimensions["L2"]["input_dimensions"][0]
+    h_in       = node.tiling_dimensions["L2"]["input_dimensions"][1]
+    w_in       = node.tiling_dimensions["L2"]["input_dimensions"][2]
+    tile_h_in  = node.tiling_dimensions["L1"]["input_dimensions"][1]
+    n_out      = node.tiling_dimensions["L2"]["output_dimensions"][0]
+    h_out      = node.tiling_dimensions["L2"]["output_dimensions"][1]
+    w_out      = node.tiling_dimensions["L2"]["output_dimensions"][2]
+    tile_h_out = node.tiling_dimensions["L1"]["output_dimensions"][1]
+    ds_x       = node.input_activation_bits
+    ds_y       = node.output_activation_bits
+    ds_act     = node.constant_bits
+
+    tk['double_buffering'] = double_buffering
+    tk['nif'] = n_in
+    tk['nof'] = n_out
+    # x parameters
+    tk['x_h'] = h_in
+    tk['x_w'] = w_in
+    tk['x_data_size_byte'] = ds_x
+    tk['x_tile_size_h'] = tile_h_in
+    tk['x_tile_size_byte'] = int(math.ceil(ds_x * n_in * tile_h_in * w_in / 8.0))
+    tk['x_stride_w_byte'] = int(math.ceil(w_in * n_in * ds_x / 8.0))
+    tk['x_stride_c_byte'] = int(math.ceil(n_in * ds_x / 8.0))
+    tk['x_length_nif_byte'] = int(math.ceil(n_in * ds_x / 8.0))
+    # y parameters
+    tk['y_h'] = h_out
+    tk['y_w'] = w_out
+    tk['y_data_size_byte'] = ds_y
+    tk['y_tile_size_h'] = tile_h_out
+    tk['y_tile_size_byte'] = int(math.ceil(n_out * tile_h_out * w_out * ds_y / 8.0))
+    tk['y_stride_w_byte'] = int(math.ceil(w_out * n_out * ds_y / 8.0))
+    tk['y_stride_c_byte'] = int(math.ceil(n_out * ds_y / 8.0))
+    tk['y_length_nof_byte'] = int(math.ceil(n_out * ds_y / 8.0))
+    tk['tile_dim_h'] = max(int(math.ceil(float(h_out) / float(tile_h_out))), 1)
+    # last tile
+    tk['y_tile_size_h_last'] = h_out % tile_h_out if (h_out % tile_h_out) > 0 else tile_h_out
+    tk['x_tile_size_h_last'] = tk['y_tile_size_h_last'] * s[0] + ks[0] - s[0] - (padding_bottom - ((h_in + padding_bottom + padding_top) - (h_out* s[0] + ks[0] - s[0])))
+    if tk['x_tile_size_h_last'] > tk['x_tile_size_h']:
+        tk['x_tile_size_h_last'] = tk['x_tile_size_h']
+
+    # weights blob, laid out as in HW_node.weights_blob and copied once in L1
+    dw_W_size_byte = int(math.ceil(n_in * ks[0] * ks[1] / 4.0)) * 4
+    pw_W_size_byte = int(math.ceil(n_in * n_out / 4.0)) * 4
+    tk['W_size_byte'] = int(node.tiling_dimensions["L2"]["weight_memory"] + node.tiling_dimensions["L2"]["constants_memory"])
+    tk['off_dw_k'] = dw_W_size_byte
+    tk['off_dw_lambda'] = tk['off_dw_k'] + int(n_in * ds_act / 8)
+    tk['off_pw_W'] = tk['off_dw_lambda'] + int(n_in * ds_act / 8)
+    tk['off_pw_k'] = tk['off_pw_W'] + pw_W_size_byte
+    tk['off_pw_lambda'] = tk['off_pw_k'] + int(n_out * ds_act / 8)
+
+    # l1 parameters
+    x_buffer_size = tk['x_tile_size_byte'] * (1 if tk['tile_dim_h'] == 1 else double_buffering)
+    y_buffer_size = tk['y_tile_size_byte'] * (1 if tk['tile_dim_h'] == 1 else double_buffering)
+    mid_buffer_size = int(math.ceil(n_in * tile_h_out * w_out * ds_y / 8.0))
+    tk['l1_x_offset'] = 0
+    tk['l1_y_offset'] = x_buffer_size + 8
+    tk['l1_mid_offset'] = tk['l1_y_offset'] + y_buffer_size + 8
+    tk['l1_W_offset'] = tk['l1_mid_offset'] + mid_buffer_size + 8
+    tk['buffer_l1_all'] = tk['l1_W_offset'] + tk['W_size_byte'] + 8
+    tk['im2col_dim'] = 8 * (ks[0] * (tile_h_in + padding_bottom + padding_top) + ks[0])
+
+    l = ""
+    for k, v in tk.items():
+        l += f"// {k.ljust(30)} {v}\n"
+    tk['verbose_log'] = l
+
+    return tk
+
+def print_template_layer_fused_group(node, layer_type, double_buffering = 2):
+    # Group of fused layers: every band of output rows of the last layer is computed end-to-end in L1.
+    # The rows computed by each layer for each band, halos included, are precomputed as in the tiler.
+    from dory.Hardware_targets.PULP.Common.Tiler.tiler_fused_group import fused_group_bands
+    layers = node.fused_chain
+    tk = OrderedDict([])
+    tk['ULTRA_VERBOSE'] = False
+    tk['verbose_log'] = ""
+    tk['node'] = node
+    tk['sdk'] = node.HW_description["software development kit"]["name"]
+    tk['optional_type'] = layer_type
+    tk['func_name'] = node.prefixed_name
+    tk['type'] = f"{node.input_activation_type}8_t"
+    tk['act_dim_bit'] = node.constant_bits
+
+    n_in       = node.tiling_dimensions["L2"]["input_dimensions"][0]
+    w_in       = node.tiling_dimensions["L2"]["input_dimensions"][2]
+    tile_h_in  = node.tiling_dimensions["L1"]["input_dimensions"][1]
+    n_out      = node.tiling_dimensions["L2"]["output_dimensions"][0]
+    w_out      = node.tiling_dimensions["L2"]["output_dimensions"][2]
+    tile_h_out = node.tiling_dimensions["L1"]["output_dimensions"][1]
+    ds_x       = node.input_activation_bits
+    ds_y       = node.output_activation_bits
+    ds_act     = node.constant_bits
+    bands = fused_group_bands(layers, tile_h_out)
+
+    tk['double_buffering'] = double_buffering
+    tk['nif'] = n_in
+    tk['nof'] = n_out
+    tk['x_w'] = w_in
+    tk['x_data_size_byte'] = ds_x
+    tk['x_tile_size_byte'] = int(math.ceil(ds_x * n_in * tile_h_in * w_in / 8.0))
+    tk['x_stride_w_byte'] = int(math.ceil(w_in * n_in * ds_x / 8.0))
+    tk['x_stride_c_byte'] = int(math.ceil(n_in * ds_x / 8.0))
+    tk['y_w'] = w_out
+    tk['y_data_size_byte'] = ds_y
+    tk['y_tile_size_h'] = tile_h_out
+    tk['y_tile_size_byte'] = int(math.ceil(n_out * tile_h_out * w_out * ds_y / 8.0))
+    tk['y_stride_w_byte'] = int(math.ceil(w_out * n_out * ds_y / 8.0))
+    tk['y_stride_c_byte'] = int(math.ceil(n_out * ds_y / 8.0))
+    tk['tile_dim_h'] = len(bands)
+    # per band: first input row of the group, then (input rows, p_t, p_b, output rows) of every layer
+    tk['x_band_start'] = [band[0][0] for band in bands]
+    tk['bands'] = [[entry[1:] for entry in band] for band in bands]
+
+    # weights blob, laid out as in HW_node.weights_blob and copied once in L1
+    x_buffer_size = tk['x_tile_size_byte'] * (1 if len(bands) == 1 else double_buffering)
+    y_buffer_size = tk['y_tile_size_byte'] * (1 if len(bands) == 1 else double_buffering)
+    tk['l1_x_offset'] = 0
+    tk['l1_y_offset'] = x_buffer_size + 8
+    offset = tk['l1_y_offset'] + y_buffer_size + 8
+    W_offset = 0
+    tk['layers'] = []
+    for i, layer in enumerate(layers):
+        layer_tk = {}
+        layer_tk['op'] = layer['op']
+        layer_tk['fs1'], layer_tk['fs2'] = layer['kernel_shape']
+        layer_tk['stride'] = layer['strides'][0]
+        layer_tk['padding_left'] = layer['pads'][1]
+        layer_tk['padding_right'] = layer['pads'][3]
+        layer_tk['nif'] = layer['input_channels']
+        layer_tk['nof'] = layer['output_channels']
+        layer_tk['x_w'] = layer['input_dimensions'][1]
+        layer_tk['y_w'] = layer['output_dimensions'][1]
+        if i < len(layers) - 1:
+            # single buffer of the output band, consumed by the next layer
+            layer_tk['l1_y_offset'] = offset
+            offset += int(math.ceil(max(band[i][4] for band in bands) * layer['output_dimensions'][1] * layer['output_channels'] * ds_y / 8.0 / 4.0)) * 4 + 8
+        if layer['op'] == 'conv':
+            layer_tk['out_shift'] = layer['outshift']['value'] if i < len(layers) - 1 else None
+            layer_tk['off_W'] = W_offset
+            W_offset += int(math.ceil(layer['output_channels'] * layer['input_channels'] * layer['kernel_shape'][0] * layer['kernel_shape'][1] / 4.0)) * 4
+            layer_tk['off_k'] = W_offset
+            layer_tk['off_lambda'] = W_offset + int(layer['output_channels'] * ds_act / 8)
+            W_offset += 2 * int(layer['output_channels'] * ds_act / 8)
+        tk['layers'].append(layer_tk)
+    tk['W_size_byte'] = int(node.tiling_dimensions["L2"]["weight_memory"] + node.tiling_dimensions["L2"]["constants_memory"])
+    tk['l1_W_offset'] = offset
+    tk['buffer_l1_all'] = offset + tk['W_size_byte'] + 8
+
+    l = ""
+    for k, v in tk.items():
+        l += f"// {k.ljust(30)} {v}\n"
+    tk['verbose_log'] = l
+
+    return tk
@@ -37,6 +37,8 @@ def print_template_Makefile(
 
     tk['n_inputs'] = graph[0].n_test_inputs
     tk['prefix'] = graph[0].prefix
+    if HW_description.get("packed_weights", False):
+        file_list_w = [graph[0].prefix + "weights.hex"]
     tk['layers_w'] = file_list_w
     tk['sdk'] = HW_description["software development kit"]["name"]
     tk['do_flash'] = HW_description["memory"]["levels"] > 2
@@ -46,6 +48,8 @@ def print_template_Makefile(
         print("Makefile template writer: key 'always_blocking_dma_transfers' not found in HW description, using non-blocking transfers!")
         blocking_dma_transfers = False
     tk['blocking_dma'] = blocking_dma_transfers
+    # depth of the mchan command queue: transfers block only when it is full, see dory_dma.c
+    tk['dma_queue_depth'] = HW_description.get("dma_queue_depth", False)
     try:
         single_core_dma = HW_description['single_core_dma']
     except KeyError:
@@ -57,6 +61,12 @@ def print_template_Makefile(
             f"Requested mchan check end policy {HW_description['mchan_check_end_policy']} not supported: {supported_policies}"
         tk['mchan_check_end_policy'] = HW_description['mchan_check_end_policy']
     tk['single_core_dma'] = single_core_dma
+    try:
+        resident_cluster = HW_description['resident_cluster']
+    except KeyError:
+        print("Makefile template writer: key 'resident_cluster' not found in HW description, allocating L1 at every inference!")
+        resident_cluster = False
+    tk['resident_cluster'] = resident_cluster
     root = os.path.realpath(os.path.dirname(__file__))
     tmpl = Template(filename=os.path.join(root, "../../Hardware_targets", HW_description["name"], template_location_rel))
     s = tmpl.render(**tk)
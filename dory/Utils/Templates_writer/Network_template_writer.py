@@ -23,6 +23,53 @@ import os
 from . import writer_utils as utils
 
 
+def camera_preprocessing(node, config):
+    # Parameters of the cluster stage turning a camera frame into the input of the first layer:
+    # crop, downscale to the input dimensions of the layer and requantization of
+    # (pixel - mean) * scale to its input bits. The scale is applied as mult / 2^shift.
+    # Without a "preprocessing" entry in the config file the whole frame is resized and
+    # nothing is reported when the network input cannot be produced from the camera.
+    if config is None:
+        if node.input_activation_bits > 8:
+            return None
+        config = {}
+    camera = config.get("camera", [122, 162])
+    crop = config.get("crop", [0, 0, camera[0], camera[1]])
+    resize = config.get("resize", "bilinear")
+    bits = node.input_activation_bits
+    if resize not in ["bilinear", "area"]:
+        print("  Preprocessing ERROR: resize {} not supported, use bilinear or area. Exiting...".format(resize))
+        os._exit(0)
+    if bits > 8:
+        print("  Preprocessing ERROR: input of {} bits, only up to 8 bits are supported. Exiting...".format(bits))
+        os._exit(0)
+    if crop[0] < 0 or crop[1] < 0 or crop[0] + crop[2] > camera[0] or crop[1] + crop[3] > camera[1]:
+        print("  Preprocessing ERROR: crop {} outside of the {}x{} camera frame. Exiting...".format(crop, camera[0], camera[1]))
+        os._exit(0)
+    scale = float(config.get("scale", 1.0))
+    shift = 0
+    while shift < 24 and abs(scale) * 2 ** (shift + 1) < 2 ** 15:
+        shift += 1
+    if node.input_activation_type == "int":
+        out_min, out_max = -2 ** (bits - 1), 2 ** (bits - 1) - 1
+    else:
+        out_min, out_max = 0, 2 ** bits - 1
+    return {
+        "camera_height": camera[0],
+        "camera_width": camera[1],
+        "crop": crop,
+        "height": node.input_dimensions[0],
+        "width": node.input_dimensions[1],
+        "channels": node.input_channels,
+        "area": int(resize == "area"),
+        "mean": int(round(float(config.get("mean", 0.0)) * 256)),
+        "mult": int(round(scale * 2 ** shift)),
+        "shift": shift,
+        "out_min": out_min,
+        "out_max": out_max,
+    }
+
+
 def print_template_network(
     graph,
     HW_description,
@@ -32,8 +79,14 @@ def print_template_network(
     app_directory,
     inc_dir_rel,
     src_dir_rel,
-    tmpl_dir
+    tmpl_dir,
+    l2_plan=None,
+    dvfs_plan=None,
+    resident_weights=None,
+    prefetch_weights=None,
+    stream_input=False
 ):
+    # The plans are computed by Parser_HW_to_C, see Network_planner
     # Generate the Network management c file.
     tk = OrderedDict([])
     prefix = graph[0].prefix
@@ -44,7 +97,7 @@ def print_template_network(
         tk['verbose'] = False
     weights_number = 0
     for nodes in graph:
-        if 'FullyConnected' in nodes.name or 'Conv' in nodes.name:
+        if nodes.has_weights():
             weights_number += 1
     tk['weights_number'] = weights_number
     tk['verbose_level'] = verbose_level
@@ -53,17 +106,26 @@ def print_template_network(
     tk['master_stack'] = HW_description["HW specific parameters"]["accelerator core0 stack"] 
     tk['slave_stack'] = HW_description["HW specific parameters"]["accelerator core1-7 stack"]
     tk['l2_buffer_size'] = HW_description["memory"]["L2"]["dimension"] - config_file["code reserved space"] 
+    if resident_weights is not None:
+        tk['l2_buffer_size'] -= resident_weights["size"]
+    # L2 reserved by the target for the input frames of the application, see GAP8_drone_db
+    tk['frame_ring_size'] = config_file.get("frame ring size", 0)
     MACs = 0
     file_list_w = []
     list_h = []
     list_name = []
     for i, node in enumerate(graph):
         MACs += node.MACs
-        if "Conv" in node.name or "FullyConnected" in node.name:
+        if node.has_weights():
             file_list_w.append(node.prefixed_name+"_weights.hex")
         list_h.append(node.prefixed_name+".h")
         list_name.append(node.prefixed_name)
     tk['MACs'] = MACs
+    tk['packed_weights'] = HW_description.get("packed_weights", False)
+    if tk['packed_weights']:
+        # Single blob holding the weights of all layers, see Parser_HW_to_C.create_hex_weights_files
+        file_list_w = [prefix + "weights.hex"]
+        tk['weights_blob_sizes'] = [len(node.weights_blob()) for node in graph if node.has_weights()]
     tk['files_list'] = utils.print_file_list(file_list_w)
     if "soc voltage" in HW_description:
         tk['soc_voltage_mv'] = int(HW_description["soc voltage"] * 1000)  # to mV
@@ -74,6 +136,11 @@ def print_template_network(
     else:
         tk['periph_frequency'] = None
     tk['sdk'] = HW_description["software development kit"]["name"]
+    tk['prefetch_weights'] = prefetch_weights if prefetch_weights is not None else [0] * len(graph)
+    # the L3 activations buffers also hold the compressed outputs and their rows table
+    tk['l3_activations_size'] = max([1500000] + [node.compressed_output["l3_size"] for node in graph
+                                                 if node.compressed_output is not None])
+    tk['stream_input'] = stream_input
     list_h = list(set(list_h))
     tk['list_h'] = list_h
     tk['func_name'] = list_name
@@ -88,6 +155,10 @@ def print_template_network(
             except (TypeError, IndexError):
                 l += "// %s %s\n" % (k.ljust(30), v)
     tk['DORY_HW_graph'] = graph
+    tk['l2_plan'] = l2_plan
+    tk['dvfs_plan'] = dvfs_plan
+    tk['resident_weights'] = resident_weights
+    tk['preprocessing'] = camera_preprocessing(graph[0], config_file.get("preprocessing"))
 
     tmpl = Template(filename=os.path.join(tmpl_dir, "network_c_template.c"))
     s = tmpl.render(verbose_log=l, **tk)
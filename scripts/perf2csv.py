@@ -5,10 +5,13 @@ import argparse
 
 parser = argparse.ArgumentParser()
 parser.add_argument('--output', '-o', default='perf.csv', help='Path to output csv file.')
+parser.add_argument('--extended-output', '-e', default='perf_extended.csv',
+                    help='Path to output csv file of the PERF_LAYER_EXTENDED tables, if any.')
 args = parser.parse_args()
 
 regex_perf = re.compile(r"(.+) performance:\n  - num cycles: (\d+)\n  - MACs: (\d+)\n  - MAC/cycle: (.+)",
                         re.MULTILINE)
+regex_extended = re.compile(r"^PERF_EXTENDED (.+)$", re.MULTILINE)
 
 data = sys.stdin.read()
 
@@ -16,8 +19,55 @@ csv_list = [["Name", "Latency", "Ops", "Perf"]]
 
 for match in regex_perf.finditer(data):
     csv_list.append([match.group(1), match.group(2), match.group(3), match.group(4)])
-    
+
 
 with open(args.output, "w") as f:
     writer = csv.writer(f)
     writer.writerows(csv_list)
+
+
+# PERF_LAYER_EXTENDED: one table every PERF_EXTENDED_EVENTS runs, with the sum and
+# the maximum over the cores of every event. The tables of all the runs are averaged.
+header = None
+layers = {}
+for match in regex_extended.finditer(data):
+    row = match.group(1).split(",")
+    if row[0] == "Layer":
+        header = row
+        continue
+    if header is None:
+        continue
+    values = [float(v) for v in row[1:]]
+    if row[0] in layers:
+        layers[row[0]][0] += 1
+        layers[row[0]][1] = [a + b for a, b in zip(layers[row[0]][1], values)]
+    else:
+        layers[row[0]] = [1, values]
+
+if header is not None:
+    def ratio(a, b):
+        return a / b if b > 0 else 0
+
+    extended_list = [header + ["MAC/cycle", "IPC", "Idle fraction", "Stall fraction", "Load stall fraction",
+                               "TCDM contention fraction", "Icache miss fraction", "Jump stall fraction",
+                               "Imbalance"]]
+    for name, (count, values) in layers.items():
+        event = dict(zip(header[1:], [v / count for v in values]))
+        stalls = event["load stalls"] + event["tcdm contention"] + event["icache misses"] + event["jump stalls"]
+        extended_list.append([name] + ["{:.0f}".format(event[column]) for column in header[1:]] + [
+            # the layer lasts as long as its slowest core
+            "{:.3f}".format(ratio(event["MACs"], event["cycles max"])),
+            "{:.3f}".format(ratio(event["instructions"], event["active cycles"])),
+            # cycles spent clock gated, waiting on barriers and DMA transfers
+            "{:.3f}".format(1 - ratio(event["active cycles"], event["cycles"])),
+            "{:.3f}".format(ratio(stalls, event["active cycles"])),
+            "{:.3f}".format(ratio(event["load stalls"], event["active cycles"])),
+            "{:.3f}".format(ratio(event["tcdm contention"], event["active cycles"])),
+            "{:.3f}".format(ratio(event["icache misses"], event["active cycles"])),
+            "{:.3f}".format(ratio(event["jump stalls"], event["active cycles"])),
+            # busiest core against the average core
+            "{:.3f}".format(ratio(event["active cycles max"] * event["Cores"], event["active cycles"]))])
+
+    with open(args.extended_output, "w") as f:
+        writer = csv.writer(f)
+        writer.writerows(extended_list)
@@ -0,0 +1,49 @@
+import sys
+import csv
+import argparse
+
+parser = argparse.ArgumentParser(description='Compare the cycles predicted by the L2-L1 cost model '
+                                             '(perf_model.csv in the generated application) '
+                                             'with a PERF_LAYER run converted by perf2csv.py.')
+parser.add_argument('--model', '-m', default='application/perf_model.csv', help='Path to the predicted csv file.')
+parser.add_argument('--measured', '-p', default='perf.csv', help='Path to the measured csv file.')
+parser.add_argument('--output', '-o', default=None, help='Optional path to the comparison csv file.')
+parser.add_argument('--tolerance', '-t', type=float, default=None,
+                    help='Exit with an error if the mean absolute error is above this percentage.')
+args = parser.parse_args()
+
+
+def read_latencies(path):
+    with open(path) as f:
+        return {row["Name"]: int(row["Latency"]) for row in csv.DictReader(f)}
+
+
+predicted = read_latencies(args.model)
+measured = read_latencies(args.measured)
+
+csv_list = [["Name", "Predicted", "Measured", "Error"]]
+errors = []
+for name, cycles in measured.items():
+    if name not in predicted:
+        continue
+    error = (predicted[name] - cycles) / cycles * 100
+    errors.append(abs(error))
+    csv_list.append([name, predicted[name], cycles, "{:.1f}".format(error)])
+
+if len(errors) == 0:
+    print("No layer in common between {} and {}.".format(args.model, args.measured))
+    sys.exit(1)
+
+print("{:<40} {:>12} {:>12} {:>8}".format(*csv_list[0]))
+for row in csv_list[1:]:
+    print("{:<40} {:>12} {:>12} {:>7}%".format(*row))
+mean_error = sum(errors) / len(errors)
+print("Mean absolute error on {} layers: {:.1f}%, worst: {:.1f}%".format(len(errors), mean_error, max(errors)))
+
+if args.output is not None:
+    with open(args.output, "w") as f:
+        writer = csv.writer(f)
+        writer.writerows(csv_list)
+
+if args.tolerance is not None and mean_error > args.tolerance:
+    sys.exit(1)
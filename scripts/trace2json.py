@@ -0,0 +1,151 @@
+import re
+import sys
+import json
+import struct
+import argparse
+
+parser = argparse.ArgumentParser(description='Convert a trace recorded with -DTRACE (see dory_trace.h) to the '
+                                             'Chrome trace format, to be opened in chrome://tracing or Perfetto. '
+                                             'The trace is read from the binary TRACE_FILE or from the '
+                                             'application output on stdin.')
+parser.add_argument('--input', '-i', default=None, help='Path to the binary trace file. Default: application output on stdin.')
+parser.add_argument('--output', '-o', default='trace.json', help='Path to the output json file.')
+parser.add_argument('--frequency', '-f', type=float, default=175, help='Cluster frequency in MHz.')
+parser.add_argument('--network', '-n', default=None, help='Optional path to the generated network.h, to name the layers.')
+args = parser.parse_args()
+
+MAGIC = 0x43525444
+EVENTS = ["run", "layer_start", "layer_end", "dma_issue", "dma_wait_start", "dma_wait_end",
+          "kernel_start", "kernel_end", "l3_read_start", "l3_read_end", "l3_write_start", "l3_write_end"]
+EVENT = {name: i for i, name in enumerate(EVENTS)}
+
+
+def read_trace():
+    if args.input is not None:
+        with open(args.input, "rb") as f:
+            return f.read()
+    words = []
+    inside = False
+    for line in sys.stdin:
+        line = line.strip()
+        if line == "TRACE BEGIN":
+            inside, words = True, []
+        elif line == "TRACE END":
+            inside = False
+        elif inside and line.startswith("TRACE "):
+            words += [int(w, 16) for w in line.split()[1:]]
+    return struct.pack("<{}I".format(len(words)), *words)
+
+
+def layer_names():
+    if args.network is None:
+        return None
+    with open(args.network) as f:
+        match = re.search(r"Layers_name\[\d+\] = \{(.*?)\};", f.read(), re.DOTALL)
+    return re.findall(r'"([^"]*)"', match.group(1)) if match else None
+
+
+data = read_trace()
+if len(data) < 16:
+    print("No trace found.")
+    sys.exit(1)
+magic, version, cores, ring = struct.unpack_from("<4I", data)
+if magic != MAGIC:
+    print("Not a DORY trace (magic 0x{:08x}).".format(magic))
+    sys.exit(1)
+counts = struct.unpack_from("<{}I".format(cores), data, 16)
+offset = 16 + 4 * cores
+per_core = []
+for core in range(cores):
+    per_core.append([struct.unpack_from("<IBBH", data, offset + 8 * i) for i in range(counts[core])])
+    offset += 8 * counts[core]
+
+# Timestamps restart at every network run: runs are laid out one after the other.
+# Events recorded before the first run start still in a ring belong to the previous run,
+# or to the last run when the ring only holds events of that run.
+runs = {}
+last_run = max([arg for events in per_core for _, kind, _, arg in events if kind == EVENT["run"]] + [0])
+for core, events in enumerate(per_core):
+    starts = [arg for cycles, kind, _, arg in events if kind == EVENT["run"]]
+    run = starts[0] - 1 if len(starts) > 0 else last_run
+    tagged = []
+    for cycles, kind, _, arg in events:
+        if kind == EVENT["run"]:
+            run = arg
+        tagged.append((run, cycles, kind, arg))
+        runs[run] = max(runs.get(run, 0), cycles)
+    per_core[core] = tagged
+run_offset, start = {}, 0
+for run in sorted(runs):
+    run_offset[run] = start
+    start += runs[run] + 1
+
+names = layer_names()
+trace = []
+for core in range(cores):
+    for track, label in enumerate(["", " DMA", " L3"]):
+        trace.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": core * 3 + track,
+                      "args": {"name": "core {}{}".format(core, label)}})
+
+async_id = 0
+summary = {}
+for core, events in enumerate(per_core):
+    dma_issued = []
+    l3_pending = {"read": [], "write": []}
+    kernel_start = {}
+    wait_start = None
+    for run, cycles, kind, arg in events:
+        ts = (run_offset[run] + cycles) / args.frequency
+        event = {"pid": 0, "tid": core * 3, "ts": ts}
+        if kind == EVENT["run"]:
+            event.update({"ph": "i", "s": "t", "name": "run {}".format(arg)})
+        elif kind in [EVENT["layer_start"], EVENT["layer_end"]]:
+            layer = names[arg] if names is not None and arg < len(names) else "layer {}".format(arg)
+            event.update({"ph": "B" if kind == EVENT["layer_start"] else "E", "name": layer, "cat": "layer"})
+        elif kind in [EVENT["kernel_start"], EVENT["kernel_end"]]:
+            event.update({"ph": "B" if kind == EVENT["kernel_start"] else "E", "name": "tile {}".format(arg), "cat": "kernel"})
+            if kind == EVENT["kernel_start"]:
+                kernel_start[arg] = cycles
+            elif arg in kernel_start:
+                busy = summary.setdefault(core, [0, 0])
+                busy[0] += cycles - kernel_start.pop(arg)
+        elif kind in [EVENT["dma_wait_start"], EVENT["dma_wait_end"]]:
+            event.update({"ph": "B" if kind == EVENT["dma_wait_start"] else "E", "name": "dma wait", "cat": "dma"})
+            if kind == EVENT["dma_wait_start"]:
+                wait_start = cycles
+            else:
+                if wait_start is not None:
+                    summary.setdefault(core, [0, 0])[1] += cycles - wait_start
+                # every transfer issued so far is over: one async span per transfer on the DMA track
+                for issue_ts, direction in dma_issued:
+                    async_id += 1
+                    span = {"pid": 0, "tid": core * 3 + 1, "cat": "dma", "id": async_id,
+                            "name": "L2->L1" if direction == 1 else "L1->L2"}
+                    trace.append(dict(span, ph="b", ts=issue_ts))
+                    trace.append(dict(span, ph="e", ts=ts))
+                dma_issued = []
+        elif kind == EVENT["dma_issue"]:
+            dma_issued.append((ts, arg))
+            event.update({"ph": "i", "s": "t", "name": "dma issue", "cat": "dma"})
+        else:
+            # L3 transfers complete in order: each end closes the oldest pending one
+            direction = "read" if kind in [EVENT["l3_read_start"], EVENT["l3_read_end"]] else "write"
+            if kind in [EVENT["l3_read_start"], EVENT["l3_write_start"]]:
+                l3_pending[direction].append((ts, arg * 16))
+            elif len(l3_pending[direction]) > 0:
+                issue_ts, size = l3_pending[direction].pop(0)
+                async_id += 1
+                span = {"pid": 0, "tid": core * 3 + 2, "cat": "l3", "id": async_id,
+                        "name": "L3 {}".format(direction), "args": {"bytes": size}}
+                trace.append(dict(span, ph="b", ts=issue_ts))
+                trace.append(dict(span, ph="e", ts=ts))
+            continue
+        trace.append(event)
+
+with open(args.output, "w") as f:
+    json.dump({"traceEvents": trace, "displayTimeUnit": "ns"}, f)
+
+print("{} events of {} cores in {} runs written to {}.".format(sum(counts), cores, len(runs), args.output))
+print("{:<6} {:>14} {:>14}".format("Core", "Kernel us", "DMA wait us"))
+for core in sorted(summary):
+    print("{:<6} {:>14.1f} {:>14.1f}".format(core, summary[core][0] / args.frequency, summary[core][1] / args.frequency))
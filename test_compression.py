@@ -0,0 +1,166 @@
+import os
+import random
+import shutil
+import subprocess
+from types import SimpleNamespace
+
+import numpy as np
+import pytest
+
+from dory.Parsers.HW_node import HW_node
+
+
+utils = os.path.join(os.path.dirname(os.path.abspath(__file__)), "dory", "Hardware_targets", "PULP", "Common", "Utils")
+
+# Runs the codecs of the cluster on the host, one thread per core
+pmsis = r'''
+#include <pthread.h>
+extern __thread int core_id;
+extern pthread_barrier_t barrier;
+static inline int pi_core_id(void) { return core_id; }
+static inline void pi_cl_team_barrier(int id) { (void) id; pthread_barrier_wait(&barrier); }
+'''
+
+main = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pmsis.h"
+#include "dory_weights_decoder.h"
+#include "dory_activations_codec.h"
+__thread int core_id;
+pthread_barrier_t barrier;
+static uint32_t src[1 << 16], dst[1 << 16], decoded[1 << 16], offset[1 << 12];
+static int weights, a, b, c;
+
+static void *run(void *id) {
+  core_id = (int) (intptr_t) id;
+  if (weights) {
+    dory_weights_decode(src, dst, a, b, c);
+  } else {
+    dory_activations_encode(src, dst, offset, a, b);
+    dory_activations_decode(dst, decoded, offset, a, b);
+  }
+  return NULL;
+}
+
+// weights channels channel_size tail_size < compressed tile > weights
+// activations rows row_size < rows > offsets, compressed rows, expanded rows
+int main(int argc, char **argv) {
+  pthread_t threads[NUM_CORES];
+  weights = strcmp(argv[1], "weights") == 0;
+  a = atoi(argv[2]), b = atoi(argv[3]), c = argc > 4 ? atoi(argv[4]) : 0;
+  fread(src, 1, sizeof(src), stdin);
+  pthread_barrier_init(&barrier, NULL, NUM_CORES);
+  for (int i = 0; i < NUM_CORES; i++)
+    pthread_create(&threads[i], NULL, run, (void *) (intptr_t) i);
+  for (int i = 0; i < NUM_CORES; i++)
+    pthread_join(threads[i], NULL);
+  if (weights) {
+    fwrite(dst, 1, a * b + c, stdout);
+  } else {
+    fwrite(offset, 4, a + 1, stdout);
+    fwrite(dst, 1, offset[a], stdout);
+    fwrite(decoded, 1, a * b, stdout);
+  }
+  return 0;
+}
+'''
+
+
+@pytest.fixture(scope="module")
+def codecs(tmp_path_factory):
+    if shutil.which("gcc") is None:
+        pytest.skip("gcc not found")
+    build = tmp_path_factory.mktemp("codecs")
+    (build / "pmsis.h").write_text(pmsis)
+    (build / "main.c").write_text(main)
+    binary = str(build / "codecs")
+    subprocess.run(["gcc", "-O2", "-DNUM_CORES=8", "-I", str(build), "-I", utils, str(build / "main.c"),
+                    os.path.join(utils, "dory_weights_decoder.c"), os.path.join(utils, "dory_activations_codec.c"),
+                    "-o", binary, "-lpthread"], check=True)
+
+    def run(*args, data):
+        return subprocess.run([binary] + [str(a) for a in args], input=data, capture_output=True, check=True).stdout
+    return run
+
+
+def weights_node(channels, channel_size, tail_size, n_tiles, seed):
+    # int8 weights of every channel within a random width, followed by bias, k and lambda
+    rng = random.Random(seed)
+    blob = []
+    for tile in range(n_tiles):
+        for c in range(channels):
+            bits = rng.randint(1, 8)
+            blob += [rng.randint(-(1 << (bits - 1)), (1 << (bits - 1)) - 1) & 0xff for _ in range(channel_size)]
+        blob += [rng.randint(0, 255) for _ in range(tail_size)]
+    node = SimpleNamespace(tiling_dimensions={"L2": {
+        "weights_dimensions": [channels, channel_size], "weight_memory": channels * channel_size,
+        "bias_memory": 0, "constants_memory": tail_size}})
+    node.weights_blob = lambda: np.asarray(blob, dtype='uint8')
+    node.l3_weights_tiles = lambda: n_tiles
+    tile_size = channels * channel_size + tail_size
+    return node, [bytes(blob[t * tile_size:(t + 1) * tile_size]) for t in range(n_tiles)]
+
+
+def decode_weights(tile, channels, channel_size, tail_size):
+    # Reference decoder of the format documented in HW_node.compressed_weights_tiles
+    header = [int.from_bytes(tile[4 * c:4 * c + 4], "little") for c in range(channels + 1)]
+    weights = b""
+    for c in range(channels):
+        offset, bits = header[c] >> 4, header[c] & 0xf
+        stream = int.from_bytes(tile[offset:], "little")
+        for i in range(channel_size):
+            value = (stream >> (i * bits)) & ((1 << bits) - 1)
+            if value >> (bits - 1):
+                value -= 1 << bits
+            weights += bytes([value & 0xff])
+    return weights + tile[header[channels]:header[channels] + tail_size]
+
+
+def decode_activations(table, rows, row_size):
+    # Reference decoder of the format documented in dory_activations_codec.h
+    offset = [int.from_bytes(table[4 * r:4 * r + 4], "little") for r in range(rows + 1)]
+    data = table[4 * (rows + 1):]
+    expanded = b""
+    for r in range(rows):
+        row = data[offset[r] - offset[0]:offset[r + 1] - offset[0]]
+        if len(row) == row_size:
+            expanded += row
+            continue
+        bitmap, values = row[:(row_size + 7) // 8], iter(row[(row_size + 7) // 8:])
+        expanded += bytes(next(values) if bitmap[i // 8] >> (i % 8) & 1 else 0 for i in range(row_size))
+        assert next(values, None) is None
+    return expanded
+
+
+@pytest.mark.parametrize("channels, channel_size, tail_size", [(1, 9, 0), (16, 27, 16 * 9), (13, 50, 4 * 13), (32, 1, 0)])
+def test_weights_codec(codecs, channels, channel_size, tail_size):
+    node, tiles = weights_node(channels, channel_size, tail_size, 3, channels * channel_size)
+    compressed = HW_node.compressed_weights_tiles(node)
+    assert len(compressed) == len(tiles)
+    for tile, raw in zip(compressed, tiles):
+        assert len(tile) % 4 == 0
+        assert decode_weights(tile, channels, channel_size, tail_size) == raw
+        assert codecs("weights", channels, channel_size, tail_size, data=tile) == raw
+
+
+def test_weights_codec_narrow_channels():
+    # channels of small weights are stored with fewer bits
+    node, tiles = weights_node(8, 64, 0, 1, 0)
+    node.weights_blob = lambda: np.asarray([1, 0xff, 0, 1] * 128, dtype='uint8')
+    tile = HW_node.compressed_weights_tiles(node)[0]
+    assert all(int.from_bytes(tile[4 * c:4 * c + 4], "little") & 0xf == 2 for c in range(8))
+    assert len(tile) == 4 * 9 + 8 * 64 * 2 // 8
+
+
+@pytest.mark.parametrize("rows, row_size, zeros", [(1, 1, 0.5), (7, 40, 0.0), (20, 99, 0.7), (33, 8, 1.0), (64, 3, 0.3)])
+def test_activations_codec(codecs, rows, row_size, zeros):
+    rng = random.Random(rows * row_size)
+    raw = bytes(0 if rng.random() < zeros else rng.randint(1, 255) for _ in range(rows * row_size))
+    out = codecs("activations", rows, row_size, data=raw)
+    table, expanded = out[:-rows * row_size], out[-rows * row_size:]
+    assert expanded == raw
+    assert decode_activations(table, rows, row_size) == raw
+    # a row is never stored bigger than it is
+    assert len(table) - 4 * (rows + 1) <= rows * row_size
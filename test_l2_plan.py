@@ -0,0 +1,150 @@
+from types import SimpleNamespace
+
+import pytest
+
+from dory.Parsers import Network_planner
+
+
+HW_description = {"name": "PULP/GAP8", "memory": {"levels": 3}, "static_l2_plan": True, "resident_weights": True}
+
+
+def node(i, name, input_memory, output_memory, weight_memory, inputs):
+    dims = {"input_dimensions": [1, 1, 1], "output_dimensions": [1, 1, 1], "weights_dimensions": [1, 1]}
+    memory = {"input_activation_memory": input_memory, "output_activation_memory": output_memory,
+              "weight_memory": weight_memory, "constants_memory": 0, "bias_memory": 0}
+    n = SimpleNamespace(
+        name=name + str(i), HW_description=HW_description, input_indexes=[str(k) for k in inputs], output_index=str(i + 1),
+        L3_input=0, branch_change=0, compressed_weights=None, compressed_input=None, compressed_output=None, MACs=1000,
+        tiling_dimensions={"L2": dict(dims, **memory), "L3": dict(dims, **memory)}, **memory)
+    n.has_weights = lambda: "Conv" in n.name or "FullyConnected" in n.name
+    return n
+
+
+def residual_network():
+    # 0 conv -> 1 conv -> 2 conv -> 3 add(2, 0) -> 4 fc: the output of 0 is a residual
+    return [node(0, "Convolution", 1000, 4000, 2000, [0]),
+            node(1, "Convolution", 4000, 4000, 3000, [1]),
+            node(2, "Convolution", 4000, 4000, 3000, [2]),
+            node(3, "Addition", 4000, 4000, 0, [3, 1]),
+            node(4, "FullyConnected", 4000, 10, 5000, [4])]
+
+
+def long_residual_network():
+    # 0 conv -> 1 conv -> 2 conv -> 3 conv -> 4 add(3, 0) -> 5 fc: the peak is at 3, while the output of 0 is alive
+    return [node(0, "Convolution", 1000, 4000, 100, [0]),
+            node(1, "Convolution", 4000, 1000, 100, [1]),
+            node(2, "Convolution", 1000, 8000, 100, [2]),
+            node(3, "Convolution", 8000, 4000, 100, [3]),
+            node(4, "Addition", 4000, 4000, 0, [4, 1]),
+            node(5, "FullyConnected", 4000, 10, 100, [5])]
+
+
+def live_buffers(graph, plan, budget, resident_weights=None):
+    # Buffers of the plan alive at every layer, rebuilt from the offsets: tensor -> (offset, size, first, last)
+    inputs, _ = Network_planner.activation_inputs(graph)
+    prefetch = Network_planner.weights_prefetch_plan(graph, budget, resident_weights)
+    output_size = [n.output_activation_memory for n in graph]
+    buffers = {}
+
+    def use(key, offset, size, layer):
+        # the network input is pinned at the beginning of the buffer, or is not in it
+        if offset == -2 and not plan["input_in_buffer"]:
+            return
+        offset = 0 if offset == -2 else offset
+        if key in buffers:
+            assert buffers[key][:2] == (offset, size), key
+            buffers[key] = (offset, size, min(buffers[key][2], layer), max(buffers[key][3], layer))
+        else:
+            buffers[key] = (offset, size, layer, layer)
+
+    for i, n in enumerate(graph):
+        main, bypasses = inputs[i]
+        use(("act", i), plan["output"][i], output_size[i], i)
+        if plan["reload_input"][i] >= 0:
+            use(("reload", main, i), plan["input"][i], n.input_activation_memory, i)
+        else:
+            use(("act", main), plan["input"][i], n.input_activation_memory if main == -1 else output_size[main], i)
+        for bypass in bypasses:
+            if plan["reload_bypass"][i] >= 0:
+                use(("reload", bypass, i), plan["bypass"][i], output_size[bypass], i)
+            else:
+                use(("act", bypass), plan["bypass"][i], output_size[bypass], i)
+        if plan["weights"][i] >= 0:
+            use(("w", i), plan["weights"][i], n.weight_memory, i)
+            if prefetch[i] == 1:
+                use(("w", i), plan["weights"][i], n.weight_memory, i - 1)
+    return buffers
+
+
+def assert_valid_plan(graph, plan, budget, resident_weights=None):
+    buffers = live_buffers(graph, plan, budget, resident_weights)
+    assert plan["size"] <= budget
+    assert max(offset + size for offset, size, _, _ in buffers.values()) <= plan["size"]
+    for layer in range(len(graph)):
+        alive = sorted((offset, size, key) for key, (offset, size, first, last) in buffers.items() if first <= layer <= last)
+        for (offset, size, key), (next_offset, _, next_key) in zip(alive, alive[1:]):
+            assert offset + size <= next_offset, "{} overlaps {} at layer {}".format(key, next_key, layer)
+
+
+def test_plan_keeps_residuals():
+    graph = residual_network()
+    plan = Network_planner.l2_memory_plan(graph, HW_description, 40000)
+    assert plan is not None
+    assert plan["residuals"] == 1 and sum(plan["spill"]) == 0
+    assert plan["bypass"][3] == plan["output"][0]
+    assert_valid_plan(graph, plan, 40000)
+
+
+def test_plan_spills_residuals():
+    graph = long_residual_network()
+    kept = Network_planner.l2_memory_plan(graph, HW_description, 40000)
+    assert sum(kept["spill"]) == 0
+    assert_valid_plan(graph, kept, 40000)
+    # below the peak with the residual in L2: the residual is spilled and read back by the addition
+    budget = kept["size"] - 4
+    plan = Network_planner.l2_memory_plan(graph, HW_description, budget)
+    assert plan is not None
+    assert plan["spill"] == [1, 0, 0, 0, 0, 0]
+    assert plan["reload_bypass"] == [-1, -1, -1, -1, 0, -1] and plan["reload_input"] == [-1] * 6
+    assert plan["size"] < kept["size"]
+    assert_valid_plan(graph, plan, budget)
+
+
+def test_plan_without_bound_input():
+    # an application passing its own input buffer needs no room for it at the beginning of the buffer
+    graph = residual_network()
+    pinned = Network_planner.l2_memory_plan(graph, HW_description, 40000)
+    assert pinned["input_in_buffer"] and pinned["input"][0] == -2
+    assert 0 not in (pinned["output"][0], pinned["weights"][0])
+    bound = Network_planner.l2_memory_plan(graph, dict(HW_description, bound_l2_input=True), 40000)
+    assert not bound["input_in_buffer"] and bound["input"][0] == -2
+    assert 0 in (bound["output"][0], bound["weights"][0])
+    assert_valid_plan(graph, bound, 40000)
+
+
+def test_plan_does_not_fit():
+    graph = residual_network()
+    plan, _ = Network_planner.l2_memory_placement(graph, HW_description, 1000)
+    assert plan["size"] > 1000 and sum(plan["spill"]) == plan["residuals"]
+    assert Network_planner.l2_memory_plan(graph, HW_description, 1000) is None
+
+
+def test_plan_rejects_multiple_bypasses():
+    graph = residual_network()
+    graph[3].input_indexes = ["4", "1", "2"]
+    plan, reason = Network_planner.l2_memory_placement(graph, HW_description, 40000)
+    assert plan is None and "3 activation inputs" in reason
+
+
+@pytest.mark.parametrize("budget", [40000, 20000, 19000, 18000])
+def test_resident_weights_fit_the_plan(budget):
+    # the resident region leaves room for the static plan, residuals included
+    graph = residual_network()
+    resident = Network_planner.weights_residency_plan(graph, HW_description, budget)
+    if resident is None:
+        return
+    plan = Network_planner.l2_memory_plan(graph, HW_description, budget - resident["size"], resident)
+    assert plan is not None
+    for i, n in enumerate(graph):
+        assert resident["offset"][i] < 0 or plan["weights"][i] < 0
+    assert_valid_plan(graph, plan, budget - resident["size"], resident)
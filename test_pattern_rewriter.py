@@ -0,0 +1,111 @@
+import json
+import os
+from functools import partial
+from types import SimpleNamespace
+
+import numpy as np
+import pytest
+
+from dory.Parsers.Layer_node import Layer_node
+from dory.Parsers.HW_node import HW_node
+from dory.Hardware_targets.PULP.Common.HW_Pattern_rewriter import Pattern_rewriter_PULP
+from dory.Hardware_targets.PULP.GAP8.HW_Parser import onnx_manager
+from dory.Hardware_targets.PULP.GAP8.Tiler import Tiler
+
+
+def conv_node(index, in_ch, out_ch, ks, group, h=16, w=16):
+    return SimpleNamespace(
+        name="BNReluConvolution", op_type="BNReluConv", input_indexes=[str(index)], output_index=str(index + 1),
+        input_channels=in_ch, output_channels=out_ch, input_dimensions=[h, w], output_dimensions=[h, w],
+        kernel_shape=[ks, ks], strides=[1, 1], pads=[ks // 2] * 4, dilations=[1, 1], group=group,
+        input_activation_bits=8, output_activation_bits=8, weight_bits=8, constant_bits=32,
+        constant_names=["weights", "k", "l", "outshift"])
+
+
+@pytest.fixture
+def rewriter():
+    def make(graph):
+        pattern_rewriter = Pattern_rewriter_PULP(graph)
+        pattern_rewriter.L1_memory = 64000 - 4096 - 7 * 3072
+        pattern_rewriter.L2_memory = 400000
+        return pattern_rewriter
+    return make
+
+
+def test_depthwise_pointwise_fused(rewriter):
+    dw, pw = conv_node(0, 32, 32, 3, 32), conv_node(1, 32, 64, 1, 1)
+    assert rewriter([dw, pw]).DepthwisePointwise_fusable(dw, pw)
+
+
+@pytest.mark.parametrize("in_ch, out_ch, group", [(32, 32, 8), (32, 64, 32), (32, 32, 1)])
+def test_not_depthwise_not_fused(rewriter, in_ch, out_ch, group):
+    # grouped convolutions with more than one channel per group, or with a channel multiplier,
+    # are not run by the depthwise kernel of the fused layer
+    first, pw = conv_node(0, in_ch, out_ch, 3, group), conv_node(1, out_ch, 64, 1, 1)
+    assert not rewriter([first, pw]).DepthwisePointwise_fusable(first, pw)
+
+
+def test_grouped_convolution_kept_apart(rewriter):
+    # neither a fused depthwise + pointwise nor a fused group
+    grouped, pw = conv_node(0, 32, 32, 3, 8), conv_node(1, 32, 64, 1, 1)
+    graph = rewriter([grouped, pw]).execute("DepthwisePointwise", [0, 1])
+    assert graph == [grouped, pw] and graph[1].name == "BNReluConvolution"
+
+
+def layer_node(index, in_ch, out_ch, ks, group, h=32, w=32):
+    node = Layer_node()
+    for key, value in vars(conv_node(index, in_ch, out_ch, ks, group, h, w)).items():
+        setattr(node, key, value)
+    node.bias_bits, node.conv1d, node.layout = 32, False, "CHW"
+    node.input_activation_type = node.output_activation_type = "uint"
+    node.weights = {"value": np.ones((out_ch, in_ch // group, ks, ks)), "layout": "CoutCinK"}
+    node.k, node.l = {"value": np.ones(out_ch), "layout": ""}, {"value": np.zeros(out_ch), "layout": ""}
+    node.outshift = {"value": 8, "layout": ""}
+    return node
+
+
+@pytest.mark.parametrize("input_L3", [False, True])
+@pytest.mark.parametrize("fused, group", [("DepthwisePointwiseBNReluConvolution", 32), ("FusedGroupBNReluConvolution", 1)])
+def test_fused_node_split_when_input_in_L3(rewriter, input_L3, fused, group, monkeypatch):
+    # a fused node can't read its input from L3: its layers are then tiled as separate nodes
+    def exit(status):
+        pytest.fail("the generation was aborted")
+    monkeypatch.setattr(os, "_exit", exit)
+    with open("dory/Hardware_targets/PULP/GAP8/HW_description.json") as f:
+        HW_description = json.load(f)
+    graph = [layer_node(0, 32, 32, 3, 1), layer_node(1, 32, 32, 3, group), layer_node(2, 32, 64, 1, 1)]
+    graph = rewriter(graph).execute("DepthwisePointwise", [1, 2])
+    assert [node.name for node in graph] == ["BNReluConvolution", fused]
+    for node in graph:
+        node.branch_in = node.branch_out = node.branch_change = node.branch_last = 0
+        node.add_memory_and_MACs()
+
+    parser = object.__new__(onnx_manager)
+    parser.HW_description, parser.config_file = HW_description, {"code reserved space": 0}
+    parser.DORY_Graph = [HW_node(node, HW_description) for node in graph]
+    HW_node.Tiler = partial(Tiler, double_buffering=2)
+    previous = parser.DORY_Graph[0]
+
+    def previous_tiling(previous_node, config_file):
+        # the previous layer leaves its output in L3, in bands of 8 rows
+        previous.tiling_dimensions["L2"]["output_dimensions"] = [32, 8 if input_L3 else 32, 32]
+    previous.create_tiling_dimensions = previous_tiling
+    parser.tiling()
+
+    if input_L3:
+        assert [node.name for node in parser.DORY_Graph] == ["BNReluConvolution"] * 3
+        assert [node.group for node in parser.DORY_Graph] == [1, group, 1]
+        assert parser.DORY_Graph[1].tiling_dimensions["L2"]["input_dimensions"] is not None
+    else:
+        assert parser.DORY_Graph[1].name == fused
+
+
+def test_fused_nodes_exported(rewriter):
+    # fused_chain and unfused_nodes hold weights: the graph dumps only export their geometry and names
+    graph = rewriter([layer_node(0, 16, 16, 3, 1), layer_node(1, 16, 16, 3, 1)]).execute("DepthwisePointwise", [0, 1])
+    assert [node.name for node in graph] == ["FusedGroupBNReluConvolution"]
+    assert len(graph[0].unfused_nodes) == 2
+    exported = json.loads(json.dumps(graph[0].export_to_dict()))
+    assert exported["Layer_node_parameters"]["unfused_nodes"] == ["BNReluConvolution"] * 2
+    onnx_node = graph[0].export_to_onnx()
+    assert all(attribute["name"] not in ["fused_chain", "unfused_nodes"] for attribute in onnx_node["attribute"])
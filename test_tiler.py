@@ -0,0 +1,105 @@
+from types import SimpleNamespace
+
+import pytest
+
+from dory.Hardware_targets.PULP.Common.Tiler.tiler_conv2d import Tiler_Conv2D_PULP
+from dory.Hardware_targets.PULP.Common.Tiler.PulpNNPerfModel import PulpNNPerfModel
+
+
+HW_description = {
+    "memory": {"L1": {"dimension": 64000}, "L2": {"bandwidth": 8}, "levels": 2},
+    "HW specific parameters": {"accelerator core0 stack": 4096, "accelerator core1-7 stack": 3072},
+    "tiler_cost_model": "latency",
+    "dw_cluster_transpose": True,
+}
+L1_memory = 64000 - 4096 - 7 * 3072
+
+
+def conv_node(name, in_ch, out_ch, h, w, ks, strides, group):
+    pads = [ks // 2] * 4
+    h_out = (h + pads[0] + pads[2] - ks) // strides[0] + 1
+    w_out = (w + pads[1] + pads[3] - ks) // strides[1] + 1
+    weights = out_ch * ks * ks * (in_ch if group == 1 else 1)
+    return SimpleNamespace(
+        HW_description=HW_description, name=name, kernel_shape=[ks, ks], strides=list(strides), group=group, pads=pads,
+        input_activation_bits=8, output_activation_bits=8, weight_bits=8, constant_bits=32, constant_names=["k", "l"],
+        dw_input_transpose="dma",
+        input_dimensions=[h, w], output_dimensions=[h_out, w_out], input_channels=in_ch, output_channels=out_ch,
+        tiling_dimensions={"L2": {
+            "input_dimensions": [in_ch, h, w], "output_dimensions": [out_ch, h_out, w_out],
+            "weights_dimensions": [out_ch, in_ch],
+            "input_activation_memory": in_ch * h * w, "output_activation_memory": out_ch * h_out * w_out,
+            "weight_memory": weights, "constants_memory": out_ch * 8, "bias_memory": 0}})
+
+
+def conv_tiler(node):
+    return Tiler_Conv2D_PULP(SimpleNamespace(HW_node=node, double_buffering=2, n_memory_levels=2, code_reserved_space=0))
+
+
+layers = [
+    ("BNReluConvolution", 32, 64, 48, 80, 3, (1, 1), 1),
+    ("BNReluConvolution", 64, 128, 24, 40, 1, (1, 1), 1),
+    ("BNReluConvolution", 64, 64, 48, 80, 3, (2, 2), 64),
+    ("BNReluConvolution", 128, 128, 12, 20, 3, (1, 1), 128),
+    ("BNReluConvolution", 3, 32, 200, 200, 3, (2, 2), 1),
+    ("BNReluConvolution", 16, 32, 40, 80, 3, (1, 2), 1),
+    ("BNReluConvolution", 32, 32, 40, 80, 3, (1, 2), 32),
+    ("FullyConnected", 4096, 256, 1, 1, 1, (1, 1), 1),
+]
+
+
+def test_perf_model_tiling_overhead():
+    # the same conv layer gets slower as the tiles shrink
+    model = PulpNNPerfModel('conv', (3, 3))
+    shape_in, shape_out = (26, 42, 32), (24, 40, 32)
+    whole = model.tiled_layer_latency(shape_in, shape_out, (24, 40, 32))
+    half = model.tiled_layer_latency(shape_in, shape_out, (12, 40, 32))
+    small = model.tiled_layer_latency(shape_in, shape_out, (4, 8, 8))
+    assert whole < half < small
+
+
+def test_perf_model_kernels():
+    # a 3x3 convolution costs more than a pointwise one and less than 9 of them
+    pointwise = PulpNNPerfModel('pointwise', (1, 1)).set_layer((24, 40, 32, 32)).latency
+    conv = PulpNNPerfModel('conv', (3, 3)).set_layer((24, 40, 32, 32)).latency
+    assert pointwise < conv < 9 * pointwise
+    # more output channels, more cycles
+    model = PulpNNPerfModel('conv', (3, 3))
+    assert model.set_layer((24, 40, 16, 32)).latency < model.set_layer((24, 40, 32, 32)).latency
+
+
+def test_perf_model_dw_transpose():
+    # the DMA moves a byte per burst: transposing on the cluster is faster on a typical depthwise tile
+    model = PulpNNPerfModel('depthwise', (3, 3))
+    model.dw_input = 'dma'
+    dma = model.tiled_layer_latency((50, 82, 64), (48, 80, 64), (48, 80, 16))
+    model.dw_input = 'cluster'
+    cluster = model.tiled_layer_latency((50, 82, 64), (48, 80, 64), (48, 80, 16))
+    assert cluster < dma
+
+
+@pytest.mark.parametrize("layer", layers)
+def test_latency_tiling_fits_L1(layer):
+    node = conv_node(*layer)
+    tiler = conv_tiler(node)
+    (tile_n_out, tile_n_in), (_, tile_h_in, tile_w_in), (_, tile_h_out, tile_w_out) = tiler.get_tiling(2)
+    assert tiler.l1_tile_dimension_conv2d_L2(tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out, 2) <= L1_memory
+    assert node.predicted_latency > 0
+    assert 0 < tile_n_out <= node.output_channels
+    assert 0 < tile_h_out <= node.output_dimensions[0] and 0 < tile_w_out <= node.output_dimensions[1]
+    # input tiles cover the output tiles along each axis with the stride of that axis
+    for tile_in, tile_out, axis in [(tile_h_in, tile_h_out, 0), (tile_w_in, tile_w_out, 1)]:
+        if tile_in < node.input_dimensions[axis]:
+            assert tile_in == (tile_out - 1) * node.strides[axis] + node.kernel_shape[axis]
+        else:
+            assert tile_out == node.output_dimensions[axis]
+
+
+def test_latency_tiling_is_the_fastest():
+    # the latency search never returns a tiling slower than the untiled layer, when that fits
+    node = conv_node("BNReluConvolution", 64, 128, 24, 40, 1, (1, 1), 1)
+    tiler = conv_tiler(node)
+    tiler.get_tiling(2)
+    model = PulpNNPerfModel.from_node(node, 2)
+    untiled = tiler.tiled_latency_conv2d_L2(model, [24, 40], [24, 40], 64, 128, (24, 40, 128))
+    assert node.predicted_latency <= untiled